@@ -0,0 +1,414 @@
+#include "affinity.h"
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <utility>
+
+using std::cout;
+using std::endl;
+
+std::vector<omp_place> omp_places;
+
+static std::vector<int> bind_levels;            // OMP_PROC_BIND, one entry per nesting level
+static std::vector<int> worker_place;           // the place each worker is bound to
+static std::vector<std::vector<int>> place_workers;
+
+struct proc_info {
+    int os;
+    int core;
+    int package;
+    int pu;             // HPX (hwloc logical) number
+};
+
+static int read_sys_int( std::string const& path, int fallback ) {
+    std::ifstream in(path);
+    int value;
+    if( in >> value ) {
+        return value;
+    }
+    return fallback;
+}
+
+//The processors this process may run on, in HPX's PU order. hwloc numbers
+// PUs by package, then core, then hardware thread, which the OS numbering
+// doesn't always follow.
+static std::vector<proc_info> read_topology() {
+    std::vector<proc_info> procs;
+    int n = (int) sysconf(_SC_NPROCESSORS_CONF);
+    for( int os = 0; os < n; os++ ) {
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(os) + "/topology/";
+        procs.push_back( { os, read_sys_int( dir + "core_id", os ),
+                           read_sys_int( dir + "physical_package_id", 0 ), 0 } );
+    }
+    std::sort( procs.begin(), procs.end(), []( proc_info const& a, proc_info const& b ) {
+        if( a.package != b.package ) return a.package < b.package;
+        if( a.core != b.core ) return a.core < b.core;
+        return a.os < b.os;
+    } );
+    for( std::size_t i = 0; i < procs.size(); i++ ) {
+        procs[i].pu = (int) i;
+    }
+
+    cpu_set_t allowed;
+    if( sched_getaffinity( 0, sizeof(allowed), &allowed ) == 0 ) {
+        procs.erase( std::remove_if( procs.begin(), procs.end(), [&]( proc_info const& p ) {
+                         return p.os >= CPU_SETSIZE || !CPU_ISSET( p.os, &allowed );
+                     } ), procs.end() );
+    }
+    return procs;
+}
+
+//threads, cores or sockets, optionally with a count like cores(4)
+static bool abstract_places( std::string const& name, std::vector<proc_info> const& procs,
+                             std::vector<std::vector<int>> &places ) {
+    std::map<std::pair<int,int>, std::size_t> groups;
+    for( proc_info const& p : procs ) {
+        std::pair<int,int> key;
+        if( name == "threads" ) {
+            key = std::make_pair( p.pu, 0 );
+        } else if( name == "cores" ) {
+            key = std::make_pair( p.package, p.core );
+        } else if( name == "sockets" ) {
+            key = std::make_pair( p.package, 0 );
+        } else {
+            return false;
+        }
+        auto group = groups.find( key );
+        if( group == groups.end() ) {
+            groups[key] = places.size();
+            places.push_back( { p.os } );
+        } else {
+            places[group->second].push_back( p.os );
+        }
+    }
+    return true;
+}
+
+//Explicit place lists, like {0,1},{2,3} or {0:4}:4:4, with ! to exclude
+// a processor or a place.
+class place_parser {
+    public:
+        place_parser( std::string const& s ) : text(s), pos(0) {}
+
+        bool parse( std::vector<std::vector<int>> &places ) {
+            do {
+                skip_space();
+                bool exclude = accept('!');
+                std::vector<int> place;
+                if( !parse_place( place ) ) {
+                    return false;
+                }
+                if( exclude ) {
+                    places.erase( std::remove( places.begin(), places.end(), place ), places.end() );
+                    continue;
+                }
+                int len = 1, stride = 1;
+                if( !parse_interval( len, stride ) ) {
+                    return false;
+                }
+                for( int i = 0; i < len; i++ ) {
+                    std::vector<int> shifted;
+                    for( int proc : place ) {
+                        shifted.push_back( proc + i * stride );
+                    }
+                    places.push_back( shifted );
+                }
+            } while( accept(',') );
+            skip_space();
+            return pos == text.size();
+        }
+
+    private:
+        bool parse_place( std::vector<int> &place ) {
+            if( !accept('{') ) {
+                return false;
+            }
+            do {
+                skip_space();
+                bool exclude = accept('!');
+                int proc;
+                if( !parse_number( proc ) ) {
+                    return false;
+                }
+                if( exclude ) {
+                    place.erase( std::remove( place.begin(), place.end(), proc ), place.end() );
+                    continue;
+                }
+                int len = 1, stride = 1;
+                if( !parse_interval( len, stride ) ) {
+                    return false;
+                }
+                for( int i = 0; i < len; i++ ) {
+                    if( std::find( place.begin(), place.end(), proc + i * stride ) == place.end() ) {
+                        place.push_back( proc + i * stride );
+                    }
+                }
+            } while( accept(',') );
+            return accept('}');
+        }
+
+        //an optional :len or :len:stride
+        bool parse_interval( int &len, int &stride ) {
+            if( accept(':') ) {
+                if( !parse_number( len ) || len < 1 ) {
+                    return false;
+                }
+                if( accept(':') ) {
+                    return parse_number( stride );
+                }
+            }
+            return true;
+        }
+
+        bool parse_number( int &value ) {
+            skip_space();
+            std::size_t start = pos;
+            if( pos < text.size() && text[pos] == '-' ) {
+                pos++;
+            }
+            while( pos < text.size() && isdigit( text[pos] ) ) {
+                pos++;
+            }
+            if( pos == start || ( pos == start + 1 && text[start] == '-' ) ) {
+                return false;
+            }
+            value = atoi( text.c_str() + start );
+            return true;
+        }
+
+        bool accept( char c ) {
+            skip_space();
+            if( pos < text.size() && text[pos] == c ) {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+
+        void skip_space() {
+            while( pos < text.size() && isspace( text[pos] ) ) {
+                pos++;
+            }
+        }
+
+        std::string text;
+        std::size_t pos;
+};
+
+static std::string lower_case( std::string s ) {
+    std::transform( s.begin(), s.end(), s.begin(), ::tolower );
+    return s;
+}
+
+static std::vector<int> parse_proc_bind( const char *env ) {
+    std::vector<int> levels;
+    std::istringstream list(env);
+    std::string item;
+    while( std::getline( list, item, ',' ) ) {
+        item.erase( std::remove_if( item.begin(), item.end(), ::isspace ), item.end() );
+        item = lower_case( item );
+        if( item == "false" ) {
+            levels.push_back( proc_bind_false );
+        } else if( item == "true" ) {
+            levels.push_back( proc_bind_true );
+        } else if( item == "master" || item == "primary" ) {
+            levels.push_back( proc_bind_master );
+        } else if( item == "close" ) {
+            levels.push_back( proc_bind_close );
+        } else if( item == "spread" ) {
+            levels.push_back( proc_bind_spread );
+        } else {
+            cout << "OMP_PROC_BIND: ignoring unknown policy " << item << endl;
+        }
+    }
+    return levels;
+}
+
+static bool parse_places( std::string const& env, std::vector<proc_info> const& procs,
+                          std::vector<std::vector<int>> &places ) {
+    std::string name = lower_case( env );
+    name.erase( std::remove_if( name.begin(), name.end(), ::isspace ), name.end() );
+    std::size_t count_pos = name.find('(');
+    if( !name.empty() && name[0] != '{' && name[0] != '!' ) {
+        std::size_t count = std::string::npos;
+        if( count_pos != std::string::npos ) {
+            count = atoi( name.c_str() + count_pos + 1 );
+            name = name.substr( 0, count_pos );
+        }
+        if( !abstract_places( name, procs, places ) ) {
+            return false;
+        }
+        if( places.size() > count ) {
+            places.resize( count );
+        }
+        return true;
+    }
+    return place_parser( env ).parse( places );
+}
+
+int affinity_worker_place( int worker ) {
+    if( worker < 0 || worker >= (int) worker_place.size() ) {
+        return -1;
+    }
+    return worker_place[worker];
+}
+
+int affinity_bind_var( int levels ) {
+    if( bind_levels.empty() ) {
+        return proc_bind_false;
+    }
+    return bind_levels[ std::min<std::size_t>( levels, bind_levels.size() - 1 ) ];
+}
+
+std::string affinity_init( int num_workers ) {
+    const char *bind_env = getenv("OMP_PROC_BIND");
+    const char *places_env = getenv("OMP_PLACES");
+    if( bind_env ) {
+        bind_levels = parse_proc_bind( bind_env );
+    }
+    if( !places_env && bind_levels.empty() ) {
+        return "";
+    }
+    if( bind_levels.empty() ) {
+        bind_levels.push_back( proc_bind_true );
+    }
+    if( bind_levels[0] == proc_bind_false ) {
+        bind_levels.clear();
+        return "";
+    }
+
+    std::vector<proc_info> procs = read_topology();
+    std::vector<std::vector<int>> places;
+    if( !parse_places( places_env ? places_env : "cores", procs, places ) ) {
+        cout << "OMP_PLACES: can't parse " << places_env << ", using cores" << endl;
+        places.clear();
+        parse_places( "cores", procs, places );
+    }
+    std::map<int, int> os_to_pu;
+    for( proc_info const& p : procs ) {
+        os_to_pu[p.os] = p.pu;
+    }
+    for( auto const& procs_of_place : places ) {
+        omp_place place;
+        for( int os : procs_of_place ) {
+            if( os_to_pu.count( os ) ) {
+                place.procs.push_back( os );
+                place.pus.push_back( os_to_pu[os] );
+            } else {
+                cout << "OMP_PLACES: processor " << os << " isn't available, ignoring it" << endl;
+            }
+        }
+        if( !place.procs.empty() ) {
+            omp_places.push_back( place );
+        }
+    }
+    if( omp_places.empty() ) {
+        cout << "OMP_PLACES: no usable places, threads aren't bound" << endl;
+        bind_levels.clear();
+        return "";
+    }
+
+    //Workers are pinned like the threads of a first level team of all of
+    // them. A master policy would put all workers on one place, which
+    // nested teams couldn't get away from.
+    int worker_bind = bind_levels[0];
+    if( worker_bind != proc_bind_spread ) {
+        worker_bind = proc_bind_close;
+    }
+    std::vector<affinity_assignment> workers;
+    affinity_assign_team( worker_bind, num_workers, 0, 0, (int) omp_places.size() - 1, workers );
+    place_workers.assign( omp_places.size(), std::vector<int>() );
+
+    std::ostringstream bind;
+    std::vector<int> on_place( omp_places.size(), 0 );
+    worker_place.resize( num_workers );
+    for( int w = 0; w < num_workers; w++ ) {
+        int place = workers[w].place;
+        worker_place[w] = place;
+        place_workers[place].push_back( w );
+        std::vector<int> const& pus = omp_places[place].pus;
+        bind << ( w ? ";" : "" ) << "thread:" << w << "=pu:" << pus[ on_place[place]++ % pus.size() ];
+    }
+    //A place without a worker borrows the workers of the nearest place that has some
+    std::vector<std::vector<int>> owned = place_workers;
+    int num_places = (int) omp_places.size();
+    for( int p = 0; p < num_places; p++ ) {
+        for( int d = 1; place_workers[p].empty() && d < num_places; d++ ) {
+            if( p - d >= 0 && !owned[p - d].empty() ) {
+                place_workers[p] = owned[p - d];
+            } else if( p + d < num_places && !owned[p + d].empty() ) {
+                place_workers[p] = owned[p + d];
+            }
+        }
+    }
+    return bind.str();
+}
+
+//See "Controlling OpenMP Thread Affinity" in the spec for the policies.
+// Partitions are index ranges into omp_places.
+void affinity_assign_team( int bind, int nthreads, int master_place,
+                           int partition_first, int partition_last,
+                           std::vector<affinity_assignment> &threads ) {
+    int num_places = partition_last - partition_first + 1;
+    if( master_place < partition_first || master_place > partition_last ) {
+        master_place = partition_first;
+    }
+    int master_pos = master_place - partition_first;
+    threads.assign( nthreads, { master_place, partition_first, partition_last, 0 } );
+
+    if( bind == proc_bind_true ) {
+        bind = proc_bind_spread;
+    }
+    if( bind == proc_bind_spread && nthreads <= num_places ) {
+        //nthreads subpartitions, the first num_places % nthreads one place larger;
+        // thread 0 gets the one holding the master's place
+        int base = num_places / nthreads, extra = num_places % nthreads;
+        std::vector<int> sub_first( nthreads );
+        int first = 0, master_sub = 0;
+        for( int s = 0; s < nthreads; s++ ) {
+            sub_first[s] = first;
+            first += base + ( s < extra ? 1 : 0 );
+            if( master_pos >= sub_first[s] && master_pos < first ) {
+                master_sub = s;
+            }
+        }
+        for( int i = 0; i < nthreads; i++ ) {
+            int s = ( master_sub + i ) % nthreads;
+            int size = base + ( s < extra ? 1 : 0 );
+            threads[i].partition_first = partition_first + sub_first[s];
+            threads[i].partition_last = threads[i].partition_first + size - 1;
+            threads[i].place = ( s == master_sub ) ? master_place : threads[i].partition_first;
+        }
+    } else if( bind == proc_bind_close || bind == proc_bind_spread ) {
+        //More threads than places spread like close, one place per partition
+        int per_place = nthreads / num_places, extra = nthreads % num_places;
+        int i = 0;
+        for( int p = 0; p < num_places && i < nthreads; p++ ) {
+            int count = ( nthreads <= num_places ) ? 1 : per_place + ( p < extra ? 1 : 0 );
+            int place = partition_first + ( master_pos + p ) % num_places;
+            for( int k = 0; k < count && i < nthreads; k++, i++ ) {
+                threads[i].place = place;
+                if( bind == proc_bind_spread ) {
+                    threads[i].partition_first = place;
+                    threads[i].partition_last = place;
+                }
+            }
+        }
+    }
+
+    if( place_workers.empty() ) {
+        return;
+    }
+    std::vector<int> on_place( omp_places.size(), 0 );
+    for( auto &thread : threads ) {
+        std::vector<int> const& workers = place_workers[thread.place];
+        thread.worker = workers[ on_place[thread.place]++ % workers.size() ];
+    }
+}
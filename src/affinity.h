@@ -0,0 +1,65 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <string>
+#include <vector>
+
+//OMP_PLACES and OMP_PROC_BIND.
+//
+//HPX workers are pinned when the runtime starts, so binding happens in two
+// steps. First, each worker is bound with --hpx:bind to a processor of the
+// place that thread i of a first level team of all workers would get.
+// Then, when a team is forked, its threads are given places by the team's
+// proc_bind policy, and each runs on a worker bound to its place. Nested
+// teams are placed inside their parent thread's place partition.
+//
+//Without OMP_PLACES and OMP_PROC_BIND (or with OMP_PROC_BIND=false) nothing
+// is bound and teams are forked as before.
+
+//The values of the proc_bind clause, as passed to __kmpc_push_proc_bind
+enum kmp_proc_bind_t {
+    proc_bind_false   = 0,
+    proc_bind_true    = 1,
+    proc_bind_master  = 2,
+    proc_bind_close   = 3,
+    proc_bind_spread  = 4,
+    proc_bind_intel   = 5,
+    proc_bind_default = 6
+};
+
+struct omp_place {
+    std::vector<int> procs;     // OS processor numbers, what omp_get_place_proc_ids reports
+    std::vector<int> pus;       // the same processors as HPX PU numbers
+};
+
+//Empty when threads aren't bound
+extern std::vector<omp_place> omp_places;
+
+//Parses OMP_PLACES and OMP_PROC_BIND. Returns the --hpx:bind value that
+// pins num_workers workers, or "" when threads aren't bound.
+std::string affinity_init( int num_workers );
+
+inline bool affinity_enabled() {
+    return !omp_places.empty();
+}
+
+//The place a worker is bound to, -1 if it isn't
+int affinity_worker_place( int worker );
+
+//The bind-var ICV of an implicit task at nesting level levels
+int affinity_bind_var( int levels );
+
+struct affinity_assignment {
+    int place;
+    int partition_first;
+    int partition_last;
+    int worker;
+};
+
+//Places nthreads threads by the bind policy, from the place and partition
+// of the thread forking them.
+void affinity_assign_team( int bind, int nthreads, int master_place,
+                           int partition_first, int partition_last,
+                           std::vector<affinity_assignment> &threads );
+
+#endif
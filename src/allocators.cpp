@@ -0,0 +1,365 @@
+#include "allocators.h"
+#include <hpx/hpx.hpp>
+#include <hpx/runtime/threads/topology.hpp>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using std::cout;
+using std::endl;
+
+//Linux memory policies, for mbind
+#define KMP_MPOL_PREFERRED  1
+#define KMP_MPOL_INTERLEAVE 3
+
+struct kmp_allocator {
+    omp_memspace_handle_t memspace{omp_default_mem_space};
+    size_t alignment{16};
+    bool pinned{false};
+    omp_uintptr_t fallback{omp_atv_default_mem_fb};
+    omp_allocator_handle_t fb_data{omp_null_allocator};
+    omp_uintptr_t partition{omp_atv_environment};
+    size_t pool_size{0};                    // 0 is unlimited
+    std::atomic<size_t> used{0};
+};
+
+static kmp_allocator predefined[omp_thread_mem_alloc + 1];
+
+static kmp_allocator* get_allocator( omp_allocator_handle_t allocator ) {
+    if( allocator <= omp_thread_mem_alloc ) {
+        return &predefined[allocator];
+    }
+    return (kmp_allocator*) allocator;
+}
+
+//In front of every allocation
+struct alignas(16) alloc_header {
+    kmp_allocator *allocator;
+    uint32_t offset;            // from the start of the block
+    uint16_t size_class;        // large_class for mapped allocations
+    uint16_t arena;
+};
+
+static const int min_class_shift = 5;           // 32 bytes
+static const int num_classes = 11;              // up to 32K
+static const uint16_t large_class = 0xffff;
+static const size_t chunk_size = 2 << 20;       // what arenas map at a time
+static const int cache_limit = 64;              // free blocks per class a worker keeps
+static const int cache_refill = 16;
+
+static size_t class_size( int size_class ) {
+    return size_t(1) << (size_class + min_class_shift);
+}
+
+//Free blocks are linked through their first word
+struct arena {
+    std::mutex mtx;
+    void *free_lists[num_classes] = {};
+    char *chunk{nullptr};
+    char *chunk_end{nullptr};
+};
+
+struct alignas(64) worker_cache {
+    void *free_lists[2][num_classes] = {};      // by pinned
+    int counts[2][num_classes] = {};
+};
+
+//arenas[node * 2 + pinned]
+static int num_nodes = 1;
+static std::unique_ptr<arena[]> arenas;
+static std::vector<int> worker_node;
+static std::unique_ptr<worker_cache[]> caches;
+
+static void bind_pages( void *addr, size_t length, int mode, unsigned long nodes ) {
+    //Only a placement hint; without NUMA support this fails, harmlessly
+    syscall( SYS_mbind, addr, length, mode, &nodes, sizeof(nodes) * 8, 0 );
+}
+
+static void* map_pages( size_t length, int node, omp_uintptr_t partition, bool pinned ) {
+    void *addr = mmap( nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( addr == MAP_FAILED ) {
+        return nullptr;
+    }
+    if( num_nodes > 1 ) {
+        if( partition == omp_atv_interleaved ) {
+            bind_pages( addr, length, KMP_MPOL_INTERLEAVE, (2UL << (num_nodes - 1)) - 1 );
+        } else if( partition == omp_atv_blocked ) {
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t block = ( length / num_nodes + page - 1 ) / page * page;
+            for( int i = 0; i < num_nodes && i * block < length; i++ ) {
+                bind_pages( (char*) addr + i * block, std::min( block, length - i * block ),
+                            KMP_MPOL_PREFERRED, 1UL << i );
+            }
+        } else {
+            bind_pages( addr, length, KMP_MPOL_PREFERRED, 1UL << node );
+        }
+    }
+    if( pinned && mlock( addr, length ) != 0 ) {
+        munmap( addr, length );
+        return nullptr;
+    }
+    return addr;
+}
+
+static int current_worker() {
+    std::size_t worker = hpx::get_worker_thread_num();
+    return worker < worker_node.size() ? (int) worker : -1;
+}
+
+//Called with the arena locked
+static void* arena_block( arena &a, int size_class, int node, bool pinned ) {
+    void *block = a.free_lists[size_class];
+    if( block ) {
+        a.free_lists[size_class] = *(void**) block;
+        return block;
+    }
+    size_t size = class_size( size_class );
+    if( a.chunk + size > a.chunk_end ) {
+        char *chunk = (char*) map_pages( chunk_size, node, omp_atv_nearest, pinned );
+        if( !chunk ) {
+            return nullptr;
+        }
+        a.chunk = chunk;
+        a.chunk_end = chunk + chunk_size;
+    }
+    block = a.chunk;
+    a.chunk += size;
+    return block;
+}
+
+static void* alloc_block( int size_class, int node, bool pinned, int worker ) {
+    arena &a = arenas[node * 2 + pinned];
+    if( worker < 0 || worker_node[worker] != node ) {
+        std::lock_guard<std::mutex> lk(a.mtx);
+        return arena_block( a, size_class, node, pinned );
+    }
+    worker_cache &cache = caches[worker];
+    void *&list = cache.free_lists[pinned][size_class];
+    if( !list ) {
+        std::lock_guard<std::mutex> lk(a.mtx);
+        for( int i = 0; i < cache_refill; i++ ) {
+            void *block = arena_block( a, size_class, node, pinned );
+            if( !block ) {
+                break;
+            }
+            *(void**) block = list;
+            list = block;
+            cache.counts[pinned][size_class]++;
+        }
+        if( !list ) {
+            return nullptr;
+        }
+    }
+    void *block = list;
+    list = *(void**) block;
+    cache.counts[pinned][size_class]--;
+    return block;
+}
+
+static void free_block( void *block, int size_class, int arena_index ) {
+    int node = arena_index / 2;
+    bool pinned = arena_index % 2;
+    int worker = current_worker();
+    if( worker >= 0 && worker_node[worker] == node &&
+        caches[worker].counts[pinned][size_class] < cache_limit ) {
+        void *&list = caches[worker].free_lists[pinned][size_class];
+        *(void**) block = list;
+        list = block;
+        caches[worker].counts[pinned][size_class]++;
+        return;
+    }
+    arena &a = arenas[arena_index];
+    std::lock_guard<std::mutex> lk(a.mtx);
+    *(void**) block = a.free_lists[size_class];
+    a.free_lists[size_class] = block;
+}
+
+static void* fallback_alloc( kmp_allocator *al, size_t size, size_t alignment ) {
+    switch( al->fallback ) {
+        case omp_atv_null_fb:
+            return nullptr;
+        case omp_atv_abort_fb:
+            cout << "omp_alloc: can't allocate " << size << " bytes, aborting" << endl;
+            abort();
+        case omp_atv_allocator_fb:
+            return allocator_alloc( size, std::max( alignment, al->alignment ), al->fb_data );
+        default:
+            if( al == &predefined[omp_default_mem_alloc] ) {
+                return nullptr;
+            }
+            return allocator_alloc( size, std::max( alignment, al->alignment ),
+                                    omp_default_mem_alloc );
+    }
+}
+
+void* allocator_alloc( size_t size, size_t alignment, omp_allocator_handle_t allocator ) {
+    kmp_allocator *al = get_allocator( allocator );
+    if( size == 0 ) {
+        return nullptr;
+    }
+    alignment = std::max( std::max( alignment, al->alignment ), sizeof(alloc_header) );
+    size_t total = size + sizeof(alloc_header) + alignment - sizeof(alloc_header);
+
+    int worker = current_worker();
+    int node = worker >= 0 ? worker_node[worker] : 0;
+    uint16_t size_class = large_class;
+    size_t charge;
+    if( total <= class_size( num_classes - 1 ) ) {
+        size_class = 0;
+        while( class_size( size_class ) < total ) {
+            size_class++;
+        }
+        charge = class_size( size_class );
+    } else {
+        size_t page = sysconf(_SC_PAGESIZE);
+        charge = ( total + sizeof(size_t) + page - 1 ) / page * page;
+    }
+
+    if( al->pool_size > 0 && al->used.fetch_add( charge ) + charge > al->pool_size ) {
+        al->used -= charge;
+        return fallback_alloc( al, size, alignment );
+    }
+
+    char *block, *start;
+    if( size_class != large_class ) {
+        block = (char*) alloc_block( size_class, node, al->pinned, worker );
+        start = block;
+    } else {
+        block = (char*) map_pages( charge, node, al->partition, al->pinned );
+        if( block ) {
+            *(size_t*) block = charge;
+        }
+        start = block + sizeof(size_t);
+    }
+    if( !block ) {
+        if( al->pool_size > 0 ) {
+            al->used -= charge;
+        }
+        return fallback_alloc( al, size, alignment );
+    }
+
+    uintptr_t ptr = ( (uintptr_t) start + sizeof(alloc_header) + alignment - 1 ) / alignment * alignment;
+    alloc_header *header = (alloc_header*) ptr - 1;
+    header->allocator = al;
+    header->offset = (uint32_t) ( ptr - (uintptr_t) block );
+    header->size_class = size_class;
+    header->arena = (uint16_t) ( node * 2 + al->pinned );
+    return (void*) ptr;
+}
+
+void allocator_free( void *ptr ) {
+    if( !ptr ) {
+        return;
+    }
+    alloc_header *header = (alloc_header*) ptr - 1;
+    kmp_allocator *al = header->allocator;
+    char *block = (char*) ptr - header->offset;
+    size_t charge;
+    if( header->size_class == large_class ) {
+        charge = *(size_t*) block;
+        munmap( block, charge );
+    } else {
+        charge = class_size( header->size_class );
+        free_block( block, header->size_class, header->arena );
+    }
+    if( al->pool_size > 0 ) {
+        al->used -= charge;
+    }
+}
+
+omp_allocator_handle_t allocator_create( omp_memspace_handle_t memspace, int ntraits,
+                                         const omp_alloctrait_t traits[] ) {
+    if( memspace > omp_low_lat_mem_space ) {
+        return omp_null_allocator;
+    }
+    std::unique_ptr<kmp_allocator> al( new kmp_allocator );
+    al->memspace = memspace;
+    for( int i = 0; i < ntraits; i++ ) {
+        omp_uintptr_t value = traits[i].value;
+        switch( traits[i].key ) {
+            case omp_atk_sync_hint:
+            case omp_atk_access:
+                break;
+            case omp_atk_alignment:
+                if( value == 0 || (value & (value - 1)) != 0 ) {
+                    return omp_null_allocator;
+                }
+                al->alignment = std::max<size_t>( value, al->alignment );
+                break;
+            case omp_atk_pool_size:
+                al->pool_size = value;
+                break;
+            case omp_atk_fallback:
+                if( value < omp_atv_default_mem_fb || value > omp_atv_allocator_fb ) {
+                    return omp_null_allocator;
+                }
+                al->fallback = value;
+                break;
+            case omp_atk_fb_data:
+                al->fb_data = (omp_allocator_handle_t) value;
+                break;
+            case omp_atk_pinned:
+                al->pinned = ( value == omp_atv_true );
+                break;
+            case omp_atk_partition:
+                if( value < omp_atv_environment || value > omp_atv_interleaved ) {
+                    return omp_null_allocator;
+                }
+                al->partition = value;
+                break;
+            default:
+                return omp_null_allocator;
+        }
+    }
+    if( al->fallback == omp_atv_allocator_fb && al->fb_data == omp_null_allocator ) {
+        return omp_null_allocator;
+    }
+    return (omp_allocator_handle_t) (uintptr_t) al.release();
+}
+
+void allocator_destroy( omp_allocator_handle_t allocator ) {
+    if( allocator > omp_thread_mem_alloc ) {
+        delete (kmp_allocator*) allocator;
+    }
+}
+
+omp_allocator_handle_t allocators_init() {
+    auto &topology = hpx::threads::get_topology();
+    std::size_t workers = hpx::get_os_thread_count();
+    num_nodes = (int) std::max<std::size_t>( 1, std::min<std::size_t>( 64,
+                    topology.get_number_of_numa_nodes() ) );
+    worker_node.resize( workers );
+    for( std::size_t w = 0; w < workers; w++ ) {
+        worker_node[w] = std::min<int>( (int) topology.get_numa_node_number( w ), num_nodes - 1 );
+    }
+    caches.reset( new worker_cache[workers] );
+    arenas.reset( new arena[num_nodes * 2] );
+
+    predefined[omp_large_cap_mem_alloc].memspace = omp_large_cap_mem_space;
+    predefined[omp_const_mem_alloc].memspace = omp_const_mem_space;
+    predefined[omp_high_bw_mem_alloc].memspace = omp_high_bw_mem_space;
+    predefined[omp_low_lat_mem_alloc].memspace = omp_low_lat_mem_space;
+
+    static const char* names[] = { "omp_null_allocator", "omp_default_mem_alloc",
+        "omp_large_cap_mem_alloc", "omp_const_mem_alloc", "omp_high_bw_mem_alloc",
+        "omp_low_lat_mem_alloc", "omp_cgroup_mem_alloc", "omp_pteam_mem_alloc",
+        "omp_thread_mem_alloc" };
+    const char *env = getenv("OMP_ALLOCATOR");
+    if( env ) {
+        for( int i = omp_default_mem_alloc; i <= omp_thread_mem_alloc; i++ ) {
+            if( !strcmp( env, names[i] ) ) {
+                return (omp_allocator_handle_t) i;
+            }
+        }
+        cout << "OMP_ALLOCATOR: unknown allocator " << env << ", using omp_default_mem_alloc" << endl;
+    }
+    return omp_default_mem_alloc;
+}
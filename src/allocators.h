@@ -0,0 +1,98 @@
+#ifndef ALLOCATORS_H
+#define ALLOCATORS_H
+
+#include <cstddef>
+#include <cstdint>
+
+//OpenMP 5.0 memory allocators.
+//
+//Allocations up to 32K come from size class arenas, one per NUMA domain.
+// Each worker keeps a cache of free blocks of its own domain, so tasks
+// allocating scratch buffers take no lock and get local memory. Blocks freed
+// on another domain go back to the arena they came from. Larger allocations
+// are mapped directly and placed by the allocator's partition trait.
+//
+//There is no high bandwidth or low latency memory to tell apart; every
+// memory space is served from the same arenas.
+
+extern "C" {
+
+typedef uintptr_t omp_uintptr_t;
+
+typedef enum omp_alloctrait_key_t {
+    omp_atk_sync_hint = 1,
+    omp_atk_alignment = 2,
+    omp_atk_access    = 3,
+    omp_atk_pool_size = 4,
+    omp_atk_fallback  = 5,
+    omp_atk_fb_data   = 6,
+    omp_atk_pinned    = 7,
+    omp_atk_partition = 8
+} omp_alloctrait_key_t;
+
+typedef enum omp_alloctrait_value_t {
+    omp_atv_false          = 0,
+    omp_atv_true           = 1,
+    omp_atv_default        = 2,
+    omp_atv_contended      = 3,
+    omp_atv_uncontended    = 4,
+    omp_atv_sequential     = 5,
+    omp_atv_private        = 6,
+    omp_atv_all            = 7,
+    omp_atv_thread         = 8,
+    omp_atv_pteam          = 9,
+    omp_atv_cgroup         = 10,
+    omp_atv_default_mem_fb = 11,
+    omp_atv_null_fb        = 12,
+    omp_atv_abort_fb       = 13,
+    omp_atv_allocator_fb   = 14,
+    omp_atv_environment    = 15,
+    omp_atv_nearest        = 16,
+    omp_atv_blocked        = 17,
+    omp_atv_interleaved    = 18
+} omp_alloctrait_value_t;
+
+typedef struct omp_alloctrait_t {
+    omp_alloctrait_key_t key;
+    omp_uintptr_t value;
+} omp_alloctrait_t;
+
+typedef enum omp_memspace_handle_t {
+    omp_default_mem_space   = 0,
+    omp_large_cap_mem_space = 1,
+    omp_const_mem_space     = 2,
+    omp_high_bw_mem_space   = 3,
+    omp_low_lat_mem_space   = 4,
+    KMP_MEMSPACE_MAX_HANDLE = UINTPTR_MAX
+} omp_memspace_handle_t;
+
+//Handles above the predefined ones point to a kmp_allocator
+typedef enum omp_allocator_handle_t {
+    omp_null_allocator       = 0,
+    omp_default_mem_alloc    = 1,
+    omp_large_cap_mem_alloc  = 2,
+    omp_const_mem_alloc      = 3,
+    omp_high_bw_mem_alloc    = 4,
+    omp_low_lat_mem_alloc    = 5,
+    omp_cgroup_mem_alloc     = 6,
+    omp_pteam_mem_alloc      = 7,
+    omp_thread_mem_alloc     = 8,
+    KMP_ALLOCATOR_MAX_HANDLE = UINTPTR_MAX
+} omp_allocator_handle_t;
+
+}
+
+//Reads the NUMA domains of the workers from HPX's topology, and OMP_ALLOCATOR.
+// Called when the runtime starts; returns the initial def-allocator-var.
+omp_allocator_handle_t allocators_init();
+
+//omp_null_allocator if a trait is invalid
+omp_allocator_handle_t allocator_create( omp_memspace_handle_t memspace, int ntraits,
+                                         const omp_alloctrait_t traits[] );
+void allocator_destroy( omp_allocator_handle_t allocator );
+
+//alignment is in addition to the allocator's alignment trait
+void* allocator_alloc( size_t size, size_t alignment, omp_allocator_handle_t allocator );
+void allocator_free( void *ptr );
+
+#endif
@@ -0,0 +1,274 @@
+#ifndef DEP_INDEX_H
+#define DEP_INDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//The last writers of the address ranges that a task's children depend on,
+// used to find the predecessors of a new child.
+//
+//The dependence on [addr, addr+len) is kept in an interval tree. The tree is a
+// treap ordered by start address, and each node knows the largest end in its
+// subtree, so dependences on overlapping array sections find each other even
+// when they start at different addresses. A write removes the ranges it
+// covers; a range it only partly overlaps stays, because the part that is not
+// covered still has its old writer.
+//
+//A hash of the start addresses handles the common case without the tree. That
+// case is a dependence on exactly a range written before, while no two stored
+// ranges overlap.
+template <class T>
+class dep_index {
+    public:
+        dep_index() {}
+        ~dep_index() { clear(); }
+        dep_index( dep_index const& ) = delete;
+        dep_index& operator=( dep_index const& ) = delete;
+
+        //Calls f with the writer of every range overlapping [addr, addr+len)
+        template <class F>
+        void find( int64_t addr, size_t len, F f ) {
+            node *exact = find_exact( addr, len );
+            if( exact ) {
+                f( exact->value );
+                return;
+            }
+            std::vector<node*> found;
+            query( root, addr, range_end(addr, len), found );
+            for( node *n : found ) {
+                f( n->value );
+            }
+        }
+
+        //Makes value the writer of [addr, addr+len)
+        void insert( int64_t addr, size_t len, T const& value ) {
+            node *exact = find_exact( addr, len );
+            if( exact ) {
+                exact->value = value;
+                return;
+            }
+            int64_t end = range_end( addr, len );
+            std::vector<node*> found;
+            query( root, addr, end, found );
+            bool partial = false;
+            node *match = nullptr;
+            for( node *n : found ) {
+                if( n->start == addr && n->end == end ) {
+                    match = n;
+                } else if( n->start >= addr && n->end <= end ) {
+                    erase( n );
+                } else {
+                    partial = true;
+                }
+            }
+            //A covered range erased above may have taken the match's start
+            if( match ) {
+                match->value = value;
+                starts[addr] = match;
+                return;
+            }
+            node *n = new node( addr, end, value, next_priority() );
+            if( partial ) {
+                n->overlaps = true;
+                overlapping++;
+            }
+            root = insert_node( root, n );
+            starts[addr] = n;
+            count++;
+        }
+
+        //Calls f with the writer of every range overlapping [addr, addr+len),
+        // and removes those ranges
+        template <class F>
+        void erase_overlapping( int64_t addr, size_t len, F f ) {
+            std::vector<node*> found;
+            node *exact = find_exact( addr, len );
+            if( exact ) {
+                found.push_back( exact );
+            } else {
+                query( root, addr, range_end(addr, len), found );
+            }
+            for( node *n : found ) {
+                f( n->value );
+                erase( n );
+            }
+        }
+
+        template <class F>
+        void for_each( F f ) {
+            for( node *n : all_nodes() ) {
+                f( n->value );
+            }
+        }
+
+        void clear() {
+            for( node *n : all_nodes() ) {
+                delete n;
+            }
+            root = nullptr;
+            starts.clear();
+            overlapping = 0;
+            count = 0;
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+    private:
+        struct node {
+            node( int64_t s, int64_t e, T const& v, unsigned p )
+                : start(s), end(e), max_end(e), priority(p), value(v) {}
+            int64_t start;
+            int64_t end;                //exclusive
+            int64_t max_end;            //of the subtree
+            unsigned priority;
+            bool overlaps{false};       //overlapped a range when it was added
+            node *left{nullptr};
+            node *right{nullptr};
+            T value;
+        };
+
+        //Dependences of length 0 still name their address
+        static int64_t range_end( int64_t addr, size_t len ) {
+            return addr + (int64_t) std::max( len, (size_t) 1 );
+        }
+
+        //While no two ranges overlap, a range starting at addr that also ends
+        // where [addr, addr+len) ends is the only one overlapping it
+        node* find_exact( int64_t addr, size_t len ) {
+            if( overlapping > 0 ) {
+                return nullptr;
+            }
+            auto it = starts.find( addr );
+            if( it == starts.end() || it->second->end != range_end( addr, len ) ) {
+                return nullptr;
+            }
+            return it->second;
+        }
+
+        unsigned next_priority() {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            return seed;
+        }
+
+        static int64_t subtree_end( node *t ) {
+            return t ? t->max_end : std::numeric_limits<int64_t>::min();
+        }
+
+        static void update( node *t ) {
+            t->max_end = std::max( t->end, std::max( subtree_end(t->left), subtree_end(t->right) ) );
+        }
+
+        static bool before( node *a, node *b ) {
+            return std::make_pair( a->start, a->end ) < std::make_pair( b->start, b->end );
+        }
+
+        //l gets the nodes before n, r the others
+        static void split( node *t, node *n, node *&l, node *&r ) {
+            if( !t ) {
+                l = r = nullptr;
+            } else if( before( t, n ) ) {
+                split( t->right, n, t->right, r );
+                l = t;
+                update( t );
+            } else {
+                split( t->left, n, l, t->left );
+                r = t;
+                update( t );
+            }
+        }
+
+        static node* merge( node *l, node *r ) {
+            if( !l || !r ) {
+                return l ? l : r;
+            }
+            if( l->priority > r->priority ) {
+                l->right = merge( l->right, r );
+                update( l );
+                return l;
+            }
+            r->left = merge( l, r->left );
+            update( r );
+            return r;
+        }
+
+        static node* insert_node( node *t, node *n ) {
+            if( !t ) {
+                return n;
+            }
+            if( n->priority > t->priority ) {
+                split( t, n, n->left, n->right );
+                update( n );
+                return n;
+            }
+            if( before( n, t ) ) {
+                t->left = insert_node( t->left, n );
+            } else {
+                t->right = insert_node( t->right, n );
+            }
+            update( t );
+            return t;
+        }
+
+        static node* erase_node( node *t, node *n ) {
+            if( t == n ) {
+                return merge( t->left, t->right );
+            }
+            if( before( n, t ) ) {
+                t->left = erase_node( t->left, n );
+            } else {
+                t->right = erase_node( t->right, n );
+            }
+            update( t );
+            return t;
+        }
+
+        //Nodes overlapping [start, end), in address order
+        static void query( node *t, int64_t start, int64_t end, std::vector<node*> &found ) {
+            if( !t || t->max_end <= start ) {
+                return;
+            }
+            query( t->left, start, end, found );
+            if( t->start < end ) {
+                if( t->end > start ) {
+                    found.push_back( t );
+                }
+                query( t->right, start, end, found );
+            }
+        }
+
+        void erase( node *n ) {
+            root = erase_node( root, n );
+            auto it = starts.find( n->start );
+            if( it != starts.end() && it->second == n ) {
+                starts.erase( it );
+            }
+            if( n->overlaps ) {
+                overlapping--;
+            }
+            count--;
+            delete n;
+        }
+
+        std::vector<node*> all_nodes() {
+            std::vector<node*> nodes;
+            query( root, std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max(), nodes );
+            return nodes;
+        }
+
+        node *root{nullptr};
+        std::unordered_map<int64_t, node*> starts;
+        int overlapping{0};         //nodes with overlaps set
+        size_t count{0};
+        unsigned seed{2463534242u};
+};
+
+#endif
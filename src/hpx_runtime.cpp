@@ -6,6 +6,14 @@
 
 #define  HPX_LIMIT 9
 #include "hpx_runtime.h"
+#include "allocators.h"
+#include "lock_profile.h"
+#include "perf_counters.h"
+#include "threadprivate.h"
+#include <hpx/runtime/threads/threadmanager.hpp>
+#include <algorithm>
+#include <cctype>
+#include <strings.h>
 
 using std::cout;
 using std::endl;
@@ -24,6 +32,7 @@ extern boost::shared_ptr<hpx_runtime> hpx_backend;
 void wait_for_startup(boost::mutex& mtx, boost::condition& cond, bool& running)
 {
     cout << "HPX OpenMP runtime has started" << endl;
+    perf_counters_register();
     {   // Let the main thread know that we're done.
         boost::mutex::scoped_lock lk(mtx);
         running = true;
@@ -31,11 +40,94 @@ void wait_for_startup(boost::mutex& mtx, boost::condition& cond, bool& running)
     }
 }
 
+#ifdef OMP_COMPLIANT
+//Executors of finished teams, by team size. Creating one allocates the
+// queues of its scheduler and destroying one waits for its closures, which
+// costs more than many small regions do, so teams of the same size reuse
+// them. The pool is only emptied before HPX stops. fini_runtime takes the
+// lock on the main thread, so it's a spinlock and not an HPX mutex.
+static hpx::lcos::local::spinlock executor_mtx;
+static std::map<int, vector<shared_ptr<local_priority_queue_executor>>> *idle_executors
+    = new std::map<int, vector<shared_ptr<local_priority_queue_executor>>>;
+static const std::size_t max_idle_executors = 4;     //per team size
+
+static shared_ptr<local_priority_queue_executor> acquire_team_executor( int num_threads )
+{
+    {
+        std::lock_guard<hpx::lcos::local::spinlock> lk(executor_mtx);
+        auto &idle = (*idle_executors)[num_threads];
+        if( !idle.empty() ) {
+            shared_ptr<local_priority_queue_executor> exec = std::move(idle.back());
+            idle.pop_back();
+            return exec;
+        }
+    }
+    return shared_ptr<local_priority_queue_executor>(new local_priority_queue_executor(num_threads));
+}
+
+//The team's tasks have to be done
+static void release_team_executor( int num_threads, shared_ptr<local_priority_queue_executor> exec )
+{
+    {
+        std::lock_guard<hpx::lcos::local::spinlock> lk(executor_mtx);
+        auto &idle = (*idle_executors)[num_threads];
+        if( idle.size() < max_idle_executors ) {
+            idle.push_back(std::move(exec));
+            return;
+        }
+    }
+    //Otherwise exec is destroyed here, outside the lock
+}
+#endif
+
+#ifdef OMP_COMPLIANT
+static void clear_idle_executors( boost::mutex& mtx, boost::condition& cond, bool& done )
+{
+    std::map<int, vector<shared_ptr<local_priority_queue_executor>>> idle;
+    {
+        std::lock_guard<hpx::lcos::local::spinlock> lk(executor_mtx);
+        idle.swap(*idle_executors);
+    }
+    idle.clear();
+    {
+        boost::mutex::scoped_lock lk(mtx);
+        done = true;
+        cond.notify_all();
+    }
+}
+#endif
+
+//Destroying an executor waits for its scheduling threads, which has to
+// happen on an HPX thread; fini_runtime runs on the main thread.
+static void release_team_executors()
+{
+#ifdef OMP_COMPLIANT
+    boost::mutex mtx;
+    boost::condition cond;
+    bool done = false;
+    hpx::applier::register_thread_nullary(
+            std::bind(&clear_idle_executors, boost::ref(mtx), boost::ref(cond), boost::ref(done)),
+            "omp_release_executors");
+    boost::mutex::scoped_lock lk(mtx);
+    while(!done) {
+        cond.wait(lk);
+    }
+#endif
+}
+
 void fini_runtime()
 {
+    lock_profile_report();
+    loop_profile_report();
     cout << "Stopping HPX OpenMP runtime" << endl;
     //this should only be done if this runtime started hpx
+    release_team_executors();
     hpx::get_runtime().stop();
+    ompt_fini();
+    trace_flush();
+    threadprivate_fini();
+    future_cached_fini();
+    taskgraph_fini();
 }
 
 void start_hpx(int initial_num_threads)
@@ -64,16 +156,27 @@ void start_hpx(int initial_num_threads)
         boost::algorithm::split(hpx_args, tmp,
             boost::algorithm::is_any_of(";"),
                 boost::algorithm::token_compress_on);
+    }
 
-        argc = hpx_args.size() + num_hard_coded_args;
-        argv = new char*[argc];
-
-        for (boost::uint64_t i = 0; i < hpx_args.size(); ++i) {
-            argv[i + num_hard_coded_args] = const_cast<char*>(hpx_args[i].c_str());
+    //An explicit --hpx:bind in OMP_HPX_ARGS wins over OMP_PLACES
+    std::string bind = affinity_init(initial_num_threads);
+    if (!bind.empty()) {
+        bool user_bind = false;
+        for (auto const& arg : hpx_args) {
+            user_bind = user_bind || arg.compare(0, 10, "--hpx:bind") == 0;
+        }
+        if (user_bind) {
+            cout << "OMP_PLACES: --hpx:bind in OMP_HPX_ARGS overrides the place binding" << endl;
+        } else {
+            hpx_args.push_back("--hpx:bind=" + bind);
         }
-    } else {
-        argc = num_hard_coded_args;
-        argv = new char*[argc];
+    }
+
+    argc = hpx_args.size() + num_hard_coded_args;
+    argv = new char*[argc];
+
+    for (boost::uint64_t i = 0; i < hpx_args.size(); ++i) {
+        argv[i + num_hard_coded_args] = const_cast<char*>(hpx_args[i].c_str());
     }
     argv[0] = const_cast<char*>("hpxMP");
 #ifdef OMP_COMPLIANT
@@ -100,6 +203,12 @@ void start_hpx(int initial_num_threads)
     delete[] argv;
 }
 
+//With HPXMP_TASK_PLACEMENT=n, dependent tasks start on the worker that ran
+// the producer of their largest input, where that input is likely still in
+// cache, unless n HPX threads are already queued on that worker; then they go
+// wherever the team's other tasks go. Off by default.
+static int task_placement = 0;
+
 hpx_runtime::hpx_runtime()
 {
     int initial_num_threads;
@@ -120,13 +229,58 @@ hpx_runtime::hpx_runtime()
         initial_num_threads = num_procs;
     }
 
+    char const* omp_thread_limit = getenv("OMP_THREAD_LIMIT");
+    if(omp_thread_limit != NULL) {
+        if(atoi(omp_thread_limit) > 0) {
+            device_icv.thread_limit = atoi(omp_thread_limit);
+            initial_num_threads = std::min(initial_num_threads, device_icv.thread_limit);
+        } else {
+            cout << "OMP_THREAD_LIMIT: ignoring " << omp_thread_limit << endl;
+        }
+    }
+    char const* omp_max_task_priority = getenv("OMP_MAX_TASK_PRIORITY");
+    if(omp_max_task_priority != NULL) {
+        if(atoi(omp_max_task_priority) >= 0 && isdigit(omp_max_task_priority[0])) {
+            device_icv.max_task_priority = atoi(omp_max_task_priority);
+        } else {
+            cout << "OMP_MAX_TASK_PRIORITY: ignoring " << omp_max_task_priority << endl;
+        }
+    }
+    char const* omp_max_active_levels = getenv("OMP_MAX_ACTIVE_LEVELS");
+    if(omp_max_active_levels != NULL) {
+        if(atoi(omp_max_active_levels) >= 0 && isdigit(omp_max_active_levels[0])) {
+            device_icv.max_active_levels = atoi(omp_max_active_levels);
+        } else {
+            cout << "OMP_MAX_ACTIVE_LEVELS: ignoring " << omp_max_active_levels << endl;
+        }
+    }
+
     implicit_region.reset(new parallel_region(1));
     initial_thread.reset(new omp_task_data(implicit_region.get(), &device_icv, initial_num_threads));
+    char const* task_placement_env = getenv("HPXMP_TASK_PLACEMENT");
+    if(task_placement_env != NULL) {
+        if(isdigit(task_placement_env[0])) {
+            task_placement = atoi(task_placement_env);
+        } else {
+            cout << "HPXMP_TASK_PLACEMENT: ignoring " << task_placement_env << endl;
+        }
+    }
+    char const* omp_dynamic = getenv("OMP_DYNAMIC");
+    if(omp_dynamic != NULL) {
+        initial_thread->icv.dyn = !strcasecmp(omp_dynamic, "true") || !strcmp(omp_dynamic, "1");
+    }
     walltime.reset(new high_resolution_timer);
 
     if(!external_hpx) {
         start_hpx(initial_num_threads);
+        initial_thread->icv.place_partition_last = (int) omp_places.size() - 1;
+    } else if(hpx::threads::get_self_ptr()) {
+        perf_counters_register();
     }
+    initial_thread->icv.def_allocator = allocators_init();
+    ompt_init();
+    OMPT_CALLBACK(implicit_task, (ompt_scope_begin, &implicit_region->ompt_parallel_data,
+                                  &initial_thread->ompt_task_data, 1, 1, ompt_task_initial));
 }
 
 parallel_region* hpx_runtime::get_team()
@@ -136,6 +290,9 @@ parallel_region* hpx_runtime::get_team()
     return team;
 }
 
+//The task of a serialized region run by a thread that isn't an HPX thread
+static thread_local size_t os_thread_data = 0;
+
 omp_task_data* hpx_runtime::get_task_data()
 {
     omp_task_data *data;
@@ -144,12 +301,27 @@ omp_task_data* hpx_runtime::get_task_data()
         if(!data) {
             data = initial_thread.get();
         }
+    } else if(os_thread_data) {
+        data = reinterpret_cast<omp_task_data*>(os_thread_data);
     } else { 
         data = initial_thread.get();
     }
     return data;
 }
 
+size_t hpx_runtime::swap_task_data( size_t data )
+{
+    size_t old;
+    if(hpx::threads::get_self_ptr()) {
+        old = get_thread_data(get_self_id());
+        set_thread_data(get_self_id(), data);
+    } else {
+        old = os_thread_data;
+        os_thread_data = data;
+    }
+    return old;
+}
+
 double hpx_runtime::get_time() {
     return walltime->now();
 }
@@ -162,6 +334,24 @@ int hpx_runtime::get_num_procs() {
     return num_procs;
 }
 
+int hpx_runtime::get_thread_limit() {
+    return device_icv.thread_limit;
+}
+
+int hpx_runtime::get_max_task_priority() {
+    return device_icv.max_task_priority;
+}
+
+void hpx_runtime::set_max_active_levels(int levels) {
+    if(levels >= 0) {
+        device_icv.max_active_levels = levels;
+    }
+}
+
+int hpx_runtime::get_max_active_levels() {
+    return device_icv.max_active_levels;
+}
+
 void hpx_runtime::set_num_threads(int nthreads) {
     if(nthreads > 0) {
         get_task_data()->icv.nthreads = nthreads;
@@ -169,21 +359,42 @@ void hpx_runtime::set_num_threads(int nthreads) {
     }
 }
 
-//TODO: Why not always return the given worker thread number?
+//The rank in the team
 int hpx_runtime::get_thread_num() {
-#ifdef OMP_COMPLIANT
-    return hpx::get_worker_thread_num();
-#else
     return get_task_data()->local_thread_num;
-#endif
+}
+
+//The gtid the compiler hands the outlined region, see acquire_gtid
+int hpx_runtime::get_global_thread_num() {
+    return get_task_data()->global_thread_num;
+}
+
+static void wait_for_child_tasks( omp_task_data *task )
+{
+    if(task->df_map.size() > 0) {
+        task->last_df_task.wait();
+    }
+    while( *(task->num_child_tasks) > 0 ) {
+        hpx::this_thread::yield();
+    }
 }
 
 // this should only be called from implicit tasks
-void hpx_runtime::barrier_wait(){
-    auto *team = get_team();
-    task_wait();
+void hpx_runtime::barrier_wait( ompt_sync_region_t kind, const void *codeptr ){
+    uint64_t trace_start = trace_begin();
+    uint64_t wait_start = perf_wait_begin();
+    auto *task = get_task_data();
+    auto *team = task->team;
+    task->loop_profile.leave();
+    OMPT_CALLBACK(sync_region, (kind, ompt_scope_begin, &team->ompt_parallel_data,
+                                &task->ompt_task_data, codeptr));
+    OMPT_CALLBACK(sync_region_wait, (kind, ompt_scope_begin, &team->ompt_parallel_data,
+                                     &task->ompt_task_data, codeptr));
+    wait_for_child_tasks(task);
 #ifdef OMP_COMPLIANT
-    while(team->exec->num_pending_closures() > 0 ) {
+    //Teams of one thread have no executor, their tasks run immediately.
+    // Placed tasks bypass the executor, and are counted in num_tasks.
+    while((team->exec && team->exec->num_pending_closures() > 0) || team->num_tasks > 0) {
         hpx::this_thread::yield();
     }
 #else
@@ -194,126 +405,371 @@ void hpx_runtime::barrier_wait(){
     if(team->num_threads > 1) {
         team->globalBarrier.wait();
     }
+    OMPT_CALLBACK(sync_region_wait, (kind, ompt_scope_end, &team->ompt_parallel_data,
+                                     &task->ompt_task_data, codeptr));
+    OMPT_CALLBACK(sync_region, (kind, ompt_scope_end, &team->ompt_parallel_data,
+                                &task->ompt_task_data, codeptr));
+    perf_wait_end(perf_barrier_wait_ns, wait_start);
+    trace_end(trace_barrier, trace_start);
 }
 
-//TODO: Does the spec say that outstanding tasks need to end before this begins?
+//A taskgroup is a counter of its tasks; they run on the team's executor
+// like any other task.
 bool hpx_runtime::start_taskgroup()
 {
     auto *task = get_task_data();
-    task->in_taskgroup = true;
-#ifdef OMP_COMPLIANT
-    task->tg_exec.reset(new local_priority_queue_executor(task->local_thread_num));
-#else
-    task->tg_num_tasks.reset(new atomic<int64_t>{0});
-#endif
+    task->taskgroup.reset(new taskgroup_data(task->taskgroup));
     return true;
 }
 
+//Yielding lets this worker run queued tasks, the group's among them, while
+// it waits.
 void hpx_runtime::end_taskgroup() 
 {
     auto *task = get_task_data();
-#ifdef OMP_COMPLIANT
-    task->tg_exec.reset();
-#else
-    while( *(task->tg_num_tasks) > 0 ) {
+    while( task->taskgroup->num_tasks > 0 ) {
         hpx::this_thread::yield();
     }
-    task->tg_num_tasks.reset();
-#endif
-    task->in_taskgroup = false;
+    task->taskgroup = task->taskgroup->parent;
 }
 
-void hpx_runtime::task_wait() 
+//Runs a queued task on this thread, so a task polling for something, like a
+// lock or a value its descendants produce, makes progress. Falls back to
+// yielding the worker when there is nothing it may run.
+bool hpx_runtime::task_yield()
 {
     auto *task = get_task_data();
-    if(task->df_map.size() > 0) {
-        task->last_df_task.wait();
+    if(task->team->num_threads > 1 && run_ready_task(task->team, task)) {
+        return true;
     }
-    while( *(task->num_child_tasks) > 0 ) {
+    if(hpx::threads::get_self_ptr()) {
         hpx::this_thread::yield();
     }
+    return false;
+}
+
+void hpx_runtime::task_wait( const void *codeptr ) 
+{
+    uint64_t trace_start = trace_begin();
+    uint64_t wait_start = perf_wait_begin();
+    auto *task = get_task_data();
+    auto *team = task->team;
+    OMPT_CALLBACK(sync_region, (ompt_sync_region_taskwait, ompt_scope_begin,
+                                &team->ompt_parallel_data, &task->ompt_task_data, codeptr));
+    OMPT_CALLBACK(sync_region_wait, (ompt_sync_region_taskwait, ompt_scope_begin,
+                                     &team->ompt_parallel_data, &task->ompt_task_data, codeptr));
+    wait_for_child_tasks(task);
+    OMPT_CALLBACK(sync_region_wait, (ompt_sync_region_taskwait, ompt_scope_end,
+                                     &team->ompt_parallel_data, &task->ompt_task_data, codeptr));
+    OMPT_CALLBACK(sync_region, (ompt_sync_region_taskwait, ompt_scope_end,
+                                &team->ompt_parallel_data, &task->ompt_task_data, codeptr));
+    perf_wait_end(perf_taskwait_wait_ns, wait_start);
+    trace_end(trace_taskwait, trace_start);
+}
+
+//Global thread ids. The compiler passes them back to the runtime, and indexes
+// threadprivate caches with them, so no two threads that run at the same
+// time may share one. The initial thread is 0 and the master of a team keeps
+// the id of the thread that forked it. The other threads of a first level
+// team get their rank if it is free, so they keep their threadprivate copies
+// from one region to the next; threads of nested teams get the lowest free id,
+// and so do deferred tasks, see task_setup.
+static hpx::lcos::local::spinlock gtid_mtx;
+static vector<bool> gtid_used(1, true);
+
+static int acquire_gtid( int preferred )
+{
+    std::lock_guard<hpx::lcos::local::spinlock> lk(gtid_mtx);
+    int gtid = preferred;
+    if( gtid < 0 || ( gtid < (int) gtid_used.size() && gtid_used[gtid] ) ) {
+        gtid = 1;
+        while( gtid < (int) gtid_used.size() && gtid_used[gtid] ) {
+            gtid++;
+        }
+    }
+    if( gtid >= (int) gtid_used.size() ) {
+        gtid_used.resize( gtid + 1, false );
+    }
+    gtid_used[gtid] = true;
+    return gtid;
+}
+
+static void release_gtid( int gtid )
+{
+    std::lock_guard<hpx::lcos::local::spinlock> lk(gtid_mtx);
+    gtid_used[gtid] = false;
 }
 
-void task_setup( int gtid, kmp_task_t *task, omp_icv icv, 
+//taskgroup is the innermost taskgroup the task is in, if any; the task's
+// own descendants join it as well.
+void task_setup( int tid, kmp_task_t *task, omp_icv icv, 
                  shared_ptr<atomic<int64_t>> parent_task_counter,
+                 shared_ptr<taskgroup_data> taskgroup,
+                 shared_ptr<task_lineage> creator,
                  parallel_region *team)
 {
     auto task_func = task->routine;
-    omp_task_data task_data(gtid, team, icv);
-    set_thread_data( get_self_id(), reinterpret_cast<size_t>(&task_data));
+    omp_task_data task_data(tid, 0, team, icv);        //gtid set below
+    task_data.taskgroup = taskgroup;
+    task_data.lineage->parent = creator;
+    task_data.ompt_task_data = kmp_task_get_header(task)->ompt_task_data;
+    task_data.ompt_task_flags = kmp_task_get_header(task)->ompt_task_flags;
+    //Tasks also run inline, in a team of one or at a taskyield, so the
+    // thread's task is put back afterwards
+    size_t parent_data = hpx_backend->swap_task_data(reinterpret_cast<size_t>(&task_data));
+    auto *outer = reinterpret_cast<omp_task_data*>(parent_data);
+    if(!(task_data.ompt_task_flags & ompt_task_untied)) {
+        task_data.tied_lineage = task_data.lineage.get();
+    } else if(outer) {
+        task_data.tied_lineage = outer->tied_lineage;
+    }
+    //The task uses the threadprivate copies of the thread running it. Inline,
+    // that is the thread of the task it runs on top of; on an HPX thread of
+    // its own, it takes a free gtid while it runs. Off HPX threads, outside
+    // of any region, it runs on the initial thread.
+    bool own_gtid = !outer && hpx::threads::get_self_ptr();
+    int gtid = outer ? outer->global_thread_num : own_gtid ? acquire_gtid(-1) : 0;
+    task_data.global_thread_num = gtid;
+    ompt_thread_begin();
+    OMPT_CALLBACK(task_schedule, (ompt_scheduler_task_data(), ompt_task_switch,
+                                  &task_data.ompt_task_data));
+    uint64_t trace_start = trace_begin();
 
     task_func(gtid, task);
 
+    trace_end(trace_task, trace_start, (int64_t) task_func);
+    OMPT_CALLBACK(task_schedule, (&task_data.ompt_task_data, ompt_task_complete,
+                                  ompt_scheduler_task_data()));
+    hpx_backend->swap_task_data(parent_data);
+    if(own_gtid) {
+        release_gtid(gtid);
+    }
     *(parent_task_counter) -= 1;
+    if(taskgroup) {
+        taskgroup->num_tasks--;
+    }
 #ifndef OMP_COMPLIANT
     team->num_tasks--;
 #endif
-    delete[] (char*)task;
+    kmp_task_free(task);
 }
 
-#ifdef OMP_COMPLIANT
-void tg_task_setup( int gtid, kmp_task_t *task, omp_icv icv, 
-                 shared_ptr<local_priority_queue_executor> tg_exec,
-                 parallel_region *team)
+//Queues a task by its priority; the caller schedules one ready_task_runner
+// for it. A runner that starts later than a higher priority task was
+// queued runs that task instead, so urgent tasks overtake the queued ones.
+static void push_ready_task( parallel_region *team, kmp_task_t *task, int priority,
+                             shared_ptr<task_lineage> creator, std::function<void()> &&run )
 {
-    auto task_func = task->routine;
-    omp_task_data task_data(gtid, team, icv);
-    task_data.in_taskgroup = true;
-    task_data.tg_exec = tg_exec;
-    set_thread_data( get_self_id(), reinterpret_cast<size_t>(&task_data));
+    bool untied = kmp_task_get_header(task)->ompt_task_flags & ompt_task_untied;
+    std::lock_guard<hpx::lcos::local::spinlock> lk(team->ready_mtx);
+    team->ready_tasks.emplace(priority, ready_task{std::move(run), creator, untied});
+}
 
-    task_func(gtid, task);
+static bool descends_from( shared_ptr<task_lineage> const& creator, task_lineage const *ancestor )
+{
+    for(task_lineage const *l = creator.get(); l; l = l->parent.get()) {
+        if(l == ancestor) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    delete[] (char*)task;
+//Runs the highest priority queued task. At a taskyield, the yielding task's
+// own descendants among the first few queued go first, then any other task
+// that task scheduling constraint 2 allows: with a tied task on the thread,
+// an untied task or a descendant of it. False if there was none.
+static bool run_ready_task( parallel_region *team, omp_task_data const *yielding = nullptr )
+{
+    std::function<void()> run;
+    {
+        std::lock_guard<hpx::lcos::local::spinlock> lk(team->ready_mtx);
+        auto chosen = team->ready_tasks.begin();
+        if(yielding) {
+            auto allowed = [&]( ready_task const& t ) {
+                return t.untied || !yielding->tied_lineage ||
+                       descends_from(t.creator, yielding->tied_lineage);
+            };
+            chosen = team->ready_tasks.end();
+            int scanned = 0;
+            for(auto it = team->ready_tasks.begin();
+                it != team->ready_tasks.end() && scanned < 32; ++it, ++scanned) {
+                if(!allowed(it->second)) {
+                    continue;
+                }
+                if(descends_from(it->second.creator, yielding->lineage.get())) {
+                    chosen = it;
+                    break;
+                }
+                if(chosen == team->ready_tasks.end()) {
+                    chosen = it;
+                }
+            }
+        }
+        if(chosen == team->ready_tasks.end()) {
+            return false;
+        }
+        run = std::move(chosen->second.run);
+        team->ready_tasks.erase(chosen);
+    }
+    run();
+    return true;
 }
+
+//A taskyield may have taken this runner's task already. Without the
+// executor counting them, runners count in the team's tasks.
+static void ready_task_runner( parallel_region *team )
+{
+    run_ready_task(team);
+#ifndef OMP_COMPLIANT
+    team->num_tasks--;
 #endif
+}
 
 //shared_ptr is used for these counters, because the parent/calling task may terminate at any time,
 //causing its omp_task_data to be deallocated.
 void hpx_runtime::create_task( kmp_routine_entry_t task_func, int gtid, kmp_task_t *thunk)
 {
     auto *current_task = get_task_data();
+    shared_ptr<taskgroup_data> taskgroup = current_task->taskgroup;
+    if(taskgroup) {
+        taskgroup->num_tasks++;
+    }
+    *(current_task->num_child_tasks) += 1;
 
     if(current_task->team->num_threads > 1) {
+        perf_counter_add(perf_tasks_deferred);
+        auto *team = current_task->team;
+#ifndef OMP_COMPLIANT
+        team->num_tasks++;
+#endif
+        //The task waits in the team's queue, where a taskyield can take it
+        // before its runner starts
+        push_ready_task(team, thunk, kmp_task_priority(thunk, device_icv.max_task_priority),
+                        current_task->lineage,
+                        std::bind(task_setup, current_task->local_thread_num, thunk, current_task->icv,
+                                  current_task->num_child_tasks, taskgroup, current_task->lineage, team));
 #ifdef OMP_COMPLIANT
-        if(current_task->in_taskgroup) { 
-            hpx::apply( *(current_task->tg_exec), tg_task_setup, gtid, thunk, current_task->icv,
-                        current_task->tg_exec, current_task->team );
-        } else {
-            *(current_task->num_child_tasks) += 1;
-            hpx::apply( *(current_task->team->exec), task_setup, gtid, thunk, current_task->icv,
-                        current_task->num_child_tasks, current_task->team );
-        }
+        hpx::apply( *(team->exec), ready_task_runner, team );
 #else
-        //TODO: add taskgroups in non compliant version
-        current_task->team->num_tasks++;
-        hpx::apply(task_setup, gtid, thunk, current_task->icv,
-                    current_task->num_child_tasks, current_task->team );
+        team->num_tasks++;          //the runner
+        hpx::apply( ready_task_runner, team );
 #endif
     } else {
-        *(current_task->num_child_tasks) += 1;
-        task_setup(gtid, thunk, current_task->icv, current_task->num_child_tasks, current_task->team);
+        perf_counter_add(perf_tasks_inline);
+        task_setup(current_task->local_thread_num, thunk, current_task->icv,
+                   current_task->num_child_tasks, taskgroup, current_task->lineage,
+                   current_task->team);
     }
 }
 
-void df_task_wrapper( int gtid, kmp_task_t *task, omp_icv icv, 
+void df_task_wrapper( int tid, kmp_task_t *task, omp_icv icv, 
                       shared_ptr<atomic<int64_t>> task_counter,
-                      parallel_region *team, 
+                      shared_ptr<taskgroup_data> taskgroup,
+                      shared_ptr<task_lineage> creator,
+                      parallel_region *team, shared_ptr<atomic<int>> worker,
                       vector<shared_future<void>> deps) 
 {
-    task_setup( gtid, task, icv, task_counter, team);
+    //Once its dependences are met, the task competes by priority with the
+    // other ready tasks of the team. This closure runs the top one, and the
+    // task's successors wait on this closure, so it waits for the task to
+    // finish wherever it ran.
+    auto done = std::make_shared<hpx::lcos::local::promise<void>>();
+    future<void> finished = done->get_future();
+    push_ready_task(team, task, kmp_task_priority(task, icv.device->max_task_priority), creator,
+                    [=]() {
+                        *worker = (int) hpx::get_worker_thread_num();
+                        task_setup(tid, task, icv, task_counter, taskgroup, creator, team);
+                        done->set_value();
+                    });
+    run_ready_task(team);
+    finished.wait();
 }
 
-#ifdef OMP_COMPLIANT
-void df_tg_task_wrapper( int gtid, kmp_task_t *task, omp_icv icv, 
-                        shared_ptr<local_priority_queue_executor> tg_exec,
-                        parallel_region *team, 
-                        vector<shared_future<void>> deps) 
+static void place_df_task( parallel_region *team, int worker, std::function<void()> &&run )
 {
-    tg_task_setup( gtid, task, icv, tg_exec, team);
+    if(worker >= 0 && worker < (int) hpx::get_os_thread_count() &&
+       hpx::threads::get_thread_manager().get_thread_count(
+            hpx::threads::pending, hpx::threads::thread_priority_default, worker ) < task_placement) {
+        hpx::applier::register_thread_nullary( std::move(run), "omp_df_task",
+                hpx::threads::pending, true, hpx::threads::thread_priority_normal, worker );
+        return;
+    }
+#ifdef OMP_COMPLIANT
+    hpx::apply( *(team->exec), std::move(run) );
+#else
+    hpx::apply( std::move(run) );
+#endif
 }
+
+static void run_graph_node( taskgraph *graph, int node, parallel_region *team );
+
+static void start_graph_node( taskgraph *graph, int node, parallel_region *team )
+{
+#ifdef OMP_COMPLIANT
+    hpx::apply( *(team->exec), run_graph_node, graph, node, team );
+#else
+    hpx::apply( run_graph_node, graph, node, team );
 #endif
+}
+
+//Runs a replayed task, then the successors it was the last predecessor of:
+// one of them on this thread, while the task's outputs are in its cache, and
+// the others as new HPX threads.
+static void run_graph_node( taskgraph *graph, int node, parallel_region *team )
+{
+    while(node >= 0) {
+        std::function<void()> run = std::move(graph->launch[node]);
+        run();
+        int next = -1;
+        for(int successor : graph->nodes[node].successors) {
+            if(graph->release(successor)) {
+                if(next < 0) {
+                    next = successor;
+                } else {
+                    start_graph_node(graph, successor, team);
+                }
+            }
+        }
+        graph->active--;
+        node = next;
+    }
+}
+
+//Creates a dependent task of a replayed graph. False if it does not match
+// the graph; the tasks replayed so far are finished then, and the task goes
+// through the dependence map like the rest of the region.
+static bool replay_df_task( kmp_task_t *thunk, omp_task_data *task,
+                            vector<taskgraph_dep> const& deps )
+{
+    taskgraph *graph = task->graph;
+    auto *team = task->team;
+    int node = graph->replay_next( (void*) thunk->routine, deps );
+    if(node < 0) {
+        while(graph->active > 0) {
+            hpx_backend->task_yield();
+        }
+        graph->abandon();
+        return false;
+    }
 
+    perf_counter_add(perf_tasks_deferred);
+    shared_ptr<taskgroup_data> taskgroup = task->taskgroup;
+    if(taskgroup) {
+        taskgroup->num_tasks++;
+    }
+    *(task->num_child_tasks) += 1;
+#ifndef OMP_COMPLIANT
+    team->num_tasks++;
+#endif
+    graph->active++;
+    graph->launch[node] = std::bind(task_setup, task->local_thread_num, thunk, task->icv,
+                                    task->num_child_tasks, taskgroup, task->lineage, team);
+    if(graph->release(node)) {
+        start_graph_node(graph, node, team);
+    }
+    return true;
+}
 
 // The input on the Intel call is a pair of pointers to arrays of dep structs,
 // and the length of these arrays.
@@ -326,183 +782,360 @@ void hpx_runtime::create_df_task( int gtid, kmp_task_t *thunk,
     auto team = task->team;
     if(team->num_threads == 1 ) {
         create_task(thunk->routine, gtid, thunk);
+        return;
+    }
+    bool recording = task->graph && task->graph->mode == taskgraph::recording;
+    vector<taskgraph_dep> graph_deps;
+    if(task->graph && task->graph->mode != taskgraph::off) {
+        graph_deps.reserve( ndeps + ndeps_noalias);
+        for(int i = 0; i < ndeps + ndeps_noalias; i++) {
+            auto &dep = i < ndeps ? dep_list[i] : noalias_dep_list[i - ndeps];
+            graph_deps.push_back( taskgraph_dep{dep.base_addr, dep.len, dep.flags.out} );
+        }
+        if(!recording && replay_df_task( thunk, task, graph_deps )) {
+            return;
+        }
     }
     vector<shared_future<void>> dep_futures;
     dep_futures.reserve( ndeps + ndeps_noalias);
 
-    //Populating a vector of futures that the task depends on
-    for(int i = 0; i < ndeps;i++) {
-        if(task->df_map.count( dep_list[i].base_addr) > 0) {
-            dep_futures.push_back(task->df_map[dep_list[i].base_addr]);
-        }
+    //Populating a vector of futures that the task depends on, and finding
+    // the producer of the largest input. Producers of ranges overlapping a
+    // dependence count, not only the ones of the same address.
+    shared_ptr<atomic<int>> producer;
+    size_t producer_len = 0;
+    vector<int> graph_preds;
+    for(int i = 0; i < ndeps + ndeps_noalias; i++) {
+        auto &dep = i < ndeps ? dep_list[i] : noalias_dep_list[i - ndeps];
+        task->df_map.find( dep.base_addr, dep.len, [&]( df_producer const& p ) {
+            dep_futures.push_back(p.task);
+            if(!producer || dep.len > producer_len) {
+                producer = p.worker;
+                producer_len = dep.len;
+            }
+            if(recording) {
+                graph_preds.push_back(p.graph_node);
+            }
+        });
     }
-    for(int i = 0; i < ndeps_noalias;i++) {
-        if(task->df_map.count( noalias_dep_list[i].base_addr) > 0) {
-            dep_futures.push_back(task->df_map[noalias_dep_list[i].base_addr]);
-        }
+    int graph_node = -1;
+    if(recording) {
+        graph_node = task->graph->record( (void*) thunk->routine, graph_deps, graph_preds );
     }
 
     shared_future<void> new_task;
+    shared_ptr<atomic<int>> worker(new atomic<int>(-1));
 
-    if(task->in_taskgroup) {
-    } else {
-        *(task->num_child_tasks) += 1;
+    perf_counter_add(perf_tasks_deferred);
+    shared_ptr<taskgroup_data> taskgroup = task->taskgroup;
+    if(taskgroup) {
+        taskgroup->num_tasks++;
     }
+    *(task->num_child_tasks) += 1;
 #ifndef OMP_COMPLIANT
     team->num_tasks++;
 #endif
     if(dep_futures.size() == 0) {
 #ifdef OMP_COMPLIANT
-        if(task->in_taskgroup) {
-            new_task = hpx::async( *(task->tg_exec), tg_task_setup, gtid, thunk, task->icv,
-                                    task->tg_exec, team);
-        } else {
-            new_task = hpx::async( *(team->exec), task_setup, gtid, thunk, task->icv,
-                                    task->num_child_tasks, team);
-        }
+        new_task = hpx::async( *(team->exec), df_task_wrapper, task->local_thread_num, thunk, task->icv,
+                                task->num_child_tasks, taskgroup, task->lineage, team, worker,
+                                vector<shared_future<void>>() );
 #else
-        new_task = hpx::async( task_setup, gtid, thunk, task->icv,
-                                task->num_child_tasks, team);
+        new_task = hpx::async( df_task_wrapper, task->local_thread_num, thunk, task->icv,
+                                task->num_child_tasks, taskgroup, task->lineage, team, worker,
+                                vector<shared_future<void>>() );
+#endif
+    } else if(task_placement > 0 && task->icv.device->max_task_priority == 0) {
+        //The producer has started by the time the inputs are ready, so its
+        // worker is known when the task is placed. The executor doesn't see
+        // placed tasks, so the team counts them from here on in both builds.
+        auto done = std::make_shared<hpx::lcos::local::promise<void>>();
+        new_task = done->get_future();
+        omp_icv icv = task->icv;
+        int tid = task->local_thread_num;
+        shared_ptr<atomic<int64_t>> parent_counter = task->num_child_tasks;
+        shared_ptr<task_lineage> creator = task->lineage;
+#ifdef OMP_COMPLIANT
+        team->num_tasks++;
+#endif
+        dataflow( hpx::launch::sync,
+                  [=]( future<vector<shared_future<void>>> ) {
+                      place_df_task( team, producer->load(), [=]() {
+                          df_task_wrapper( tid, thunk, icv, parent_counter, taskgroup, creator,
+                                           team, worker, vector<shared_future<void>>() );
+                          done->set_value();
+#ifdef OMP_COMPLIANT
+                          team->num_tasks--;
 #endif
+                      });
+                  }, hpx::when_all(dep_futures) );
     } else {
         shared_future<kmp_task_t*>      f_thunk = make_ready_future( thunk );
-        shared_future<int>              f_gtid  = make_ready_future( gtid );
+        shared_future<int>              f_tid   = make_ready_future( task->local_thread_num );
         shared_future<omp_icv>          f_icv   = make_ready_future( task->icv );
         shared_future<parallel_region*> f_team  = make_ready_future( team );
         shared_future<shared_ptr<atomic<int64_t>>> f_parent_counter  = hpx::make_ready_future( task->num_child_tasks);
-        shared_future<shared_ptr<atomic<int64_t>>> f_counter;
-
+        shared_future<shared_ptr<taskgroup_data>> f_taskgroup = hpx::make_ready_future( taskgroup );
+        shared_future<shared_ptr<task_lineage>> f_creator = hpx::make_ready_future( task->lineage );
+        shared_future<shared_ptr<atomic<int>>> f_worker = make_ready_future( worker );
 
 #ifdef OMP_COMPLIANT
-        shared_future<shared_ptr<local_priority_queue_executor>> tg_exec = hpx::make_ready_future(task->tg_exec);
-
-        if(task->in_taskgroup) {
-            new_task = dataflow( *(task->tg_exec),
-                                 unwrapped(df_tg_task_wrapper), f_gtid, f_thunk, f_icv, 
-                                 //make_ready_future(task->tg_exec),
-                                 tg_exec, 
-                                 f_team, hpx::when_all(dep_futures) );
-        } else {
-            new_task = dataflow( *(team->exec),
-                                 unwrapped(df_task_wrapper), f_gtid, f_thunk, f_icv, 
-                                 f_parent_counter, 
-                                 f_team, hpx::when_all(dep_futures) );
-        }
+        new_task = dataflow( *(team->exec),
+                             unwrapped(df_task_wrapper), f_tid, f_thunk, f_icv, 
+                             f_parent_counter, f_taskgroup, f_creator,
+                             f_team, f_worker, hpx::when_all(dep_futures) );
 #else
-        new_task = dataflow( unwrapped(df_task_wrapper), f_gtid, f_thunk, f_icv, 
-                             f_parent_counter, 
-                             f_team, hpx::when_all(dep_futures) );
+        new_task = dataflow( unwrapped(df_task_wrapper), f_tid, f_thunk, f_icv, 
+                             f_parent_counter, f_taskgroup, f_creator,
+                             f_team, f_worker, hpx::when_all(dep_futures) );
 #endif
     }
-    for(int i = 0 ; i < ndeps; i++) {
-        if(dep_list[i].flags.out) {
-            task->df_map[dep_list[i].base_addr] = new_task;
-        }
-    }
-    for(int i = 0 ; i < ndeps_noalias; i++) {
-        if(noalias_dep_list[i].flags.out) {
-            task->df_map[noalias_dep_list[i].base_addr] = new_task;
+    for(int i = 0 ; i < ndeps + ndeps_noalias; i++) {
+        auto &dep = i < ndeps ? dep_list[i] : noalias_dep_list[i - ndeps];
+        if(dep.flags.out) {
+            task->df_map.insert( dep.base_addr, dep.len, df_producer{new_task, worker, graph_node} );
         }
     }
     task->last_df_task = new_task;
 }
 
-raw_data future_wrapper( int gtid, kmp_task_t *task, raw_data arg1)
+//Waits for the predecessors of an undeferred task, which then runs inline on
+// the encountering thread. The task is finished before any later sibling is
+// created, so the predecessors' entries are dropped from the dependence map.
+void hpx_runtime::wait_deps( int ndeps, kmp_depend_info_t *dep_list,
+                             int ndeps_noalias, kmp_depend_info_t *noalias_dep_list )
 {
-    memcpy( (task->shareds), arg1.data, arg1.size);
-
-    task->routine(gtid, task);
+    auto task = get_task_data();
+    vector<shared_future<void>> dep_futures;
+    dep_futures.reserve( ndeps + ndeps_noalias);
 
-    delete[] (char*)task;
+#ifdef FUTURIZE_TASKS
+    for(int i = 0; i < ndeps; i++) {
+        shared_future<raw_data> *dep_future = (**(shared_future<raw_data>***)(dep_list[i].base_addr));
+        dep_futures.push_back(*dep_future);
+    }
+#else
+    //Replayed tasks are not in the dependence map; wait for all of them
+    if(task->graph && task->graph->mode == taskgraph::replaying) {
+        while(task->graph->active > 0) {
+            task_yield();
+        }
+    }
+    for(int i = 0; i < ndeps + ndeps_noalias; i++) {
+        auto &dep = i < ndeps ? dep_list[i] : noalias_dep_list[i - ndeps];
+        task->df_map.erase_overlapping( dep.base_addr, dep.len, [&]( df_producer const& p ) {
+            dep_futures.push_back(p.task);
+        });
+    }
+#endif
+    if(dep_futures.size() == 0) {
+        return;
+    }
+    uint64_t wait_start = perf_wait_begin();
+    auto deps_done = hpx::when_all(dep_futures);
+    //queued tasks are run while waiting, the predecessors, descendants of this task, first
+    while(!deps_done.is_ready()) {
+        if(!task_yield()) {
+            deps_done.wait();
+        }
+    }
+    perf_wait_end(perf_taskwait_wait_ns, wait_start);
+}
 
-    return arg1;
+//Dependent tasks created before the region are waited for, so that a graph
+// has no edges to tasks outside of it. Teams of one run their tasks
+// immediately and have nothing to record.
+void hpx_runtime::taskgraph_begin( int id )
+{
+    auto *task = get_task_data();
+    task->taskgraph_ids.push_back(id);
+    if(task->taskgraph_ids.size() > 1 || task->team->num_threads == 1) {
+        return;
+    }
+    task->df_map.for_each( []( df_producer const& p ) {
+        p.task.wait();
+    });
+    task->df_map.clear();
+    taskgraph *graph = taskgraph_get(id);
+    if(graph->begin()) {
+        task->graph = graph;
+    }
 }
 
-//I don't have access to which variable is output, assuming it's the first one for now.
-raw_data future_wrapper2( int gtid, kmp_task_t *task, raw_data arg1, raw_data arg2)
+//The region's tasks are finished at its end, like at a taskwait. An id
+// that isn't the innermost open region's is ignored.
+void hpx_runtime::taskgraph_end( int id )
 {
-    memcpy((task->shareds)            , arg1.data, arg1.size);
-    memcpy((task->shareds) + arg1.size, arg2.data, arg2.size);
+    auto *task = get_task_data();
+    if(task->taskgraph_ids.empty() || task->taskgraph_ids.back() != id) {
+        cout << "kmp_taskgraph_end: ignoring " << id << ", it is not the innermost open region" << endl;
+        return;
+    }
+    task->taskgraph_ids.pop_back();
+    if(!task->taskgraph_ids.empty() || !task->graph) {
+        return;
+    }
+    wait_for_child_tasks(task);
+    while(task->graph->active > 0) {
+        task_yield();
+    }
+    task->df_map.clear();
+    task->graph->end();
+    task->graph = nullptr;
+}
 
-    task->routine(gtid, task);
+//Futurized variables live in one buffer each for the whole program, and the
+// compiler's cache points to the future of the buffer's last value.
+struct future_var {
+    void ***cache;
+    raw_data value;
+};
 
-    delete[] (char*)task;
+//future_cached_fini runs on the main thread after HPX stopped, so this is a
+// spinlock and not an HPX mutex
+static hpx::lcos::local::spinlock future_var_mtx;
+static vector<future_var> future_vars;
 
-    memcpy(arg1.data, (task->shareds), arg1.size);
-    return arg1;
+void* future_cached_get( size_t size, void ***cache )
+{
+    shared_future<raw_data> *future_ptr =
+        (shared_future<raw_data>*) __atomic_load_n( cache, __ATOMIC_ACQUIRE );
+    if( !future_ptr ) {
+        std::lock_guard<hpx::lcos::local::spinlock> lk(future_var_mtx);
+        future_ptr = (shared_future<raw_data>*) *cache;
+        if( !future_ptr ) {
+            raw_data data;
+            data.data = (void*) new char[size]{0};
+            data.size = size;
+            future_ptr = new shared_future<raw_data>( make_ready_future(data) );
+            future_vars.push_back( {cache, data} );
+            __atomic_store_n( cache, (void**) future_ptr, __ATOMIC_RELEASE );
+        }
+    }
+    return future_ptr->get().data;
 }
 
-raw_data future_wrapper3( int gtid, kmp_task_t *task, raw_data arg1, raw_data arg2, raw_data arg3)
+void future_cached_fini()
 {
-    memcpy((task->shareds), 
-            arg1.data, arg1.size);
-    memcpy((task->shareds) + arg1.size,
-            arg2.data, arg2.size);
-    memcpy((task->shareds) + arg1.size + arg3.size, 
-            arg3.data, arg3.size);
+    std::lock_guard<hpx::lcos::local::spinlock> lk(future_var_mtx);
+    for( auto &var : future_vars ) {
+        delete (shared_future<raw_data>*) *var.cache;
+        delete[] (char*) var.value.data;
+        *var.cache = nullptr;
+    }
+    future_vars.clear();
+}
 
-    task->routine(gtid, task);
+//The outlined routine reads the dependences' values from shareds, one after
+// the other in dependence order. A single out dependence is handed over
+// without copying by pointing shareds at its buffer; otherwise the inputs are
+// gathered and only the out dependences are written back, so a task writing
+// its copy of an in dependence leaves the variable alone. Like other
+// deferred tasks, it takes a free gtid while it runs.
+static void future_task_wrapper( kmp_task_t *task,
+                                 vector<shared_future<raw_data>> const& deps,
+                                 vector<bool> const& outs )
+{
+    int gtid = acquire_gtid(-1);
+    if( deps.size() == 1 && outs[0] ) {
+        task->shareds = deps[0].get().data;
+        task->routine(gtid, task);
+    } else {
+        char *shareds = (char*) task->shareds;
+        for( auto const& dep : deps ) {
+            raw_data const& arg = dep.get();
+            memcpy( shareds, arg.data, arg.size );
+            shareds += arg.size;
+        }
 
-    delete[] (char*)task;
+        task->routine(gtid, task);
 
-    memcpy(arg1.data, (task->shareds), arg1.size);
-    return arg1;
+        shareds = (char*) task->shareds;
+        for( size_t i = 0; i < deps.size(); i++ ) {
+            raw_data const& arg = deps[i].get();
+            if( outs[i] ) {
+                memcpy( arg.data, shareds, arg.size );
+            }
+            shareds += arg.size;
+        }
+    }
+    release_gtid(gtid);
+    kmp_task_free(task);
 }
 
 void hpx_runtime::create_future_task( int gtid, kmp_task_t *thunk, 
                                       int ndeps, kmp_depend_info_t *dep_list)
 {
-    shared_future<raw_data> *output_future;
-    vector<shared_future<raw_data>*> input_futures(ndeps);
+    vector<shared_future<raw_data>*> futures;
+    vector<shared_future<raw_data>> inputs;
+    vector<bool> outs;
+    perf_counter_add(perf_tasks_deferred);
 
     //if the variables are FP, then the data needs to be copied, if it's shared, then only
     //pointers need to be set. working with the assumption/requirement that data is FP.
+    futures.reserve(ndeps);
+    inputs.reserve(ndeps);
     for(int i=0; i < ndeps; i++) {
-        input_futures[i] = (**(shared_future<raw_data>***)(dep_list[i].base_addr));
-        if(dep_list[i].flags.out ) {
-            output_future = (**(shared_future<raw_data>***)(dep_list[i].base_addr));
-        }
+        shared_future<raw_data> *dep_future = (**(shared_future<raw_data>***)(dep_list[i].base_addr));
+        futures.push_back(dep_future);
+        inputs.push_back(*dep_future);
+        outs.push_back(dep_list[i].flags.out);
     }
 
-    if(ndeps == 1) {
-        *(output_future) = dataflow( unwrapped(future_wrapper), 
-                                                make_ready_future(gtid), make_ready_future(thunk),
-                                                *(input_futures[0]) );
-    } else if(ndeps == 2) {
-        *(output_future) = dataflow( unwrapped(future_wrapper2), 
-                                                make_ready_future(gtid), make_ready_future(thunk),
-                                                *(input_futures[0]), *(input_futures[1]) );
-    } else if(ndeps == 3) {
-        *(output_future) = dataflow( unwrapped(future_wrapper3), 
-                                                make_ready_future(gtid), make_ready_future(thunk),
-                                                *(input_futures[0]), *(input_futures[1]),
-                                                *(input_futures[2]) );
-    } else {
-        cout << "too many dependencies for now" << endl;
+    shared_future<void> done = dataflow(
+            [thunk, outs]( vector<shared_future<raw_data>> deps ) {
+                future_task_wrapper( thunk, deps, outs );
+            }, inputs );
+
+    //each out variable's next value is its buffer, once the task is done
+    for(int i=0; i < ndeps; i++) {
+        if(outs[i]) {
+            shared_future<raw_data> prev = inputs[i];
+            *(futures[i]) = done.then(
+                    [prev]( shared_future<void> const& f ) {
+                        f.get();
+                        return prev.get();
+                    });
+        }
     }
 }
 
 
-
 void thread_setup( invoke_func kmp_invoke, microtask_t thread_func, 
-                   int argc, void **argv, int tid,
+                   int argc, void **argv, int tid, int gtid,
                    parallel_region *team, omp_task_data *parent,
+                   affinity_assignment const *place,
                    mutex_type& mtx,
                    hpx::lcos::local::condition_variable& cond,
                    atomic<int>& running_threads )
 {
-    omp_task_data task_data(tid, team, parent);
+    omp_task_data task_data(tid, gtid, team, parent);
+    if(place) {
+        task_data.place = place->place;
+        task_data.icv.place_partition_first = place->partition_first;
+        task_data.icv.place_partition_last = place->partition_last;
+    }
 
     set_thread_data( get_self_id(), reinterpret_cast<size_t>(&task_data));
+    ompt_thread_begin();
+    uint64_t trace_start = trace_begin();
+    OMPT_CALLBACK(implicit_task, (ompt_scope_begin, &team->ompt_parallel_data,
+                                  &task_data.ompt_task_data, team->num_threads, tid,
+                                  ompt_task_implicit));
 
     if(argc == 0) { //note: kmp_invoke segfaults iff argc == 0
-        thread_func(&tid, &tid);
+        thread_func(&gtid, &tid);
     } else {
-        kmp_invoke(thread_func, tid, tid, argc, argv);
+        kmp_invoke(thread_func, gtid, tid, argc, argv);
     }
     while (*(task_data.num_child_tasks) > 0 ) {
         hpx::this_thread::yield();
     }
+    OMPT_CALLBACK(implicit_task, (ompt_scope_end, nullptr, &task_data.ompt_task_data,
+                                  team->num_threads, tid, ompt_task_implicit));
+    task_data.loop_chunk.close();
+    task_data.loop_profile.leave();
+    trace_end(trace_implicit_task, trace_start, tid);
 
     if(--running_threads == 0) {
         //hpx::lcos::local::spinlock::scoped_lock lk(mtx);
@@ -515,24 +1148,59 @@ void thread_setup( invoke_func kmp_invoke, microtask_t thread_func,
 // that data is not initialized for the new hpx threads yet.
 void fork_worker( invoke_func kmp_invoke, microtask_t thread_func,
                   int argc, void **argv,
-                  omp_task_data *parent) 
+                  omp_task_data *parent, const void *codeptr ) 
 {
+    uint64_t trace_start = trace_begin();
+    perf_counter_add(perf_parallel_regions);
     parallel_region team(parent->team, parent->threads_requested);
+    OMPT_CALLBACK(parallel_begin, (&parent->ompt_task_data, &ompt_frame_unknown,
+                                   &team.ompt_parallel_data, parent->threads_requested,
+                                   ompt_parallel_invoker_runtime | ompt_parallel_team, codeptr));
     
 #ifdef OMP_COMPLIANT
-    team.exec.reset(new local_priority_queue_executor(parent->threads_requested));
+    team.exec = acquire_team_executor(parent->threads_requested);
 #endif
     hpx::lcos::local::condition_variable cond;
     mutex_type mtx;
     atomic<int> running_threads;
     running_threads = parent->threads_requested;
 
+    //With OMP_PLACES/OMP_PROC_BIND, thread i runs on a worker bound to its place
+    std::vector<affinity_assignment> places;
+    int bind = parent->proc_bind_requested;
+    if( bind == proc_bind_default || bind == proc_bind_intel ) {
+        bind = affinity_bind_var(parent->icv.levels);
+    }
+    if( affinity_enabled() && bind != proc_bind_false ) {
+        affinity_assign_team( bind, parent->threads_requested, parent->place,
+                              parent->icv.place_partition_first, parent->icv.place_partition_last,
+                              places );
+    }
+
+    //Unbound, rank i of a first level team runs on worker i, and rank i of a
+    // nested team i workers after its parent's worker. With static queuing
+    // nothing is stolen, so a team of the same shape gets the same workers in
+    // every region, and data first touched by a rank stays local to it.
+    int num_workers = hpx::get_os_thread_count();
+    int first_worker = 0;
+    if( parent->icv.levels > 0 && hpx::get_worker_thread_num() != std::size_t(-1) ) {
+        first_worker = hpx::get_worker_thread_num();
+    }
+
+    vector<int> gtids(parent->threads_requested);
+    gtids[0] = parent->global_thread_num;
+    for( int i = 1; i < parent->threads_requested; i++ ) {
+        gtids[i] = acquire_gtid( parent->icv.active_levels == 0 ? i : -1 );
+    }
+
     for( int i = 0; i < parent->threads_requested; i++ ) {
+        affinity_assignment const *place = places.empty() ? nullptr : &places[i];
+        int worker = place ? place->worker : (first_worker + i) % num_workers;
         hpx::applier::register_thread_nullary(
-                std::bind( &thread_setup, kmp_invoke, thread_func, argc, argv, i, &team, parent, 
-                           boost::ref(mtx), boost::ref(cond), boost::ref(running_threads) ),
+                std::bind( &thread_setup, kmp_invoke, thread_func, argc, argv, i, gtids[i], &team, parent,
+                           place, boost::ref(mtx), boost::ref(cond), boost::ref(running_threads) ),
                 "omp_implicit_task", hpx::threads::pending,
-                true, hpx::threads::thread_priority_normal, i );
+                true, hpx::threads::thread_priority_normal, worker );
     }
     {
         //hpx::lcos::local::spinlock::scoped_lock lk(mtx);
@@ -541,22 +1209,32 @@ void fork_worker( invoke_func kmp_invoke, microtask_t thread_func,
             cond.wait(lk);
         }
     }
-    //The executor containing the tasks will be destroyed as this call goes out
-    //of scope, which will wait on all tasks contained in it. So, nothing needs
-    //to be done here for it.
-#ifndef OMP_COMPLIANT
+    //Tasks still running take ids of their own
+    for( int i = 1; i < parent->threads_requested; i++ ) {
+        release_gtid( gtids[i] );
+    }
+    //The team's tasks have to finish before its executor goes to the next team
+#ifdef OMP_COMPLIANT
+    while(team.exec->num_pending_closures() > 0 || team.num_tasks > 0) {
+        hpx::this_thread::yield();
+    }
+    release_team_executor(parent->threads_requested, std::move(team.exec));
+#else
     while(team.num_tasks > 0) {
         hpx::this_thread::yield();
     }
 #endif
+    OMPT_CALLBACK(parallel_end, (&team.ompt_parallel_data, &parent->ompt_task_data,
+                                 ompt_parallel_invoker_runtime | ompt_parallel_team, codeptr));
+    trace_end(trace_parallel, trace_start, team.num_threads);
 }
 
 void fork_and_sync( invoke_func kmp_invoke, microtask_t thread_func, 
                     int argc, void **argv,
-                    omp_task_data *parent, boost::mutex& mtx, 
+                    omp_task_data *parent, const void *codeptr, boost::mutex& mtx, 
                     boost::condition& cond, bool& running ) 
 {
-    fork_worker(kmp_invoke, thread_func, argc, argv, parent);
+    fork_worker(kmp_invoke, thread_func, argc, argv, parent, codeptr);
     {
         boost::mutex::scoped_lock lk(mtx);
         running = true;
@@ -566,11 +1244,25 @@ void fork_and_sync( invoke_func kmp_invoke, microtask_t thread_func,
  
 //TODO: This can make main an HPX high priority thread
 //TODO: according to the spec, the current thread should be thread 0 of the new team, and execute the new work.
-void hpx_runtime::fork(invoke_func kmp_invoke, microtask_t thread_func, int argc, void** argv)
+void hpx_runtime::fork(invoke_func kmp_invoke, microtask_t thread_func, int argc, void** argv,
+                       const void *codeptr)
 { 
     omp_task_data *current_task = get_task_data();
-    if( hpx::threads::get_self_ptr() ) {
-        fork_worker(kmp_invoke, thread_func, argc, argv, current_task);
+    current_task->threads_requested = reserve_threads(current_task);
+    if( current_task->threads_requested == 1 ) {
+        //No HPX thread, executor or barrier is needed for a team of one
+        serialized_region region(current_task, codeptr);
+        begin_serialized(&region);
+        int tid = 0;
+        int gtid = current_task->global_thread_num;
+        if(argc == 0) {
+            thread_func(&gtid, &tid);
+        } else {
+            kmp_invoke(thread_func, gtid, tid, argc, argv);
+        }
+        end_serialized(&region);
+    } else if( hpx::threads::get_self_ptr() ) {
+        fork_worker(kmp_invoke, thread_func, argc, argv, current_task, codeptr);
     } else {
         boost::mutex mtx;
         boost::condition cond;
@@ -578,7 +1270,7 @@ void hpx_runtime::fork(invoke_func kmp_invoke, microtask_t thread_func, int argc
         hpx::applier::register_thread_nullary(
                 std::bind(&fork_and_sync,
                     kmp_invoke, thread_func, argc, argv,
-                    current_task, boost::ref(mtx), boost::ref(cond), boost::ref(running))
+                    current_task, codeptr, boost::ref(mtx), boost::ref(cond), boost::ref(running))
                 , "ompc_fork_worker");
         {   // Wait for the thread to run.
             boost::mutex::scoped_lock lk(mtx);
@@ -586,6 +1278,84 @@ void hpx_runtime::fork(invoke_func kmp_invoke, microtask_t thread_func, int argc
                 cond.wait(lk);
         }
     }
+    threads_busy -= current_task->threads_requested - 1;
     current_task->set_threads_requested(current_task->icv.nthreads );
+    current_task->proc_bind_requested = proc_bind_default;
+}
+
+void hpx_runtime::begin_serialized( serialized_region *region )
+{
+    omp_task_data *parent = region->parent;
+    region->trace_start = trace_begin();
+    perf_counter_add(perf_parallel_regions);
+    OMPT_CALLBACK(parallel_begin, (&parent->ompt_task_data, &ompt_frame_unknown,
+                                   &region->ompt_parallel_data, 1,
+                                   ompt_parallel_invoker_program | ompt_parallel_team,
+                                   region->codeptr));
+    region->parent_data = swap_task_data(reinterpret_cast<size_t>(&region->task));
+    OMPT_CALLBACK(implicit_task, (ompt_scope_begin, &region->ompt_parallel_data,
+                                  &region->task.ompt_task_data, 1, 0, ompt_task_implicit));
+}
+
+void hpx_runtime::end_serialized( serialized_region *region )
+{
+    omp_task_data *task = &region->task;
+    wait_for_child_tasks(task);
+    OMPT_CALLBACK(implicit_task, (ompt_scope_end, nullptr, &task->ompt_task_data,
+                                  1, 0, ompt_task_implicit));
+    task->loop_chunk.close();
+    task->loop_profile.leave();
+    swap_task_data(region->parent_data);
+    OMPT_CALLBACK(parallel_end, (&region->ompt_parallel_data, &region->parent->ompt_task_data,
+                                 ompt_parallel_invoker_program | ompt_parallel_team,
+                                 region->codeptr));
+    trace_end(trace_parallel, region->trace_start, 1);
+}
+
+//With dyn-var set, a team gets a thread for the forking thread and one
+// for each other worker with nothing running or queued. Threads suspended
+// on a future or in a barrier don't hold their worker, so HPX work and
+// other teams only count while they actually compete for the workers.
+int hpx_runtime::idle_workers()
+{
+    auto &tm = hpx::threads::get_thread_manager();
+    std::size_t self = hpx::get_worker_thread_num();
+    int idle = 0;
+    for( std::size_t w = 0; w < hpx::get_os_thread_count(); w++ ) {
+        if( w == self ) {
+            continue;
+        }
+        if( tm.get_thread_count( hpx::threads::active, hpx::threads::thread_priority_default, w ) +
+            tm.get_thread_count( hpx::threads::pending, hpx::threads::thread_priority_default, w ) == 0 ) {
+            idle++;
+        }
+    }
+    return idle;
+}
+
+//A first level team gets the threads it asks for, up to OMP_THREAD_LIMIT.
+// Nested teams only get the workers that no implicit task of another team
+// is running on, so a threaded library called from a parallel region
+// doesn't multiply the number of HPX threads competing for the workers.
+// The forking thread waits for its team, so its own slot is reused.
+int hpx_runtime::reserve_threads( omp_task_data *parent )
+{
+    int requested = parent->threads_requested;
+    if( parent->icv.active_levels >= device_icv.max_active_levels ) {
+        return 1;
+    }
+    if( parent->icv.dyn ) {
+        requested = std::min( requested, 1 + idle_workers() );
+    }
+    int capacity = device_icv.thread_limit;
+    if( parent->icv.active_levels > 0 ) {
+        capacity = std::min( capacity, (int) hpx::get_os_thread_count() );
+    }
+    int busy = threads_busy;
+    int extra;
+    do {
+        extra = std::max( 0, std::min( requested - 1, capacity - busy ) );
+    } while( !threads_busy.compare_exchange_weak( busy, busy + extra ) );
+    return extra + 1;
 }
 
@@ -24,9 +24,16 @@
 #include <atomic>
 
 #include <hpx/util/high_resolution_timer.hpp>
+#include <functional>
 #include <map>
 
 #include "icv-vars.h"
+#include "affinity.h"
+#include "ompt.h"
+#include "trace.h"
+#include "loop_profile.h"
+#include "taskgraph.h"
+#include "dep_index.h"
 
 #include <mutex>
 
@@ -55,17 +62,54 @@ typedef boost::shared_ptr<mutex_type> mtx_ptr;
 
 typedef int (* kmp_routine_entry_t)( int, void * );
 
-typedef std::map<int64_t, hpx::shared_future<void>> depends_map;
+//The last task with an out dependence on an address range, the worker it
+// ran on (-1 until it starts), and its node if a task graph is recorded
+struct df_producer {
+    hpx::shared_future<void> task;
+    shared_ptr<atomic<int>> worker;
+    int graph_node;
+};
+typedef dep_index<df_producer> depends_map;
+
+typedef union kmp_cmplrdata {
+    int                 priority;
+    kmp_routine_entry_t destructors;
+} kmp_cmplrdata_t;
 
+//data1 and data2 are only there when the task flags say so
 typedef struct kmp_task {
     void *              shareds;
     kmp_routine_entry_t routine;
     int                 part_id;
-#if OMP_40_ENABLED
-    kmp_routine_entry_t destructors;
-#endif
+    kmp_cmplrdata_t     data1;      //destructors
+    kmp_cmplrdata_t     data2;      //priority
 } kmp_task_t;
 
+//Runtime bookkeeping in front of every task thunk. The thunk follows it
+// directly, and stays 16 byte aligned.
+struct alignas(16) kmp_task_header {
+    ompt_data_t ompt_task_data;
+    int ompt_task_flags;
+    bool has_priority;
+};
+
+inline kmp_task_header* kmp_task_get_header( kmp_task_t *task ) {
+    return reinterpret_cast<kmp_task_header*>(task) - 1;
+}
+
+//The priority clause is stored by the compiler after the task is allocated
+inline int kmp_task_priority( kmp_task_t *task, int max_priority ) {
+    if( !kmp_task_get_header(task)->has_priority ) {
+        return 0;
+    }
+    return std::max( 0, std::min( task->data2.priority, max_priority ) );
+}
+
+//Frees a thunk allocated by __kmpc_omp_task_alloc
+inline void kmp_task_free( kmp_task_t *task ) {
+    delete[] reinterpret_cast<char*>( kmp_task_get_header(task) );
+}
+
 
 typedef struct kmp_depend_info {
     int64_t   base_addr;
@@ -115,6 +159,19 @@ class loop_data {
         std::vector<int> iter_count;
 };
 
+//A task's link to the task that created it, so a taskyield can tell the
+// yielding task's descendants from other tasks. Descendants keep the chain
+// alive after their ancestors finish.
+struct task_lineage {
+    shared_ptr<task_lineage> parent;
+};
+
+struct ready_task {
+    std::function<void()> run;
+    shared_ptr<task_lineage> creator;
+    bool untied;
+};
+
 //Does this need to keep track of the parallel region it is nested in,
 // the omp_task_data of the parent thread, or both?
 //template<typename scheduler>
@@ -131,7 +188,6 @@ struct parallel_region {
     int num_threads;
     hpx::lcos::local::condition_variable cond;
     barrier globalBarrier;
-    mutex_type crit_mtx{};
     mutex_type thread_mtx{};
     mutex_type single_mtx{}; 
     int depth;
@@ -145,9 +201,23 @@ struct parallel_region {
 #ifdef OMP_COMPLIANT
     shared_ptr<local_priority_queue_executor> exec;
 #endif
+    ompt_data_t ompt_parallel_data = ompt_data_none;
+
+    //Deferred tasks wait here, highest priority first, for a closure the
+    // team's executor runs or a thread at a taskyield to take them
+    hpx::lcos::local::spinlock ready_mtx;
+    std::multimap<int, ready_task, std::greater<int>> ready_tasks;
 };
 
 
+//Taskgroups nest, so each one links to the one it's in. Tasks created in
+// a taskgroup and all their descendants count in it until they complete.
+struct taskgroup_data {
+    taskgroup_data( shared_ptr<taskgroup_data> const& p ) : parent(p) {}
+    atomic<int64_t> num_tasks{0};
+    shared_ptr<taskgroup_data> parent;
+};
+
 //What parts of a task could I move to a shared state to get a performance
 // improvement, or some other, orgizational improvement?
 // icvs?
@@ -158,64 +228,90 @@ class omp_task_data {
             : team(T), num_child_tasks(new atomic<int64_t>{0})
               {
             local_thread_num = 0;
+            ompt_task_flags = ompt_task_initial;
             icv.device = global;
             icv.nthreads = init_num_threads;
             threads_requested = icv.nthreads;
         };
 
         //should be used for implicit tasks/threads
-        omp_task_data(int tid, parallel_region *T, omp_task_data *P )
-            : omp_task_data(tid, T, P->icv)
+        omp_task_data(int tid, int gtid, parallel_region *T, omp_task_data *P )
+            : omp_task_data(tid, gtid, T, P->icv)
         {
             icv.levels++;
+            ompt_task_flags = ompt_task_implicit;
             if(team->num_threads > 1) {
                 icv.active_levels++;
             }
         };
 
         //This is for explicit tasks
-        omp_task_data(int tid, parallel_region *T, omp_icv icv_vars)
-            : local_thread_num(tid), team(T), icv(icv_vars), num_child_tasks(new atomic<int64_t>{0})
+        omp_task_data(int tid, int gtid, parallel_region *T, omp_icv icv_vars)
+            : local_thread_num(tid), global_thread_num(gtid), team(T), icv(icv_vars),
+              num_child_tasks(new atomic<int64_t>{0})
         {
             threads_requested = icv.nthreads;
             icv_vars.device = icv.device;
         };
 
-        //assuming the number of threads that can be created is infinte (so I can avoid using ThreadsBusy)
+        //max-active-levels-var and the thread limit are applied when the team
+        // is forked, see hpx_runtime::reserve_threads.
         //See section 2.3 of the OpenMP 4.0 spec for details on ICVs.
         void set_threads_requested( int nthreads ){
             if( nthreads > 0) {
                 threads_requested = nthreads;
             }
-            int active_regions = icv.active_levels;
-            if( icv.nest && active_regions > 1) {
-                threads_requested = 1;
-            }
-            if(active_regions == icv.device->max_active_levels) {
-                threads_requested = 1;
-            }
         }
         
         int local_thread_num;
-        //int global_thread_num;
+        int global_thread_num{0};
         int threads_requested;
+        int proc_bind_requested{proc_bind_default};
+        int place{-1};                  //set for implicit tasks of bound teams
         parallel_region *team;
         mutex_type thread_mutex;
         hpx::lcos::local::condition_variable thread_cond;
         shared_ptr<atomic<int64_t>> num_child_tasks;
         int single_counter{0};
         int loop_num{0};
-        bool in_taskgroup{false};
         shared_future<void> last_df_task;
 
-#ifdef OMP_COMPLIANT
-        shared_ptr<local_priority_queue_executor> tg_exec;
-#else
-        shared_ptr<atomic<int64_t>> tg_num_tasks;
-#endif
+        //The innermost taskgroup, inherited by descendant tasks
+        shared_ptr<taskgroup_data> taskgroup;
+        shared_ptr<task_lineage> lineage{new task_lineage};
+        //The innermost tied explicit task running on this thread, this one
+        // if it is tied; null when there is none
+        task_lineage const *tied_lineage{nullptr};
+
+        //The task graph being recorded or replayed, see taskgraph.h. Nested
+        // regions are part of the outermost one; taskgraph_ids are the ids
+        // of the open regions, innermost last.
+        taskgraph *graph{nullptr};
+        vector<int> taskgraph_ids;
 
         omp_icv icv;
         depends_map df_map;
+
+        ompt_data_t ompt_task_data = ompt_data_none;
+        int ompt_task_flags{ompt_task_explicit};
+        trace_chunk loop_chunk;
+        loop_profile_state loop_profile;
+};
+
+//A team of one thread, run by the thread that encounters the region. Its
+// team record and implicit task live on that thread's stack, or, for
+// __kmpc_serialized_parallel, until __kmpc_end_serialized_parallel.
+struct serialized_region : parallel_region {
+    serialized_region( omp_task_data *P, const void *code )
+        : parallel_region( P->team, 1 ), task( 0, P->global_thread_num, this, P ), parent( P ), codeptr( code )
+    {
+        task.place = parent->place;
+    }
+    omp_task_data task;
+    omp_task_data *parent;
+    size_t parent_data{0};      //the thread's data before the region
+    const void *codeptr;
+    uint64_t trace_start{0};
 };
 
 struct raw_data {
@@ -223,17 +319,32 @@ struct raw_data {
     size_t size;
 };
 
+//Buffer of a futurized variable, created on first use and freed by
+// future_cached_fini when the runtime stops.
+void* future_cached_get( size_t size, void ***cache );
+void future_cached_fini();
+
 class hpx_runtime {
     public:
         hpx_runtime();
-        void fork(invoke_func kmp_invoke, microtask_t thread_func, int argc, void** argv);
+        void fork(invoke_func kmp_invoke, microtask_t thread_func, int argc, void** argv,
+                  const void *codeptr = nullptr);
         parallel_region* get_team();
+        void begin_serialized( serialized_region *region );
+        size_t swap_task_data( size_t data );
+        void end_serialized( serialized_region *region );
         omp_task_data* get_task_data();
         int get_thread_num();
+        int get_global_thread_num();
         int get_num_threads();
         int get_num_procs();
+        int get_thread_limit();
+        int get_max_task_priority();
+        void set_max_active_levels(int levels);
+        int get_max_active_levels();
         void set_num_threads(int nthreads);
-        void barrier_wait();
+        void barrier_wait( ompt_sync_region_t kind = ompt_sync_region_barrier_implementation,
+                           const void *codeptr = nullptr );
         void create_task( omp_task_func taskfunc, void *frame_pointer,
                           void *firstprivates, int is_tied, int blocks_parent);
         void create_task( kmp_routine_entry_t taskfunc, int gtid, kmp_task_t *task);
@@ -243,8 +354,13 @@ class hpx_runtime {
 
         void create_future_task( int gtid, kmp_task_t *thunk, 
                                  int ndeps, kmp_depend_info_t *dep_list);
+        void wait_deps( int ndeps, kmp_depend_info_t *dep_list,
+                        int ndeps_noalias, kmp_depend_info_t *noalias_dep_list );
+        void taskgraph_begin( int id );
+        void taskgraph_end( int id );
         void task_exit();
-        void task_wait();
+        void task_wait( const void *codeptr = nullptr );
+        bool task_yield();
         double get_time();
         void delete_hpx_objects();
         void env_init();
@@ -261,6 +377,9 @@ class hpx_runtime {
         bool external_hpx;
         omp_device_icv device_icv;
 
-        //atomic<int> threads_running{0};//ThreadsBusy
+        //Implicit tasks of all running teams, counting the initial thread
+        atomic<int> threads_busy{1};
+        int reserve_threads( omp_task_data *parent );
+        int idle_workers();
 };
 
@@ -1,4 +1,5 @@
 
+#include <cstdint>
 #include <limits>
 
 struct omp_device_icv {
@@ -7,6 +8,9 @@ struct omp_device_icv {
     //stacksize
     //wait_policy //active
     int max_active_levels{std::numeric_limits<int>::max()};
+    //There's only one contention group, so the thread limit is global
+    int thread_limit{std::numeric_limits<int>::max()};
+    int max_task_priority{0};
     bool cancel{false};
     //int stacksize_var; //-Ihpx.stacks.small_size=... (use hex numbers)
         //http://stellar-group.github.io/hpx/docs/html/hpx/manual/init/configuration/config_defaults.html
@@ -20,12 +24,13 @@ struct omp_icv {
     int nthreads;
     //int run_sched{0};//static schedule
     //bool bind{false};
-    //int thread_limit{std::numeric_limits<int>::max()};
     int active_levels{0};
     int levels{0};
     //int default_device{0};
     //scoped to implicit task
-    //int place_partition;//set to all threads
+    int place_partition_first{0};   //indices into omp_places, all of them
+    int place_partition_last{-1};   // for the initial task
+    uintptr_t def_allocator{1};     //omp_default_mem_alloc
     omp_device_icv *device;
 };
 
@@ -1,5 +1,8 @@
 #include "intel_hpxMP.h"
+#include "perf_counters.h"
 #include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <assert.h>
 
@@ -44,7 +47,7 @@ __kmpc_fork_call(ident_t *loc, kmp_int32 argc, kmpc_micro microtask, ...) {
     va_end( ap );
     void ** args = argv.data();
 
-    hpx_backend->fork(__kmp_invoke_microtask, microtask, argc, args);
+    hpx_backend->fork(__kmp_invoke_microtask, microtask, argc, args, __builtin_return_address(0));
 }
 
 // ----- Tasks -----
@@ -55,11 +58,20 @@ __kmpc_omp_task_alloc( ident_t *loc_ref, kmp_int32 gtid, kmp_int32 flags,
                        size_t sizeof_kmp_task_t, size_t sizeof_shareds,
                        kmp_routine_entry_t task_entry ){
 
-    //kmp_tasking_flags_t *input_flags = (kmp_tasking_flags_t *) & flags;
-    //TODO: do I need to do something with these flags?
+    kmp_tasking_flags_t *input_flags = (kmp_tasking_flags_t *) & flags;
     int task_size = sizeof_kmp_task_t + (-sizeof_kmp_task_t%8);
 
-    kmp_task_t *task = (kmp_task_t*)new char[task_size + sizeof_shareds]; 
+    kmp_task_header *header = (kmp_task_header*)
+        new char[sizeof(kmp_task_header) + task_size + sizeof_shareds];
+    kmp_task_t *task = (kmp_task_t*)(header + 1);
+
+    header->ompt_task_data.value = 0;
+    header->ompt_task_flags = ompt_task_explicit;
+    if( !input_flags->tiedness )
+        header->ompt_task_flags |= ompt_task_untied;
+    if( input_flags->final )
+        header->ompt_task_flags |= ompt_task_final;
+    header->has_priority = input_flags->priority_specified;
 
     //This gets deleted at the end of task_setup
     task->routine = task_entry;
@@ -70,6 +82,10 @@ __kmpc_omp_task_alloc( ident_t *loc_ref, kmp_int32 gtid, kmp_int32 flags,
     }
     task->part_id = 0;
 
+    perf_counter_add(perf_tasks_created);
+    OMPT_CALLBACK(task_create, (&hpx_backend->get_task_data()->ompt_task_data, &ompt_frame_unknown,
+                                &header->ompt_task_data, header->ompt_task_flags, 0,
+                                __builtin_return_address(0)));
     return task;
 }
 
@@ -111,47 +127,59 @@ int __kmpc_omp_task_parts( ident_t *loc_ref, int gtid, kmp_task_t * new_task) {
 }
 
 kmp_int32 __kmpc_omp_taskwait( ident_t *loc_ref, kmp_int32 gtid ){
-    hpx_backend->task_wait();
+    hpx_backend->task_wait(__builtin_return_address(0));
     return 0;
 }
 
 kmp_int32 __kmpc_omp_taskyield(ident_t *loc_ref, kmp_int32 gtid, int end_part ){
-    hpx::this_thread::yield();
+    start_backend();
+    hpx_backend->task_yield();
     return 0;
 }
 
 void __kmpc_taskgroup( ident_t* loc, int gtid ) {
-    if( hpx_backend->start_taskgroup() ) {
+    if( !hpx_backend->start_taskgroup() ) {
         cout << "Warning, taskgroup failed to start" << endl;
     }
-    //hpx_backend->get_task_data()->num_taskgroup_tasks.reset(new atomic<int>{0});
 }
 
 //Wait until all tasks generated by the current task and its descendants are complete
 void __kmpc_end_taskgroup( ident_t* loc, int gtid ) {
     hpx_backend->end_taskgroup();
-    /*
-    while( *(hpx_backend->get_task_data()->num_taskgroup_tasks) > 0 ) {
-        hpx::this_thread::yield();
-    }
-    hpx_backend->get_task_data()->num_taskgroup_tasks.reset();
-    */
 }
 
 void
 __kmpc_omp_wait_deps( ident_t *loc_ref, kmp_int32 gtid, kmp_int32 ndeps, 
                       kmp_depend_info_t *dep_list, kmp_int32 ndeps_noalias, 
                       kmp_depend_info_t *noalias_dep_list ){
-    //Not handling dependencies at the moment
-    if(ndeps > 0 || ndeps_noalias > 0){
-        cout <<"task has more than 0 dependencies. This runtime does not support task dependencies\n";
-        assert(ndeps == 0);
-        assert(ndeps_noalias == 0);
-    }
+    hpx_backend->wait_deps( ndeps, dep_list, ndeps_noalias, noalias_dep_list );
+}
+
+//Always returns 1, so the compiler runs the region's body every time:
+// replaying a graph still needs the body to create the tasks, with their
+// current firstprivate values, and is never a reason to skip it.
+kmp_int32
+__kmpc_start_record_task( ident_t *loc_ref, kmp_int32 gtid, kmp_int32 input_flags,
+                          kmp_int32 tdg_id ){
+    start_backend();
+    hpx_backend->taskgraph_begin(tdg_id);
+    return 1;
+}
+
+void
+__kmpc_end_record_task( ident_t *loc_ref, kmp_int32 gtid, kmp_int32 input_flags,
+                        kmp_int32 tdg_id ){
+    hpx_backend->taskgraph_end(tdg_id);
 }
 
 void __kmpc_omp_task_begin_if0( ident_t *loc_ref, kmp_int32 gtid, kmp_task_t * task ){
+    perf_counter_add(perf_tasks_inline);
+    ompt_data_t *if0_task_data = &kmp_task_get_header(task)->ompt_task_data;
+    OMPT_CALLBACK(task_schedule, (&hpx_backend->get_task_data()->ompt_task_data,
+                                  ompt_task_switch, if0_task_data));
     task->routine(gtid, task);
+    OMPT_CALLBACK(task_schedule, (if0_task_data, ompt_task_complete,
+                                  &hpx_backend->get_task_data()->ompt_task_data));
     //FIXME: not sure if this is correct. These only seem to do internal 
     //tracking in the intel runtime
 }
@@ -172,19 +200,34 @@ __kmpc_push_num_threads( ident_t *loc,
     data->set_threads_requested( num_threads );
 }
 
+void
+__kmpc_push_proc_bind( ident_t *loc, kmp_int32 global_tid, int proc_bind ){
+    start_backend();
+    hpx_backend->get_task_data()->proc_bind_requested = proc_bind;
+}
+
+//KMP_IDENT_BARRIER_EXPL and KMP_IDENT_BARRIER_IMPL
+static ompt_sync_region_t barrier_kind( ident_t *loc ) {
+    if( loc && (loc->flags & 0x20) )
+        return ompt_sync_region_barrier_explicit;
+    if( loc && (loc->flags & 0x40) )
+        return ompt_sync_region_barrier_implicit;
+    return ompt_sync_region_barrier;
+}
+
 void
 __kmpc_barrier(ident_t *loc, kmp_int32 global_tid) {
-    hpx_backend->barrier_wait();
+    hpx_backend->barrier_wait(barrier_kind(loc), __builtin_return_address(0));
 }
 
 int  __kmpc_cancel_barrier(ident_t* loc_ref, kmp_int32 gtid){
-    hpx_backend->barrier_wait();
+    hpx_backend->barrier_wait(barrier_kind(loc_ref), __builtin_return_address(0));
     return 0;
 }
 
 int __kmpc_global_thread_num(ident_t *loc){
     if(hpx_backend)
-        return hpx_backend->get_thread_num();
+        return hpx_backend->get_global_thread_num();
     return 0;
 }
 
@@ -223,17 +266,83 @@ int __kmpc_master(ident_t *loc, int global_tid){
 void __kmpc_end_master(ident_t *loc, int global_tid){
 }
 
+//Picks the lock kind for a hint, or default_kind if there is none.
+// Speculation isn't supported, so a speculative hint gets a lock that spins
+// for a while before suspending.
+kmp_lock_kind kmp_lock_kind_from_hint( uintptr_t hint, kmp_lock_kind default_kind ) {
+    if( hint & omp_lock_hint_speculative ) {
+        return kmp_lock_adaptive;
+    }
+    if( hint & omp_lock_hint_contended ) {
+        return kmp_lock_queuing;
+    }
+    if( hint & omp_lock_hint_uncontended ) {
+        return kmp_lock_tas;
+    }
+    return default_kind;
+}
+
+//The kind of lock as reported to OMPT tools
+static unsigned ompt_mutex_impl( kmp_lock_kind kind ) {
+    if( kind == kmp_lock_tas || kind == kmp_lock_ticket ) {
+        return kmp_mutex_impl_spin;
+    }
+    return kmp_mutex_impl_queuing;
+}
+
+//Each critical name gets its own lock, created by the first thread to enter
+// and stored in the first word of the (zero initialized) compiler storage.
+// Critical sections with different names don't exclude each other, and
+// the same name excludes across all teams.
+static kmp_indirect_lock* get_critical_lock( ident_t *loc, kmp_critical_name *crit, uintptr_t hint ) {
+    std::atomic<kmp_indirect_lock*> *lck_ptr = (std::atomic<kmp_indirect_lock*>*) crit;
+    kmp_indirect_lock *lck = lck_ptr->load( std::memory_order_acquire );
+    if( !lck ) {
+        kmp_indirect_lock *new_lck = kmp_new_indirect_lock( kmp_lock_kind_from_hint(hint, kmp_lock_hpx) );
+        if( lock_profile_enabled ) {
+            new_lck = new kmp_profiled_lock( new_lck,
+                          lock_profile_get_site( "critical", loc ? loc->psource : nullptr, crit ) );
+        }
+        if( lck_ptr->compare_exchange_strong( lck, new_lck, std::memory_order_acq_rel ) ) {
+            lck = new_lck;
+            if( lock_profile_enabled ) {
+                static_cast<kmp_profiled_lock*>( lck )->installed();
+            }
+        } else {
+            delete new_lck;
+        }
+    }
+    return lck;
+}
+
+static void enter_critical( ident_t *loc, kmp_critical_name *crit, uintptr_t hint, const void *codeptr ) {
+    start_backend();
+    kmp_indirect_lock *lck = get_critical_lock( loc, crit, hint );
+    OMPT_CALLBACK(mutex_acquire, (ompt_mutex_critical, (unsigned) hint, ompt_mutex_impl(lck->kind),
+                                  (ompt_wait_id_t) crit, codeptr));
+    if( !lck->try_lock() ) {
+        perf_counter_add(perf_critical_contended);
+        lck->lock();
+    }
+    OMPT_CALLBACK(mutex_acquired, (ompt_mutex_critical, (ompt_wait_id_t) crit, codeptr));
+}
+
 void
 __kmpc_critical( ident_t * loc, kmp_int32 global_tid, kmp_critical_name * crit ) {
-    start_backend();
-    parallel_region *team = hpx_backend->get_team();
-    team->crit_mtx.lock();
+    enter_critical( loc, crit, omp_lock_hint_none, __builtin_return_address(0) );
+}
+
+void
+__kmpc_critical_with_hint( ident_t * loc, kmp_int32 global_tid,
+                           kmp_critical_name * crit, uintptr_t hint ) {
+    enter_critical( loc, crit, hint, __builtin_return_address(0) );
 }
 
 void
 __kmpc_end_critical(ident_t *loc, kmp_int32 global_tid, kmp_critical_name *crit) {
-    parallel_region *team = hpx_backend->get_team();
-    team->crit_mtx.unlock();
+    (*(kmp_indirect_lock**) crit)->unlock();
+    OMPT_CALLBACK(mutex_released, (ompt_mutex_critical, (ompt_wait_id_t) crit,
+                                   __builtin_return_address(0)));
 }
 
 void __kmpc_flush(ident_t *loc, ...){
@@ -241,40 +350,23 @@ void __kmpc_flush(ident_t *loc, ...){
 }
 
 void * __kmpc_future_cached(ident_t *  loc, kmp_int32  global_tid, void *data, size_t size, void ***cache) {
-    void *retval;
-    shared_future<raw_data> *future_ptr;
-    if(!(*cache)) {
-        raw_data data; //TODO: When is this freed?
-        data.data = (void*)new char[size]{0};
-        data.size = size;
-        future_ptr = new shared_future<raw_data>(hpx::make_ready_future(data));
-        *cache = (void**) future_ptr;
-    } else {
-        future_ptr = (shared_future<raw_data>*) *cache;
-    }
-
-    retval = future_ptr->get().data;
-    return retval;
+    start_backend();
+    return future_cached_get(size, cache);
 }
 
-//I think I need to pair up *data to with the memory allocated to represend the threadlocal version
-void* __kmpc_threadprivate_cached( ident_t *loc, kmp_int32 tid, void *data, size_t size, void ***cache){
+//data is the original variable, which the initial thread keeps using; the
+// other threads get their own copy (see threadprivate.h).
+void* __kmpc_threadprivate_cached( ident_t *loc, kmp_int32 gtid, void *data, size_t size, void ***cache){
     start_backend();
-    parallel_region *team = hpx_backend->get_team();
-    int num_threads = hpx_backend->get_num_threads();
+    return threadprivate_get(data, size, cache, gtid);
+}
 
-    if(!(*cache)){
-        team->thread_mtx.lock();
-        if(!(*cache)){
-            *cache = (void**)calloc( 8, num_threads);//FIXME: this is never deallocated.
-        }
-        team->thread_mtx.unlock();
-    }
-    if( !((*cache)[tid]) ) {
-        (*cache)[tid] = new char[size];
-        std::memcpy((*cache)[tid], data, size);
-    }
-    return (*cache)[tid];
+//Copies the master's value of a threadprivate variable into the calling
+// thread's copy. Like the copyin code compilers generate, the caller has to
+// follow the copies with a barrier before the master may change the variable.
+void __kmpc_copyin( ident_t *loc, kmp_int32 gtid, void *data, size_t size, void ***cache){
+    start_backend();
+    threadprivate_copyin(data, size, cache, gtid);
 }
 
 //Only one of the threads (called the single thread) should have the didit variable set to 1
@@ -329,12 +421,13 @@ __kmpc_reduce( ident_t *loc, kmp_int32 gtid, kmp_int32 num_vars, size_t size,
     int is_master = __kmpc_single(loc, gtid);
     auto *team = hpx_backend->get_team();
     int num_threads = team->num_threads;
+    int tid = hpx_backend->get_thread_num();
 
-    team->reduce_data[gtid] = data;
+    team->reduce_data[tid] = data;
     hpx_backend->barrier_wait();
     if(is_master) {
         for( int i = 0; i < num_threads; i++ ) {
-            if(i != gtid) {
+            if(i != tid) {
                 func(data, team->reduce_data[i]);
             }
         }
@@ -357,54 +450,184 @@ __kmpc_end_reduce( ident_t *loc, kmp_int32 gtid, kmp_critical_name *lck ) {
     }
 }
 
-void __kmpc_init_lock( ident_t *loc, kmp_int32 gtid,  void **lock ){
+//User locks live in the user's storage when they fit (see kmp_lock.h),
+// so the uncontended set/unset of the default lock is a single CAS and a store.
+// When profiling, every lock is wrapped in a kmp_profiled_lock instead; the
+// profile site is the source location, or the caller if there is none.
+//
+//caller is the return address of the API call, which is also what OMPT tools
+// get as codeptr_ra.
+static void init_lock( void **lock, uintptr_t hint, ident_t *loc, void *caller ) {
+    start_backend();
+    kmp_lock_kind kind = kmp_lock_kind_from_hint(hint, kmp_user_lock_default());
+    if( lock_profile_enabled ) {
+        *lock = ( new kmp_profiled_lock( kmp_new_indirect_lock(kind),
+                    lock_profile_get_site( "lock", loc ? loc->psource : nullptr, caller ) ) )->installed();
+    } else {
+        kmp_user_lock_init(lock, kind);
+    }
+    OMPT_CALLBACK(lock_init, (ompt_mutex_lock, (unsigned) hint, ompt_mutex_impl(kind),
+                              (ompt_wait_id_t) lock, caller));
+}
+
+//the in place lock doesn't apply here, nest locks are always allocated
+static void init_nest_lock( void **lock, uintptr_t hint, ident_t *loc, void *caller ) {
     start_backend();
-    *lock = new omp_lock_t;
+    kmp_lock_kind kind = kmp_lock_kind_from_hint(hint, kmp_user_lock_default());
+    kmp_indirect_lock *lck = kmp_new_indirect_lock(kind);
+    if( lock_profile_enabled ) {
+        lck = ( new kmp_profiled_lock( lck,
+                  lock_profile_get_site( "nest_lock", loc ? loc->psource : nullptr, caller ) ) )->installed();
+    }
+    *lock = new kmp_nest_lock(lck);
+    OMPT_CALLBACK(lock_init, (ompt_mutex_nest_lock, (unsigned) hint, ompt_mutex_impl(kind),
+                              (ompt_wait_id_t) lock, caller));
+}
+
+static unsigned user_lock_impl( void **lock ) {
+    if( kmp_lock_is_direct(lock) ) {
+        return ompt_mutex_impl(kmp_lock_tas);
+    }
+    return ompt_mutex_impl(kmp_lock_indirect(lock)->kind);
+}
+
+static void destroy_lock( void **lock, void *caller ) {
+    kmp_user_lock_destroy(lock);
+    OMPT_CALLBACK(lock_destroy, (ompt_mutex_lock, (ompt_wait_id_t) lock, caller));
+}
+
+static void set_lock( void **lock, void *caller ) {
+    OMPT_CALLBACK(mutex_acquire, (ompt_mutex_lock, omp_lock_hint_none, user_lock_impl(lock),
+                                  (ompt_wait_id_t) lock, caller));
+    kmp_user_lock_set(lock);
+    OMPT_CALLBACK(mutex_acquired, (ompt_mutex_lock, (ompt_wait_id_t) lock, caller));
+}
+
+static void unset_lock( void **lock, void *caller ) {
+    kmp_user_lock_unset(lock);
+    OMPT_CALLBACK(mutex_released, (ompt_mutex_lock, (ompt_wait_id_t) lock, caller));
+}
+
+static int test_lock( void **lock, void *caller ) {
+    OMPT_CALLBACK(mutex_acquire, (ompt_mutex_test_lock, omp_lock_hint_none, user_lock_impl(lock),
+                                  (ompt_wait_id_t) lock, caller));
+    if( !kmp_user_lock_test(lock) ) {
+        return 0;
+    }
+    OMPT_CALLBACK(mutex_acquired, (ompt_mutex_test_lock, (ompt_wait_id_t) lock, caller));
+    return 1;
+}
+
+//Nest locks are owned by the task that set them, and count how often it did.
+// OMPT sees the first set as an acquisition and the others as nesting.
+static void destroy_nest_lock( void **lock, void *caller ) {
+    delete (kmp_nest_lock*) *lock;
+    *lock = nullptr;
+    OMPT_CALLBACK(lock_destroy, (ompt_mutex_nest_lock, (ompt_wait_id_t) lock, caller));
+}
+
+static void set_nest_lock( void **lock, void *caller ) {
+    kmp_nest_lock *lck = (kmp_nest_lock*) *lock;
+    omp_task_data *task = hpx_backend->get_task_data();
+    if( OMPT_ENABLED(mutex_acquire) && !lck->owned_by(task) ) {
+        ompt_callbacks.mutex_acquire( ompt_mutex_nest_lock, omp_lock_hint_none,
+                                      ompt_mutex_impl(lck->kind()), (ompt_wait_id_t) lock, caller );
+    }
+    if( lck->set(task) == 1 ) {
+        OMPT_CALLBACK(mutex_acquired, (ompt_mutex_nest_lock, (ompt_wait_id_t) lock, caller));
+    } else {
+        OMPT_CALLBACK(nest_lock, (ompt_scope_begin, (ompt_wait_id_t) lock, caller));
+    }
+}
+
+static void unset_nest_lock( void **lock, void *caller ) {
+    if( ((kmp_nest_lock*) *lock)->unset() == 0 ) {
+        OMPT_CALLBACK(mutex_released, (ompt_mutex_nest_lock, (ompt_wait_id_t) lock, caller));
+    } else {
+        OMPT_CALLBACK(nest_lock, (ompt_scope_end, (ompt_wait_id_t) lock, caller));
+    }
+}
+
+static int test_nest_lock( void **lock, void *caller ) {
+    kmp_nest_lock *lck = (kmp_nest_lock*) *lock;
+    omp_task_data *task = hpx_backend->get_task_data();
+    if( OMPT_ENABLED(mutex_acquire) && !lck->owned_by(task) ) {
+        ompt_callbacks.mutex_acquire( ompt_mutex_test_nest_lock, omp_lock_hint_none,
+                                      ompt_mutex_impl(lck->kind()), (ompt_wait_id_t) lock, caller );
+    }
+    int count = lck->test(task);
+    if( count == 1 ) {
+        OMPT_CALLBACK(mutex_acquired, (ompt_mutex_test_nest_lock, (ompt_wait_id_t) lock, caller));
+    } else if( count > 1 ) {
+        OMPT_CALLBACK(nest_lock, (ompt_scope_begin, (ompt_wait_id_t) lock, caller));
+    }
+    return count;
+}
+
+void __kmpc_init_lock( ident_t *loc, kmp_int32 gtid,  void **lock ){
+    init_lock(lock, omp_lock_hint_none, loc, __builtin_return_address(0));
+}
+
+void __kmpc_init_lock_with_hint( ident_t *loc, kmp_int32 gtid, void **lock, uintptr_t hint ){
+    init_lock(lock, hint, loc, __builtin_return_address(0));
 }
 
 void __kmpc_destroy_lock( ident_t *loc, kmp_int32 gtid, void **lock ){
-    delete ((omp_lock_t*) *lock);
+    destroy_lock(lock, __builtin_return_address(0));
 }
 
 void __kmpc_set_lock( ident_t *loc, kmp_int32 gtid, void **lock ){
-    ((omp_lock_t*) *lock)->lock();
+    set_lock(lock, __builtin_return_address(0));
 }
 
 void __kmpc_unset_lock( ident_t *loc, kmp_int32 gtid, void **lock ){
-    ((omp_lock_t*) *lock)->unlock();
+    unset_lock(lock, __builtin_return_address(0));
 }
 
 int __kmpc_test_lock( ident_t *loc, kmp_int32 gtid, void **lock ){
-    return ((omp_lock_t*) *lock)->try_lock();
+    return test_lock(lock, __builtin_return_address(0));
 }
 
 
 void __kmpc_init_nest_lock( ident_t *loc, kmp_int32 gtid, void **lock ){
-    __kmpc_init_lock(loc, gtid, lock);
+    init_nest_lock(lock, omp_lock_hint_none, loc, __builtin_return_address(0));
+}
+
+void __kmpc_init_nest_lock_with_hint( ident_t *loc, kmp_int32 gtid, void **lock, uintptr_t hint ){
+    init_nest_lock(lock, hint, loc, __builtin_return_address(0));
 }
 
 void __kmpc_destroy_nest_lock( ident_t *loc, kmp_int32 gtid, void **lock ){
-    __kmpc_destroy_lock(loc, gtid, lock);
+    destroy_nest_lock(lock, __builtin_return_address(0));
 }
 
 void __kmpc_set_nest_lock( ident_t *loc, kmp_int32 gtid, void **lock ){
-    __kmpc_set_lock(loc, gtid, lock);
+    set_nest_lock(lock, __builtin_return_address(0));
 }
 
 void __kmpc_unset_nest_lock( ident_t *loc, kmp_int32 gtid, void **lock ){
-    __kmpc_unset_lock(loc, gtid, lock);
+    unset_nest_lock(lock, __builtin_return_address(0));
 }
 
 int __kmpc_test_nest_lock( ident_t *loc, kmp_int32 gtid, void **lock ){
-    return __kmpc_test_lock(loc, gtid, lock);
+    return test_nest_lock(lock, __builtin_return_address(0));
 }
 
+//Compilers call the outlined region directly between these two when the
+// if clause is false. The team record has to outlive this call, so it's
+// freed by __kmpc_end_serialized_parallel.
 void __kmpc_serialized_parallel( ident_t *, kmp_int32 global_tid ){
-    //Not sure if this needs to do anything. It is not used in clang, 
-    //only in icc generated code
+    start_backend();
+    omp_task_data *parent = hpx_backend->get_task_data();
+    parent->set_threads_requested(parent->icv.nthreads);
+    parent->proc_bind_requested = proc_bind_default;
+    hpx_backend->begin_serialized(new serialized_region(parent, __builtin_return_address(0)));
 }
 
 void __kmpc_end_serialized_parallel ( ident_t *, kmp_int32 global_tid ) {
+    auto *region = static_cast<serialized_region*>(hpx_backend->get_task_data()->team);
+    hpx_backend->end_serialized(region);
+    delete region;
 }
 
 
@@ -413,7 +636,7 @@ int omp_get_thread_num(){
     if(hpx_backend)
         return hpx_backend->get_thread_num();
     else
-        return 1;
+        return 0;
 }
 
 //"returns the number of threads in the current team"
@@ -457,6 +680,48 @@ int omp_in_parallel(){
     return (active_levels > 0);
 }
 
+int omp_get_thread_limit(){
+    start_backend();
+    return hpx_backend->get_thread_limit();
+}
+
+int omp_get_max_task_priority(){
+    start_backend();
+    return hpx_backend->get_max_task_priority();
+}
+
+void omp_set_max_active_levels(int max_levels){
+    start_backend();
+    hpx_backend->set_max_active_levels(max_levels);
+}
+
+int omp_get_max_active_levels(){
+    start_backend();
+    return hpx_backend->get_max_active_levels();
+}
+
+int omp_get_level(){
+    start_backend();
+    return hpx_backend->get_task_data()->icv.levels;
+}
+
+int omp_get_active_level(){
+    start_backend();
+    return hpx_backend->get_task_data()->icv.active_levels;
+}
+
+//Dependent tasks between these two are recorded as a graph the first time,
+// and replayed when the region with the same id runs again; see taskgraph.h.
+void kmp_taskgraph_begin(int id){
+    start_backend();
+    hpx_backend->taskgraph_begin(id);
+}
+
+void kmp_taskgraph_end(int id){
+    start_backend();
+    hpx_backend->taskgraph_end(id);
+}
+
 
 void omp_set_dynamic(int dynamic_threads){
     start_backend();
@@ -468,47 +733,178 @@ int omp_get_dynamic(){
     return hpx_backend->get_task_data()->icv.dyn;
 }
 
-void omp_init_lock(omp_lock_t **lock){
+omp_proc_bind_t omp_get_proc_bind(){
     start_backend();
-    *lock = new omp_lock_t;
+    if( !affinity_enabled() ) {
+        return omp_proc_bind_false;
+    }
+    return (omp_proc_bind_t) affinity_bind_var( hpx_backend->get_task_data()->icv.levels );
 }
 
-void omp_init_nest_lock(omp_lock_t **lock){
+int omp_get_num_places(){
     start_backend();
-    *lock = new omp_lock_t;
+    return (int) omp_places.size();
 }
 
-void omp_destroy_lock(omp_lock_t **lock) {
-    delete *lock;
+int omp_get_place_num_procs(int place_num){
+    start_backend();
+    if( place_num < 0 || place_num >= (int) omp_places.size() ) {
+        return 0;
+    }
+    return (int) omp_places[place_num].procs.size();
 }
-void omp_destroy_nest_lock(omp_lock_t **lock) {
-    delete *lock;
+
+void omp_get_place_proc_ids(int place_num, int *ids){
+    start_backend();
+    if( place_num < 0 || place_num >= (int) omp_places.size() ) {
+        return;
+    }
+    std::copy( omp_places[place_num].procs.begin(), omp_places[place_num].procs.end(), ids );
 }
 
-int omp_test_lock(omp_lock_t **lock) {
-    if((*lock)->try_lock())
-        return 1;
-    return 0;
+//The place of the implicit task, or of the worker running the calling task
+int omp_get_place_num(){
+    start_backend();
+    int place = hpx_backend->get_task_data()->place;
+    if( place < 0 && hpx::threads::get_self_ptr() ) {
+        place = affinity_worker_place( hpx::get_worker_thread_num() );
+    }
+    return place;
 }
-int omp_test_nest_lock(omp_lock_t **lock) {
-    if((*lock)->try_lock())
-        return 1;
-    return 0;
+
+int omp_get_partition_num_places(){
+    start_backend();
+    omp_icv &icv = hpx_backend->get_task_data()->icv;
+    return icv.place_partition_last - icv.place_partition_first + 1;
+}
+
+void omp_get_partition_place_nums(int *place_nums){
+    start_backend();
+    omp_icv &icv = hpx_backend->get_task_data()->icv;
+    for( int place = icv.place_partition_first; place <= icv.place_partition_last; place++ ) {
+        *place_nums++ = place;
+    }
+}
+
+omp_allocator_handle_t omp_init_allocator(omp_memspace_handle_t memspace, int ntraits,
+                                          const omp_alloctrait_t traits[]){
+    start_backend();
+    return allocator_create(memspace, ntraits, traits);
 }
 
-void omp_set_lock(omp_lock_t **lock) {
-    (*lock)->lock();
+void omp_destroy_allocator(omp_allocator_handle_t allocator){
+    allocator_destroy(allocator);
 }
-void omp_set_nest_lock(omp_lock_t **lock) {
-    (*lock)->lock();
+
+void omp_set_default_allocator(omp_allocator_handle_t allocator){
+    start_backend();
+    hpx_backend->get_task_data()->icv.def_allocator = allocator;
+}
+
+omp_allocator_handle_t omp_get_default_allocator(){
+    start_backend();
+    return (omp_allocator_handle_t) hpx_backend->get_task_data()->icv.def_allocator;
+}
+
+void* omp_aligned_alloc(size_t alignment, size_t size, omp_allocator_handle_t allocator){
+    start_backend();
+    if(allocator == omp_null_allocator) {
+        allocator = omp_get_default_allocator();
+    }
+    return allocator_alloc(size, alignment, allocator);
+}
+
+void* omp_alloc(size_t size, omp_allocator_handle_t allocator){
+    return omp_aligned_alloc(1, size, allocator);
+}
+
+void* omp_calloc(size_t nmemb, size_t size, omp_allocator_handle_t allocator){
+    if(size != 0 && nmemb > SIZE_MAX / size) {
+        return nullptr;
+    }
+    void *ptr = omp_aligned_alloc(1, nmemb * size, allocator);
+    if(ptr) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+//Blocks know their allocator
+void omp_free(void *ptr, omp_allocator_handle_t allocator){
+    allocator_free(ptr);
+}
+
+omp_allocator_handle_t __kmpc_init_allocator( int gtid, omp_memspace_handle_t memspace,
+                                              int ntraits, const omp_alloctrait_t traits[] ) {
+    return omp_init_allocator(memspace, ntraits, traits);
+}
+
+void __kmpc_destroy_allocator( int gtid, omp_allocator_handle_t allocator ) {
+    omp_destroy_allocator(allocator);
+}
+
+void __kmpc_set_default_allocator( int gtid, omp_allocator_handle_t allocator ) {
+    omp_set_default_allocator(allocator);
 }
 
-void omp_unset_lock(omp_lock_t **lock) {
-    (*lock)->unlock();
+omp_allocator_handle_t __kmpc_get_default_allocator( int gtid ) {
+    return omp_get_default_allocator();
 }
 
-void omp_unset_nest_lock(omp_lock_t **lock) {
-    (*lock)->unlock();
+void* __kmpc_alloc( int gtid, size_t size, omp_allocator_handle_t allocator ) {
+    return omp_aligned_alloc(1, size, allocator);
 }
 
+void* __kmpc_aligned_alloc( int gtid, size_t alignment, size_t size,
+                            omp_allocator_handle_t allocator ) {
+    return omp_aligned_alloc(alignment, size, allocator);
+}
+
+void __kmpc_free( int gtid, void *ptr, omp_allocator_handle_t allocator ) {
+    allocator_free(ptr);
+}
+
+void omp_init_lock(omp_lock_t *lock){
+    init_lock(lock, omp_lock_hint_none, nullptr, __builtin_return_address(0));
+}
+
+void omp_init_nest_lock(omp_nest_lock_t *lock){
+    init_nest_lock(lock, omp_lock_hint_none, nullptr, __builtin_return_address(0));
+}
+
+void omp_init_lock_with_hint(omp_lock_t *lock, omp_lock_hint_t hint){
+    init_lock(lock, hint, nullptr, __builtin_return_address(0));
+}
 
+void omp_init_nest_lock_with_hint(omp_nest_lock_t *lock, omp_lock_hint_t hint){
+    init_nest_lock(lock, hint, nullptr, __builtin_return_address(0));
+}
+
+void omp_destroy_lock(omp_lock_t *lock) {
+    destroy_lock(lock, __builtin_return_address(0));
+}
+void omp_destroy_nest_lock(omp_nest_lock_t *lock) {
+    destroy_nest_lock(lock, __builtin_return_address(0));
+}
+
+int omp_test_lock(omp_lock_t *lock) {
+    return test_lock(lock, __builtin_return_address(0));
+}
+int omp_test_nest_lock(omp_nest_lock_t *lock) {
+    return test_nest_lock(lock, __builtin_return_address(0));
+}
+
+void omp_set_lock(omp_lock_t *lock) {
+    set_lock(lock, __builtin_return_address(0));
+}
+void omp_set_nest_lock(omp_nest_lock_t *lock) {
+    set_nest_lock(lock, __builtin_return_address(0));
+}
+
+void omp_unset_lock(omp_lock_t *lock) {
+    unset_lock(lock, __builtin_return_address(0));
+}
+
+void omp_unset_nest_lock(omp_nest_lock_t *lock) {
+    unset_nest_lock(lock, __builtin_return_address(0));
+}
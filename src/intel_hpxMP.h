@@ -1,10 +1,16 @@
 #include "hpx_runtime.h"
+#include "allocators.h"
+#include "kmp_lock.h"
+#include "lock_profile.h"
+#include "threadprivate.h"
 #include <cstdarg>
 
 typedef int kmp_int32;
 typedef long long kmp_int64;
 
-typedef mutex_type omp_lock_t;
+//The user's lock storage is one pointer wide, see kmp_lock.h
+typedef void *omp_lock_t;
+typedef void *omp_nest_lock_t;
 
 typedef void (*microtask_t)( int *gtid, int *tid, ... );
 
@@ -13,6 +19,24 @@ typedef int  (*launch_t)( int gtid );
 typedef void (*kmpc_micro)  ( kmp_int32 * global_tid, kmp_int32 * bound_tid, ... );
 
 typedef kmp_int32 kmp_critical_name[8];
+
+//OpenMP 4.5 lock hints, can be or'ed together
+typedef enum omp_lock_hint_t {
+    omp_lock_hint_none           = 0,
+    omp_lock_hint_uncontended    = 1,
+    omp_lock_hint_contended      = (1<<1),
+    omp_lock_hint_nonspeculative = (1<<2),
+    omp_lock_hint_speculative    = (1<<3)
+} omp_lock_hint_t;
+
+//OpenMP 4.0 thread affinity policies, see affinity.h
+typedef enum omp_proc_bind_t {
+    omp_proc_bind_false  = 0,
+    omp_proc_bind_true   = 1,
+    omp_proc_bind_master = 2,
+    omp_proc_bind_close  = 3,
+    omp_proc_bind_spread = 4
+} omp_proc_bind_t;
 /*
 typedef struct kmp_depend_info {
     int64_t                    base_addr;
@@ -99,12 +123,10 @@ typedef struct kmp_tasking_flags {          /* Total struct must be exactly 32 b
     unsigned tiedness    : 1;               /* task is either tied (1) or untied (0) */
     unsigned final       : 1;               /* task is final(1) so execute immediately */
     unsigned merged_if0  : 1;               /* no __kmpc_task_{begin/complete}_if0 calls in if0 code path */
-#if OMP_40_ENABLED
     unsigned destructors_thunk : 1;         /* set if the compiler creates a thunk to invoke destructors from the runtime */
-    unsigned reserved    : 12;              /* reserved for compiler use */
-#else // OMP_40_ENABLED
-    unsigned reserved    : 13;              /* reserved for compiler use */
-#endif // OMP_40_ENABLED
+    unsigned proxy       : 1;               /* task is a proxy task (it will be executed outside the context of the RTL) */
+    unsigned priority_specified : 1;        /* set if the compiler provides priority setting for the task */
+    unsigned reserved    : 10;              /* reserved for compiler use */
     /* Library flags */                     /* Total library flags must be 16 bits */
     unsigned tasktype    : 1;               /* task is either explicit(1) or implicit (0) */
     unsigned task_serial : 1;               /* this task is executed immediately (1) or deferred (0) */
@@ -153,6 +175,12 @@ extern "C" void
 __kmpc_omp_wait_deps( ident_t *loc_ref, kmp_int32 gtid, kmp_int32 ndeps, 
                       kmp_depend_info_t *dep_list, kmp_int32 ndeps_noalias, 
                       kmp_depend_info_t *noalias_dep_list );
+extern "C" kmp_int32
+__kmpc_start_record_task( ident_t *loc_ref, kmp_int32 gtid, kmp_int32 input_flags,
+                          kmp_int32 tdg_id );
+extern "C" void
+__kmpc_end_record_task( ident_t *loc_ref, kmp_int32 gtid, kmp_int32 input_flags,
+                        kmp_int32 tdg_id );
 extern "C" int 
 __kmpc_omp_task_parts( ident_t *loc_ref, int gtid, kmp_task_t * new_task);
 extern "C" void 
@@ -173,6 +201,7 @@ extern "C" void __kmpc_end(ident_t *loc);//used in icc
 extern "C" void __kmpc_fork_call          ( ident_t *, kmp_int32 nargs, kmpc_micro microtask, ... );
 extern "C" int  __kmpc_global_thread_num(ident_t *loc);
 extern "C" void __kmpc_push_num_threads ( ident_t *loc, kmp_int32 global_tid, kmp_int32 num_threads );
+extern "C" void __kmpc_push_proc_bind( ident_t *loc, kmp_int32 global_tid, int proc_bind );
 extern "C" int  __kmpc_cancel_barrier(ident_t* loc_ref, kmp_int32 gtid);
 
 extern "C" void __kmpc_barrier(ident_t *loc, kmp_int32 global_tid);
@@ -186,6 +215,8 @@ extern "C" void __kmpc_end_master(ident_t *loc, int global_tid);
 
 extern "C" void __kmpc_critical( ident_t * loc, kmp_int32 global_tid, kmp_critical_name * crit );
 extern "C" void __kmpc_end_critical(ident_t *loc, kmp_int32 global_tid, kmp_critical_name *crit);
+extern "C" void __kmpc_critical_with_hint( ident_t * loc, kmp_int32 global_tid,
+                                           kmp_critical_name * crit, uintptr_t hint );
 
 extern "C" void __kmpc_flush(ident_t *loc, ...);
 
@@ -193,6 +224,9 @@ extern "C" void __kmpc_flush(ident_t *loc, ...);
 extern "C" void* 
 __kmpc_threadprivate_cached( ident_t *loc, kmp_int32 tid, void *data, size_t size, void ***cache);
 
+extern "C" void
+__kmpc_copyin( ident_t *loc, kmp_int32 gtid, void *data, size_t size, void ***cache);
+
 extern "C" void*
 __kmpc_future_cached( ident_t * loc, kmp_int32 global_tid, void * data, size_t size, void *** cache );
 
@@ -227,6 +261,10 @@ extern "C" void __kmpc_unset_lock( ident_t *loc, kmp_int32 gtid, void **user_loc
 extern "C" void __kmpc_unset_nest_lock( ident_t *loc, kmp_int32 gtid, void **user_lock );
 extern "C" int __kmpc_test_lock( ident_t *loc, kmp_int32 gtid, void **user_lock );
 extern "C" int __kmpc_test_nest_lock( ident_t *loc, kmp_int32 gtid, void **user_lock );
+extern "C" void __kmpc_init_lock_with_hint( ident_t *loc, kmp_int32 gtid, void **user_lock,
+                                            uintptr_t hint );
+extern "C" void __kmpc_init_nest_lock_with_hint( ident_t *loc, kmp_int32 gtid, void **user_lock,
+                                                 uintptr_t hint );
 
 extern "C" void __kmpc_serialized_parallel( ident_t *, kmp_int32 global_tid );
 extern "C" void __kmpc_end_serialized_parallel ( ident_t *, kmp_int32 global_tid );
@@ -243,24 +281,62 @@ extern "C" int  omp_get_num_procs();
 extern "C" double omp_get_wtime();
 extern "C" double omp_get_wtick();
 extern "C" int omp_in_parallel();
+extern "C" int omp_get_thread_limit();
+extern "C" int omp_get_max_task_priority();
+extern "C" void omp_set_max_active_levels(int max_levels);
+extern "C" int omp_get_max_active_levels();
+extern "C" int omp_get_level();
+extern "C" int omp_get_active_level();
+extern "C" void kmp_taskgraph_begin(int id);
+extern "C" void kmp_taskgraph_end(int id);
 
 //ICV get and put functions:
 extern "C" void omp_set_dynamic(int dynamic_threads);
 extern "C" int omp_get_dynamic();
 
-
-extern "C" void omp_init_lock(omp_lock_t **lock);
-extern "C" void omp_init_nest_lock(omp_lock_t **lock);
-
-extern "C" void omp_destroy_lock(omp_lock_t **lock);
-extern "C" void omp_destroy_nest_lock(omp_lock_t **lock);
-
-extern "C" void omp_set_lock(omp_lock_t **lock);
-extern "C" void omp_set_nest_lock(omp_lock_t **lock);
-
-extern "C" void omp_unset_lock(omp_lock_t **lock);
-extern "C" void omp_unset_nest_lock(omp_lock_t **lock);
-
-extern "C" int omp_test_lock(omp_lock_t **lock);
-extern "C" int omp_test_nest_lock(omp_lock_t **lock);
+extern "C" omp_proc_bind_t omp_get_proc_bind();
+extern "C" int omp_get_num_places();
+extern "C" int omp_get_place_num_procs(int place_num);
+extern "C" void omp_get_place_proc_ids(int place_num, int *ids);
+extern "C" int omp_get_place_num();
+extern "C" int omp_get_partition_num_places();
+extern "C" void omp_get_partition_place_nums(int *place_nums);
+
+extern "C" omp_allocator_handle_t omp_init_allocator(omp_memspace_handle_t memspace, int ntraits,
+                                                     const omp_alloctrait_t traits[]);
+extern "C" void omp_destroy_allocator(omp_allocator_handle_t allocator);
+extern "C" void omp_set_default_allocator(omp_allocator_handle_t allocator);
+extern "C" omp_allocator_handle_t omp_get_default_allocator();
+extern "C" void* omp_alloc(size_t size, omp_allocator_handle_t allocator);
+extern "C" void* omp_aligned_alloc(size_t alignment, size_t size, omp_allocator_handle_t allocator);
+extern "C" void* omp_calloc(size_t nmemb, size_t size, omp_allocator_handle_t allocator);
+extern "C" void omp_free(void *ptr, omp_allocator_handle_t allocator);
+
+extern "C" omp_allocator_handle_t __kmpc_init_allocator( int gtid, omp_memspace_handle_t memspace,
+                                                         int ntraits, const omp_alloctrait_t traits[] );
+extern "C" void __kmpc_destroy_allocator( int gtid, omp_allocator_handle_t allocator );
+extern "C" void __kmpc_set_default_allocator( int gtid, omp_allocator_handle_t allocator );
+extern "C" omp_allocator_handle_t __kmpc_get_default_allocator( int gtid );
+extern "C" void* __kmpc_alloc( int gtid, size_t size, omp_allocator_handle_t allocator );
+extern "C" void* __kmpc_aligned_alloc( int gtid, size_t alignment, size_t size,
+                                       omp_allocator_handle_t allocator );
+extern "C" void __kmpc_free( int gtid, void *ptr, omp_allocator_handle_t allocator );
+
+
+extern "C" void omp_init_lock(omp_lock_t *lock);
+extern "C" void omp_init_nest_lock(omp_nest_lock_t *lock);
+extern "C" void omp_init_lock_with_hint(omp_lock_t *lock, omp_lock_hint_t hint);
+extern "C" void omp_init_nest_lock_with_hint(omp_nest_lock_t *lock, omp_lock_hint_t hint);
+
+extern "C" void omp_destroy_lock(omp_lock_t *lock);
+extern "C" void omp_destroy_nest_lock(omp_nest_lock_t *lock);
+
+extern "C" void omp_set_lock(omp_lock_t *lock);
+extern "C" void omp_set_nest_lock(omp_nest_lock_t *lock);
+
+extern "C" void omp_unset_lock(omp_lock_t *lock);
+extern "C" void omp_unset_nest_lock(omp_nest_lock_t *lock);
+
+extern "C" int omp_test_lock(omp_lock_t *lock);
+extern "C" int omp_test_nest_lock(omp_nest_lock_t *lock);
 
@@ -34,6 +34,11 @@
 
 #include "kmp_atomic.h"
 //#include "kmp.h"                  // TRUE, asm routines prototypes
+#if KMP_ARCH_X86_64
+#include <cpuid.h>
+#endif
+#include <atomic>
+#include <cstdlib>
 
 typedef unsigned char uchar;
 typedef unsigned short ushort;
@@ -557,6 +562,29 @@ int __kmp_atomic_mode = 1;      // Intel perf
 int __kmp_atomic_mode = 2;      // GOMP compatibility
 #endif /* KMP_GOMP_COMPAT */
 
+#if KMP_ARCH_X86_64
+// cpuid leaf 1, ecx bit 13: cmpxchg16b is available.
+// Checked once, when the library is loaded.
+static int
+__kmp_detect_cx16()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if ( ! __get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) {
+        return 0;
+    }
+    return ( ecx & bit_CMPXCHG16B ) != 0;
+}
+int __kmp_atomic_cx16 = __kmp_detect_cx16();
+#else
+int __kmp_atomic_cx16 = 0;
+#endif
+
+// Software combining of contended updates (see __kmp_combine_update).
+// It reassociates floating point sums and products, so it is off unless
+// HPXMP_ATOMIC_COMBINE=1. -1 until the variable is read, on the first
+// contended update, so a program can still set it before then.
+int __kmp_atomic_combine = -1;
+
 //KMP_ALIGN(128)
 __attribute__((aligned(128)))
 
@@ -693,6 +721,183 @@ RET_TYPE __kmpc_atomic_##TYPE_ID##_##OP_ID( ident_t *id_ref, int gtid, TYPE * lh
         }                                                                 \
     }
 
+// ------------------------------------------------------------------------
+// Software combining for contended updates
+// When many threads update one location, most attempts of the OP_CMPXCHG
+// loop fail. After KMP_COMBINE_THRESHOLD failures a commutative update is
+// posted to a combining cell chosen by the address instead. The thread that
+// takes the cell's lock merges every operand posted for that location and
+// applies the result with one compare and store, then releases the posters.
+// While batches merge more than one update the location is marked hot, and
+// updates of a hot location are posted after their first failure.
+#define KMP_COMBINE_THRESHOLD 8     // failed attempts before posting an update
+#define KMP_COMBINE_CELLS     32    // combining cells, selected by address
+#define KMP_COMBINE_SLOTS     64    // posted updates per cell
+
+#define KMP_COMBINE_CELL(p)                                               \
+    ( & __kmp_combine_cells[ ( (kmp_uintptr_t)(p) >> 3 ) % KMP_COMBINE_CELLS ] )
+
+enum kmp_combine_state {
+    kmp_combine_free,           // slot unused
+    kmp_combine_busy,           // slot claimed, request being filled in
+    kmp_combine_posted,         // waiting for a combiner
+    kmp_combine_done            // applied, poster may return
+};
+
+struct kmp_combine_slot {
+    std::atomic<int> state;
+    void *addr;
+    const void *tag;            // routine that posted it, i.e. TYPE and OP
+    kmp_int64 operand;
+};
+
+struct __attribute__((aligned(64))) kmp_combine_cell {
+    std::atomic<int> lock;
+    std::atomic<void *> hot;    // location whose updates are combined early
+    kmp_combine_slot slots[ KMP_COMBINE_SLOTS ];
+};
+
+static kmp_combine_cell __kmp_combine_cells[ KMP_COMBINE_CELLS ];
+
+// update() applies the merged operand, combine() merges two operands:
+// x - a - b is computed as x - ( a + b )
+struct kmp_combine_add {
+    template< typename TYPE > static TYPE update( TYPE x, TYPE y ) { return x + y; }
+    template< typename TYPE > static TYPE combine( TYPE a, TYPE b ) { return a + b; }
+};
+struct kmp_combine_sub {
+    template< typename TYPE > static TYPE update( TYPE x, TYPE y ) { return x - y; }
+    template< typename TYPE > static TYPE combine( TYPE a, TYPE b ) { return a + b; }
+};
+struct kmp_combine_mul {
+    template< typename TYPE > static TYPE update( TYPE x, TYPE y ) { return x * y; }
+    template< typename TYPE > static TYPE combine( TYPE a, TYPE b ) { return a * b; }
+};
+
+template< int BITS > struct kmp_combine_int;
+template<> struct kmp_combine_int<8>  { typedef kmp_uint8  type; };
+template<> struct kmp_combine_int<16> { typedef kmp_uint16 type; };
+template<> struct kmp_combine_int<32> { typedef kmp_uint32 type; };
+template<> struct kmp_combine_int<64> { typedef kmp_uint64 type; };
+
+static int
+__kmp_combine_env()
+{
+    int combine = __atomic_load_n( &__kmp_atomic_combine, __ATOMIC_RELAXED );
+    if ( combine < 0 ) {
+        const char *env = getenv( "HPXMP_ATOMIC_COMBINE" );
+        combine = env != NULL && atoi( env ) != 0;
+        __atomic_store_n( &__kmp_atomic_combine, combine, __ATOMIC_RELAXED );
+    }
+    return combine;
+}
+
+static inline bool
+__kmp_combine_wanted( void *lhs, int failures )
+{
+    return __kmp_combine_env() &&
+        ( failures >= KMP_COMBINE_THRESHOLD ||
+          KMP_COMBINE_CELL( lhs )->hot.load( std::memory_order_relaxed ) == lhs );
+}
+
+// Same loop as OP_CMPXCHG, with the operation given by OP
+template< typename TYPE, int BITS, typename OP >
+static inline void
+__kmp_combine_apply( TYPE *lhs, TYPE rhs )
+{
+    typedef typename kmp_combine_int<BITS>::type int_type;
+    TYPE old_value, new_value;
+    old_value = *(TYPE volatile *)lhs;
+    new_value = OP::update( old_value, rhs );
+    while ( ! __sync_bool_compare_and_swap( (volatile int_type *) lhs,
+                  *(int_type *) &old_value, *(int_type *) &new_value ) )
+    {
+        KMP_DO_PAUSE;
+
+        old_value = *(TYPE volatile *)lhs;
+        new_value = OP::update( old_value, rhs );
+    }
+}
+
+template< typename TYPE, int BITS, typename OP >
+static void
+__kmp_combine_update( TYPE *lhs, TYPE rhs, int gtid )
+{
+    const void *tag = (const void *) &__kmp_combine_update< TYPE, BITS, OP >;
+    kmp_combine_cell *cell = KMP_COMBINE_CELL( lhs );
+    kmp_combine_slot *slot = &cell->slots[ (unsigned) gtid % KMP_COMBINE_SLOTS ];
+    int expected = kmp_combine_free;
+
+    if ( ! slot->state.compare_exchange_strong( expected, kmp_combine_busy,
+                                                std::memory_order_acquire ) ) {
+        // another thread maps to the same slot, do without combining
+        __kmp_combine_apply< TYPE, BITS, OP >( lhs, rhs );
+        return;
+    }
+    slot->addr = lhs;
+    slot->tag = tag;
+    *(TYPE *) &slot->operand = rhs;
+    slot->state.store( kmp_combine_posted, std::memory_order_release );
+
+    while ( slot->state.load( std::memory_order_acquire ) != kmp_combine_done ) {
+        if ( cell->lock.load( std::memory_order_relaxed ) != 0 ||
+             cell->lock.exchange( 1, std::memory_order_acquire ) != 0 ) {
+            KMP_DO_PAUSE;
+            continue;
+        }
+        // we are the combiner: merge everything posted for this location
+        int served[ KMP_COMBINE_SLOTS ];
+        int count = 0;
+        TYPE operand = rhs;
+        for ( int i = 0; i < KMP_COMBINE_SLOTS; ++i ) {
+            kmp_combine_slot *other = &cell->slots[ i ];
+            if ( other->state.load( std::memory_order_acquire ) == kmp_combine_posted &&
+                 other->addr == lhs && other->tag == tag ) {
+                TYPE value = *(TYPE *) &other->operand;
+                operand = count ? OP::combine( operand, value ) : value;
+                served[ count++ ] = i;
+            }
+        }
+        if ( count > 0 ) {
+            __kmp_combine_apply< TYPE, BITS, OP >( lhs, operand );
+        }
+        for ( int i = 0; i < count; ++i ) {
+            cell->slots[ served[ i ] ].state.store( kmp_combine_done, std::memory_order_release );
+        }
+        if ( count > 1 ) {
+            cell->hot.store( lhs, std::memory_order_relaxed );
+        } else if ( cell->hot.load( std::memory_order_relaxed ) == lhs ) {
+            cell->hot.store( NULL, std::memory_order_relaxed );
+        }
+        cell->lock.store( 0, std::memory_order_release );
+    }
+    slot->state.store( kmp_combine_free, std::memory_order_release );
+}
+
+// OP_CMPXCHG for commutative operations: hand the update to a combiner
+// once the location turns out to be contended
+//     COMB    - kmp_combine_* type matching OP
+#define OP_CMPXCHG_COMB(TYPE,BITS,OP,COMB)                                \
+    {                                                                     \
+        TYPE old_value, new_value;                                        \
+        int failures = 0;                                                 \
+        old_value = *(TYPE volatile *)lhs;                                \
+        new_value = old_value OP rhs;                                     \
+        while ( ! KMP_COMPARE_AND_STORE_ACQ##BITS( (kmp_int##BITS *) lhs, \
+                      *VOLATILE_CAST(kmp_int##BITS *) &old_value,         \
+                      *VOLATILE_CAST(kmp_int##BITS *) &new_value ) )      \
+        {                                                                 \
+            if ( __kmp_combine_wanted( lhs, ++failures ) ) {              \
+                __kmp_combine_update< TYPE, BITS, COMB >( lhs, rhs, gtid ); \
+                return;                                                   \
+            }                                                             \
+            KMP_DO_PAUSE;                                                 \
+                                                                          \
+            old_value = *(TYPE volatile *)lhs;                            \
+            new_value = old_value OP rhs;                                 \
+        }                                                                 \
+    }
+
 #if USE_CMPXCHG_FIX
 // 2007-06-25:
 // workaround for C78287 (complex(kind=4) data type)
@@ -726,6 +931,41 @@ RET_TYPE __kmpc_atomic_##TYPE_ID##_##OP_ID( ident_t *id_ref, int gtid, TYPE * lh
 // end of the first part of the workaround for C78287
 #endif // USE_CMPXCHG_FIX
 
+// ------------------------------------------------------------------------
+// 16-byte operands (double complex, _Quad) on Intel(R) 64
+// These are lock free with cmpxchg16b when the cpu has it and the operand
+// is 16-byte aligned, and use the per-type lock otherwise. The choice only
+// depends on the address, so every update of one location takes the same path.
+#if KMP_ARCH_X86_64
+# define KMP_ATOMIC_CX16_OK(p) ( __kmp_atomic_cx16 && ( ( (kmp_uintptr_t)(p) & 0xF ) == 0 ) )
+#else
+# define KMP_ATOMIC_CX16_OK(p) 0
+# define KMP_COMPARE_AND_STORE_RET128(p, cv, sv) 1 /* never reached */
+#endif
+
+// The two halves are read separately, so the first read may tear. The
+// compare and store then fails and returns the real contents in old_value.
+#define OP_CMPXCHG16_INIT(TYPE,PTR)                                       \
+        union {                                                           \
+            TYPE f_val;                                                   \
+            kmp_int64 i_val[2];                                           \
+        } old_value, new_value;                                           \
+        old_value.i_val[0] = ( (volatile kmp_int64 *) (PTR) )[0];         \
+        old_value.i_val[1] = ( (volatile kmp_int64 *) (PTR) )[1];
+
+// Operation on *lhs using cmpxchg16b
+//     TYPE    - operands' type
+//     EXPR    - new value, computed from old_value.f_val and rhs
+#define OP_CMPXCHG16(TYPE,EXPR)                                           \
+        OP_CMPXCHG16_INIT(TYPE,lhs)                                       \
+        new_value.f_val = EXPR;                                           \
+        while ( ! KMP_COMPARE_AND_STORE_RET128( lhs, old_value.i_val,     \
+                                                new_value.i_val ) )       \
+        {                                                                 \
+            KMP_DO_PAUSE;                                                 \
+            new_value.f_val = EXPR;                                       \
+        }
+
 
 // ------------------------------------------------------------------------
 // X86 or X86_64: no alignment problems ====================================
@@ -741,6 +981,13 @@ ATOMIC_BEGIN(TYPE_ID,OP_ID,TYPE,void)                                      \
     OP_GOMP_CRITICAL(OP##=,GOMP_FLAG)                                      \
     OP_CMPXCHG(TYPE,BITS,OP)                                               \
 }
+// -------------------------------------------------------------------------
+// Commutative operations, combined under contention (see OP_CMPXCHG_COMB)
+#define ATOMIC_CMPXCHG_COMB(TYPE_ID,OP_ID,TYPE,BITS,OP,COMB,LCK_ID,MASK,GOMP_FLAG) \
+ATOMIC_BEGIN(TYPE_ID,OP_ID,TYPE,void)                                      \
+    OP_GOMP_CRITICAL(OP##=,GOMP_FLAG)                                      \
+    OP_CMPXCHG_COMB(TYPE,BITS,OP,COMB)                                     \
+}
 #if USE_CMPXCHG_FIX
 // -------------------------------------------------------------------------
 // workaround for C78287 (complex(kind=4) data type)
@@ -756,15 +1003,15 @@ ATOMIC_BEGIN(TYPE_ID,OP_ID,TYPE,void)
 ATOMIC_FIXED_ADD( fixed4, add, kmp_int32,  32, +, 4i, 3, 0            )  // __kmpc_atomic_fixed4_add
 ATOMIC_FIXED_ADD( fixed4, sub, kmp_int32,  32, -, 4i, 3, 0            )  // __kmpc_atomic_fixed4_sub
 
-ATOMIC_CMPXCHG( float4,  add, kmp_real32, 32, +,  4r, 3, KMP_ARCH_X86 )  // __kmpc_atomic_float4_add
-ATOMIC_CMPXCHG( float4,  sub, kmp_real32, 32, -,  4r, 3, KMP_ARCH_X86 )  // __kmpc_atomic_float4_sub
+ATOMIC_CMPXCHG_COMB( float4,  add, kmp_real32, 32, +, kmp_combine_add,  4r, 3, KMP_ARCH_X86 )  // __kmpc_atomic_float4_add
+ATOMIC_CMPXCHG_COMB( float4,  sub, kmp_real32, 32, -, kmp_combine_sub,  4r, 3, KMP_ARCH_X86 )  // __kmpc_atomic_float4_sub
 
 // Routines for ATOMIC 8-byte operands addition and subtraction
 ATOMIC_FIXED_ADD( fixed8, add, kmp_int64,  64, +, 8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8_add
 ATOMIC_FIXED_ADD( fixed8, sub, kmp_int64,  64, -, 8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8_sub
 
-ATOMIC_CMPXCHG( float8,  add, kmp_real64, 64, +,  8r, 7, KMP_ARCH_X86 )  // __kmpc_atomic_float8_add
-ATOMIC_CMPXCHG( float8,  sub, kmp_real64, 64, -,  8r, 7, KMP_ARCH_X86 )  // __kmpc_atomic_float8_sub
+ATOMIC_CMPXCHG_COMB( float8,  add, kmp_real64, 64, +, kmp_combine_add,  8r, 7, KMP_ARCH_X86 )  // __kmpc_atomic_float8_add
+ATOMIC_CMPXCHG_COMB( float8,  sub, kmp_real64, 64, -, kmp_combine_sub,  8r, 7, KMP_ARCH_X86 )  // __kmpc_atomic_float8_sub
 
 // ------------------------------------------------------------------------
 // Entries definition for integer operands
@@ -781,32 +1028,32 @@ ATOMIC_CMPXCHG( float8,  sub, kmp_real64, 64, -,  8r, 7, KMP_ARCH_X86 )  // __km
 // Routines for ATOMIC integer operands, other operators
 // ------------------------------------------------------------------------
 //              TYPE_ID,OP_ID, TYPE,          OP, LCK_ID, GOMP_FLAG
-ATOMIC_CMPXCHG( fixed1,  add, kmp_int8,    8, +,  1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1_add
+ATOMIC_CMPXCHG_COMB( fixed1,  add, kmp_int8,    8, +, kmp_combine_add,  1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1_add
 ATOMIC_CMPXCHG( fixed1, andb, kmp_int8,    8, &,  1i, 0, 0            )  // __kmpc_atomic_fixed1_andb
 ATOMIC_CMPXCHG( fixed1,  div, kmp_int8,    8, /,  1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1_div
 ATOMIC_CMPXCHG( fixed1u, div, kmp_uint8,   8, /,  1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1u_div
-ATOMIC_CMPXCHG( fixed1,  mul, kmp_int8,    8, *,  1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1_mul
+ATOMIC_CMPXCHG_COMB( fixed1,  mul, kmp_int8,    8, *, kmp_combine_mul,  1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1_mul
 ATOMIC_CMPXCHG( fixed1,  orb, kmp_int8,    8, |,  1i, 0, 0            )  // __kmpc_atomic_fixed1_orb
 ATOMIC_CMPXCHG( fixed1,  shl, kmp_int8,    8, <<, 1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1_shl
 ATOMIC_CMPXCHG( fixed1,  shr, kmp_int8,    8, >>, 1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1_shr
 ATOMIC_CMPXCHG( fixed1u, shr, kmp_uint8,   8, >>, 1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1u_shr
-ATOMIC_CMPXCHG( fixed1,  sub, kmp_int8,    8, -,  1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1_sub
+ATOMIC_CMPXCHG_COMB( fixed1,  sub, kmp_int8,    8, -, kmp_combine_sub,  1i, 0, KMP_ARCH_X86 )  // __kmpc_atomic_fixed1_sub
 ATOMIC_CMPXCHG( fixed1,  xor, kmp_int8,    8, ^,  1i, 0, 0            )  // __kmpc_atomic_fixed1_xor
-ATOMIC_CMPXCHG( fixed2,  add, kmp_int16,  16, +,  2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2_add
+ATOMIC_CMPXCHG_COMB( fixed2,  add, kmp_int16,  16, +, kmp_combine_add,  2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2_add
 ATOMIC_CMPXCHG( fixed2, andb, kmp_int16,  16, &,  2i, 1, 0            )  // __kmpc_atomic_fixed2_andb
 ATOMIC_CMPXCHG( fixed2,  div, kmp_int16,  16, /,  2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2_div
 ATOMIC_CMPXCHG( fixed2u, div, kmp_uint16, 16, /,  2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2u_div
-ATOMIC_CMPXCHG( fixed2,  mul, kmp_int16,  16, *,  2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2_mul
+ATOMIC_CMPXCHG_COMB( fixed2,  mul, kmp_int16,  16, *, kmp_combine_mul,  2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2_mul
 ATOMIC_CMPXCHG( fixed2,  orb, kmp_int16,  16, |,  2i, 1, 0            )  // __kmpc_atomic_fixed2_orb
 ATOMIC_CMPXCHG( fixed2,  shl, kmp_int16,  16, <<, 2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2_shl
 ATOMIC_CMPXCHG( fixed2,  shr, kmp_int16,  16, >>, 2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2_shr
 ATOMIC_CMPXCHG( fixed2u, shr, kmp_uint16, 16, >>, 2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2u_shr
-ATOMIC_CMPXCHG( fixed2,  sub, kmp_int16,  16, -,  2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2_sub
+ATOMIC_CMPXCHG_COMB( fixed2,  sub, kmp_int16,  16, -, kmp_combine_sub,  2i, 1, KMP_ARCH_X86 )  // __kmpc_atomic_fixed2_sub
 ATOMIC_CMPXCHG( fixed2,  xor, kmp_int16,  16, ^,  2i, 1, 0            )  // __kmpc_atomic_fixed2_xor
 ATOMIC_CMPXCHG( fixed4, andb, kmp_int32,  32, &,  4i, 3, 0            )  // __kmpc_atomic_fixed4_andb
 ATOMIC_CMPXCHG( fixed4,  div, kmp_int32,  32, /,  4i, 3, KMP_ARCH_X86 )  // __kmpc_atomic_fixed4_div
 ATOMIC_CMPXCHG( fixed4u, div, kmp_uint32, 32, /,  4i, 3, KMP_ARCH_X86 )  // __kmpc_atomic_fixed4u_div
-ATOMIC_CMPXCHG( fixed4,  mul, kmp_int32,  32, *,  4i, 3, KMP_ARCH_X86 )  // __kmpc_atomic_fixed4_mul
+ATOMIC_CMPXCHG_COMB( fixed4,  mul, kmp_int32,  32, *, kmp_combine_mul,  4i, 3, KMP_ARCH_X86 )  // __kmpc_atomic_fixed4_mul
 ATOMIC_CMPXCHG( fixed4,  orb, kmp_int32,  32, |,  4i, 3, 0            )  // __kmpc_atomic_fixed4_orb
 ATOMIC_CMPXCHG( fixed4,  shl, kmp_int32,  32, <<, 4i, 3, KMP_ARCH_X86 )  // __kmpc_atomic_fixed4_shl
 ATOMIC_CMPXCHG( fixed4,  shr, kmp_int32,  32, >>, 4i, 3, KMP_ARCH_X86 )  // __kmpc_atomic_fixed4_shr
@@ -815,16 +1062,16 @@ ATOMIC_CMPXCHG( fixed4,  xor, kmp_int32,  32, ^,  4i, 3, 0            )  // __km
 ATOMIC_CMPXCHG( fixed8, andb, kmp_int64,  64, &,  8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8_andb
 ATOMIC_CMPXCHG( fixed8,  div, kmp_int64,  64, /,  8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8_div
 ATOMIC_CMPXCHG( fixed8u, div, kmp_uint64, 64, /,  8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8u_div
-ATOMIC_CMPXCHG( fixed8,  mul, kmp_int64,  64, *,  8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8_mul
+ATOMIC_CMPXCHG_COMB( fixed8,  mul, kmp_int64,  64, *, kmp_combine_mul,  8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8_mul
 ATOMIC_CMPXCHG( fixed8,  orb, kmp_int64,  64, |,  8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8_orb
 ATOMIC_CMPXCHG( fixed8,  shl, kmp_int64,  64, <<, 8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8_shl
 ATOMIC_CMPXCHG( fixed8,  shr, kmp_int64,  64, >>, 8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8_shr
 ATOMIC_CMPXCHG( fixed8u, shr, kmp_uint64, 64, >>, 8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8u_shr
 ATOMIC_CMPXCHG( fixed8,  xor, kmp_int64,  64, ^,  8i, 7, KMP_ARCH_X86 )  // __kmpc_atomic_fixed8_xor
 ATOMIC_CMPXCHG( float4,  div, kmp_real32, 32, /,  4r, 3, KMP_ARCH_X86 )  // __kmpc_atomic_float4_div
-ATOMIC_CMPXCHG( float4,  mul, kmp_real32, 32, *,  4r, 3, KMP_ARCH_X86 )  // __kmpc_atomic_float4_mul
+ATOMIC_CMPXCHG_COMB( float4,  mul, kmp_real32, 32, *, kmp_combine_mul,  4r, 3, KMP_ARCH_X86 )  // __kmpc_atomic_float4_mul
 ATOMIC_CMPXCHG( float8,  div, kmp_real64, 64, /,  8r, 7, KMP_ARCH_X86 )  // __kmpc_atomic_float8_div
-ATOMIC_CMPXCHG( float8,  mul, kmp_real64, 64, *,  8r, 7, KMP_ARCH_X86 )  // __kmpc_atomic_float8_mul
+ATOMIC_CMPXCHG_COMB( float8,  mul, kmp_real64, 64, *, kmp_combine_mul,  8r, 7, KMP_ARCH_X86 )  // __kmpc_atomic_float8_mul
 //              TYPE_ID,OP_ID, TYPE,          OP, LCK_ID, GOMP_FLAG
 
 
@@ -917,6 +1164,26 @@ ATOMIC_BEGIN(TYPE_ID,OP_ID,TYPE,void)                                      \
     }                                                                      \
 }
 
+// 16-byte operands: cmpxchg16b if possible, otherwise critical section
+#define MIN_MAX_CMPXCHG16(TYPE_ID,OP_ID,TYPE,OP,LCK_ID,GOMP_FLAG)          \
+ATOMIC_BEGIN(TYPE_ID,OP_ID,TYPE,void)                                      \
+    if ( *lhs OP rhs ) {     /* need actions? */                           \
+        if ( KMP_ATOMIC_CX16_OK( lhs ) ) {                                 \
+            OP_CMPXCHG16_INIT(TYPE,lhs)                                    \
+            new_value.f_val = rhs;                                         \
+            while ( old_value.f_val OP rhs &&  /* still need actions? */   \
+                ! KMP_COMPARE_AND_STORE_RET128( lhs, old_value.i_val,      \
+                                                new_value.i_val ) )        \
+            {                                                              \
+                KMP_CPU_PAUSE();                                           \
+            }                                                              \
+            return;                                                        \
+        }                                                                  \
+        GOMP_MIN_MAX_CRITSECT(OP,GOMP_FLAG)                                \
+        MIN_MAX_CRITSECT(OP,LCK_ID)                                        \
+    }                                                                      \
+}
+
 #define MIN_MAX_COMPXCHG(TYPE_ID,OP_ID,TYPE,BITS,OP,LCK_ID,MASK,GOMP_FLAG) \
 ATOMIC_BEGIN(TYPE_ID,OP_ID,TYPE,void)                                      \
     if ( *lhs OP rhs ) {                                                   \
@@ -938,8 +1205,8 @@ MIN_MAX_COMPXCHG( float4,  min, kmp_real32, 32, >, 4r, 3, KMP_ARCH_X86 ) // __km
 MIN_MAX_COMPXCHG( float8,  max, kmp_real64, 64, <, 8r, 7, KMP_ARCH_X86 ) // __kmpc_atomic_float8_max
 MIN_MAX_COMPXCHG( float8,  min, kmp_real64, 64, >, 8r, 7, KMP_ARCH_X86 ) // __kmpc_atomic_float8_min
 #if KMP_HAVE_QUAD
-MIN_MAX_CRITICAL( float16, max,     QUAD_LEGACY,      <, 16r,   1 )            // __kmpc_atomic_float16_max
-MIN_MAX_CRITICAL( float16, min,     QUAD_LEGACY,      >, 16r,   1 )            // __kmpc_atomic_float16_min
+MIN_MAX_CMPXCHG16( float16, max,    QUAD_LEGACY,      <, 16r,   1 )            // __kmpc_atomic_float16_max
+MIN_MAX_CMPXCHG16( float16, min,    QUAD_LEGACY,      >, 16r,   1 )          // __kmpc_atomic_float16_min
 
 #endif
 // ------------------------------------------------------------------------
@@ -980,6 +1247,18 @@ ATOMIC_BEGIN(TYPE_ID,OP_ID,TYPE,void)                                     \
     OP_CRITICAL(OP##=,LCK_ID)          /* send assignment */              \
 }
 
+// ------------------------------------------------------------------------
+// 16-byte operands: cmpxchg16b if possible, otherwise as ATOMIC_CRITICAL
+#define ATOMIC_CMPXCHG16(TYPE_ID,OP_ID,TYPE,OP,LCK_ID,GOMP_FLAG)          \
+ATOMIC_BEGIN(TYPE_ID,OP_ID,TYPE,void)                                     \
+    if ( KMP_ATOMIC_CX16_OK( lhs ) ) {                                    \
+        OP_CMPXCHG16(TYPE,old_value.f_val OP rhs)                         \
+        return;                                                           \
+    }                                                                     \
+    OP_GOMP_CRITICAL(OP##=,GOMP_FLAG)  /* send assignment */              \
+    OP_CRITICAL(OP##=,LCK_ID)          /* send assignment */              \
+}
+
 /* ------------------------------------------------------------------------- */
 // routines for long double type
 ATOMIC_CRITICAL( float10, add, long double,     +, 10r,   1 )            // __kmpc_atomic_float10_add
@@ -988,10 +1267,10 @@ ATOMIC_CRITICAL( float10, mul, long double,     *, 10r,   1 )            // __km
 ATOMIC_CRITICAL( float10, div, long double,     /, 10r,   1 )            // __kmpc_atomic_float10_div
 #if KMP_HAVE_QUAD
 // routines for _Quad type
-ATOMIC_CRITICAL( float16, add, QUAD_LEGACY,     +, 16r,   1 )            // __kmpc_atomic_float16_add
-ATOMIC_CRITICAL( float16, sub, QUAD_LEGACY,     -, 16r,   1 )            // __kmpc_atomic_float16_sub
-ATOMIC_CRITICAL( float16, mul, QUAD_LEGACY,     *, 16r,   1 )            // __kmpc_atomic_float16_mul
-ATOMIC_CRITICAL( float16, div, QUAD_LEGACY,     /, 16r,   1 )            // __kmpc_atomic_float16_div
+ATOMIC_CMPXCHG16( float16, add, QUAD_LEGACY,    +, 16r,   1 )           // __kmpc_atomic_float16_add
+ATOMIC_CMPXCHG16( float16, sub, QUAD_LEGACY,    -, 16r,   1 )           // __kmpc_atomic_float16_sub
+ATOMIC_CMPXCHG16( float16, mul, QUAD_LEGACY,    *, 16r,   1 )           // __kmpc_atomic_float16_mul
+ATOMIC_CMPXCHG16( float16, div, QUAD_LEGACY,    /, 16r,   1 )           // __kmpc_atomic_float16_div
 #endif
 // routines for complex types
 
@@ -1009,10 +1288,10 @@ ATOMIC_CRITICAL( cmplx4,  mul, kmp_cmplx32,     *,  8c,   1 )            // __km
 ATOMIC_CRITICAL( cmplx4,  div, kmp_cmplx32,     /,  8c,   1 )            // __kmpc_atomic_cmplx4_div
 #endif // USE_CMPXCHG_FIX
 
-ATOMIC_CRITICAL( cmplx8,  add, kmp_cmplx64,     +, 16c,   1 )            // __kmpc_atomic_cmplx8_add
-ATOMIC_CRITICAL( cmplx8,  sub, kmp_cmplx64,     -, 16c,   1 )            // __kmpc_atomic_cmplx8_sub
-ATOMIC_CRITICAL( cmplx8,  mul, kmp_cmplx64,     *, 16c,   1 )            // __kmpc_atomic_cmplx8_mul
-ATOMIC_CRITICAL( cmplx8,  div, kmp_cmplx64,     /, 16c,   1 )            // __kmpc_atomic_cmplx8_div
+ATOMIC_CMPXCHG16( cmplx8,  add, kmp_cmplx64,    +, 16c,   1 )           // __kmpc_atomic_cmplx8_add
+ATOMIC_CMPXCHG16( cmplx8,  sub, kmp_cmplx64,    -, 16c,   1 )           // __kmpc_atomic_cmplx8_sub
+ATOMIC_CMPXCHG16( cmplx8,  mul, kmp_cmplx64,    *, 16c,   1 )           // __kmpc_atomic_cmplx8_mul
+ATOMIC_CMPXCHG16( cmplx8,  div, kmp_cmplx64,    /, 16c,   1 )           // __kmpc_atomic_cmplx8_div
 ATOMIC_CRITICAL( cmplx10, add, kmp_cmplx80,     +, 20c,   1 )            // __kmpc_atomic_cmplx10_add
 ATOMIC_CRITICAL( cmplx10, sub, kmp_cmplx80,     -, 20c,   1 )            // __kmpc_atomic_cmplx10_sub
 ATOMIC_CRITICAL( cmplx10, mul, kmp_cmplx80,     *, 20c,   1 )            // __kmpc_atomic_cmplx10_mul
@@ -1155,21 +1434,33 @@ ATOMIC_BEGIN_REV(TYPE_ID,OP_ID,TYPE,void)                                     \
     OP_CRITICAL_REV(OP,LCK_ID)                                                \
 }
 
+// ------------------------------------------------------------------------
+// 16-byte operands: cmpxchg16b if possible, otherwise as ATOMIC_CRITICAL_REV
+#define ATOMIC_CMPXCHG16_REV(TYPE_ID,OP_ID,TYPE,OP,LCK_ID,GOMP_FLAG)      \
+ATOMIC_BEGIN_REV(TYPE_ID,OP_ID,TYPE,void)                                 \
+    if ( KMP_ATOMIC_CX16_OK( lhs ) ) {                                    \
+        OP_CMPXCHG16(TYPE,rhs OP old_value.f_val)                         \
+        return;                                                           \
+    }                                                                     \
+    OP_GOMP_CRITICAL_REV(OP,GOMP_FLAG)                                    \
+    OP_CRITICAL_REV(OP,LCK_ID)                                            \
+}
+
 /* ------------------------------------------------------------------------- */
 // routines for long double type
 ATOMIC_CRITICAL_REV( float10, sub, long double,     -, 10r,   1 )            // __kmpc_atomic_float10_sub_rev
 ATOMIC_CRITICAL_REV( float10, div, long double,     /, 10r,   1 )            // __kmpc_atomic_float10_div_rev
 #if KMP_HAVE_QUAD
 // routines for _Quad type
-ATOMIC_CRITICAL_REV( float16, sub, QUAD_LEGACY,     -, 16r,   1 )            // __kmpc_atomic_float16_sub_rev
-ATOMIC_CRITICAL_REV( float16, div, QUAD_LEGACY,     /, 16r,   1 )            // __kmpc_atomic_float16_div_rev
+ATOMIC_CMPXCHG16_REV( float16, sub, QUAD_LEGACY,    -, 16r,   1 )           // __kmpc_atomic_float16_sub_rev
+ATOMIC_CMPXCHG16_REV( float16, div, QUAD_LEGACY,    /, 16r,   1 )           // __kmpc_atomic_float16_div_rev
 #endif
 
 // routines for complex types
 ATOMIC_CRITICAL_REV( cmplx4,  sub, kmp_cmplx32,     -, 8c,    1 )            // __kmpc_atomic_cmplx4_sub_rev
 ATOMIC_CRITICAL_REV( cmplx4,  div, kmp_cmplx32,     /, 8c,    1 )            // __kmpc_atomic_cmplx4_div_rev
-ATOMIC_CRITICAL_REV( cmplx8,  sub, kmp_cmplx64,     -, 16c,   1 )            // __kmpc_atomic_cmplx8_sub_rev
-ATOMIC_CRITICAL_REV( cmplx8,  div, kmp_cmplx64,     /, 16c,   1 )            // __kmpc_atomic_cmplx8_div_rev
+ATOMIC_CMPXCHG16_REV( cmplx8,  sub, kmp_cmplx64,    -, 16c,   1 )           // __kmpc_atomic_cmplx8_sub_rev
+ATOMIC_CMPXCHG16_REV( cmplx8,  div, kmp_cmplx64,    /, 16c,   1 )           // __kmpc_atomic_cmplx8_div_rev
 ATOMIC_CRITICAL_REV( cmplx10, sub, kmp_cmplx80,     -, 20c,   1 )            // __kmpc_atomic_cmplx10_sub_rev
 ATOMIC_CRITICAL_REV( cmplx10, div, kmp_cmplx80,     /, 20c,   1 )            // __kmpc_atomic_cmplx10_div_rev
 #if KMP_HAVE_QUAD
@@ -1385,6 +1676,24 @@ ATOMIC_BEGIN_READ(TYPE_ID,OP_ID,TYPE,TYPE)                                \
     return new_value;                                                     \
 }
 
+// ------------------------------------------------------------------------
+// 16-byte operands: a compare and store of a value with itself never changes
+// *loc, but always returns its whole contents
+#define ATOMIC_CMPXCHG16_READ(TYPE_ID,OP_ID,TYPE,OP,LCK_ID,GOMP_FLAG)     \
+ATOMIC_BEGIN_READ(TYPE_ID,OP_ID,TYPE,TYPE)                                \
+    if ( KMP_ATOMIC_CX16_OK( loc ) ) {                                    \
+        OP_CMPXCHG16_INIT(TYPE,loc)                                       \
+        new_value = old_value;                                            \
+        KMP_COMPARE_AND_STORE_RET128( loc, old_value.i_val,               \
+                                      new_value.i_val );                  \
+        return old_value.f_val;                                           \
+    }                                                                     \
+    TYPE new_value;                                                       \
+    OP_GOMP_CRITICAL_READ(OP##=,GOMP_FLAG)  /* send assignment */         \
+    OP_CRITICAL_READ(OP,LCK_ID)          /* send assignment */            \
+    return new_value;                                                     \
+}
+
 // ------------------------------------------------------------------------
 // Fix for cmplx4 read (CQ220361) on Windows* OS. Regular routine with return value doesn't work.
 // Let's return the read value through the additional parameter.
@@ -1434,7 +1743,7 @@ ATOMIC_CMPXCHG_READ( fixed2,  rd, kmp_int16,  16, +,  KMP_ARCH_X86 )  // __kmpc_
 
 ATOMIC_CRITICAL_READ( float10, rd, long double, +, 10r,   1 )         // __kmpc_atomic_float10_rd
 #if KMP_HAVE_QUAD
-ATOMIC_CRITICAL_READ( float16, rd, QUAD_LEGACY, +, 16r,   1 )         // __kmpc_atomic_float16_rd
+ATOMIC_CMPXCHG16_READ( float16, rd, QUAD_LEGACY, +, 16r, 1 )         // __kmpc_atomic_float16_rd
 #endif // KMP_HAVE_QUAD
 
 // Fix for CQ220361 on Windows* OS
@@ -1443,7 +1752,7 @@ ATOMIC_CRITICAL_READ( float16, rd, QUAD_LEGACY, +, 16r,   1 )         // __kmpc_
 #else
     ATOMIC_CRITICAL_READ( cmplx4,  rd, kmp_cmplx32, +,  8c, 1 )       // __kmpc_atomic_cmplx4_rd
 #endif
-ATOMIC_CRITICAL_READ( cmplx8,  rd, kmp_cmplx64, +, 16c, 1 )           // __kmpc_atomic_cmplx8_rd
+ATOMIC_CMPXCHG16_READ( cmplx8,  rd, kmp_cmplx64, +, 16c, 1 )          // __kmpc_atomic_cmplx8_rd
 ATOMIC_CRITICAL_READ( cmplx10, rd, kmp_cmplx80, +, 20c, 1 )           // __kmpc_atomic_cmplx10_rd
 #if KMP_HAVE_QUAD
 ATOMIC_CRITICAL_READ( cmplx16, rd, CPLX128_LEG, +, 32c, 1 )           // __kmpc_atomic_cmplx16_rd
@@ -1511,6 +1820,17 @@ ATOMIC_BEGIN(TYPE_ID,OP_ID,TYPE,void)                                     \
     OP_CRITICAL(OP,LCK_ID)               /* send assignment */            \
 }
 // -------------------------------------------------------------------------
+// 16-byte operands: cmpxchg16b if possible, otherwise as ATOMIC_CRITICAL_WR
+#define ATOMIC_CMPXCHG16_WR(TYPE_ID,OP_ID,TYPE,OP,LCK_ID,GOMP_FLAG)       \
+ATOMIC_BEGIN(TYPE_ID,OP_ID,TYPE,void)                                     \
+    if ( KMP_ATOMIC_CX16_OK( lhs ) ) {                                    \
+        OP_CMPXCHG16(TYPE,rhs)                                            \
+        return;                                                           \
+    }                                                                     \
+    OP_GOMP_CRITICAL(OP,GOMP_FLAG)       /* send assignment */            \
+    OP_CRITICAL(OP,LCK_ID)               /* send assignment */            \
+}
+// -------------------------------------------------------------------------
 
 ATOMIC_XCHG_WR( fixed1,  wr, kmp_int8,    8, =,  KMP_ARCH_X86 )  // __kmpc_atomic_fixed1_wr
 ATOMIC_XCHG_WR( fixed2,  wr, kmp_int16,  16, =,  KMP_ARCH_X86 )  // __kmpc_atomic_fixed2_wr
@@ -1522,10 +1842,10 @@ ATOMIC_XCHG_FLOAT_WR( float8, wr, kmp_real64, 64, =, KMP_ARCH_X86 )  // __kmpc_a
 
 ATOMIC_CRITICAL_WR( float10, wr, long double, =, 10r,   1 )         // __kmpc_atomic_float10_wr
 #if KMP_HAVE_QUAD
-ATOMIC_CRITICAL_WR( float16, wr, QUAD_LEGACY, =, 16r,   1 )         // __kmpc_atomic_float16_wr
+ATOMIC_CMPXCHG16_WR( float16, wr, QUAD_LEGACY, =, 16r, 1 )          // __kmpc_atomic_float16_wr
 #endif
 ATOMIC_CRITICAL_WR( cmplx4,  wr, kmp_cmplx32, =,  8c,   1 )         // __kmpc_atomic_cmplx4_wr
-ATOMIC_CRITICAL_WR( cmplx8,  wr, kmp_cmplx64, =, 16c,   1 )         // __kmpc_atomic_cmplx8_wr
+ATOMIC_CMPXCHG16_WR( cmplx8,  wr, kmp_cmplx64, =, 16c, 1 )          // __kmpc_atomic_cmplx8_wr
 ATOMIC_CRITICAL_WR( cmplx10, wr, kmp_cmplx80, =, 20c,   1 )         // __kmpc_atomic_cmplx10_wr
 #if KMP_HAVE_QUAD
 ATOMIC_CRITICAL_WR( cmplx16, wr, CPLX128_LEG, =, 32c,   1 )         // __kmpc_atomic_cmplx16_wr
@@ -1815,6 +2135,31 @@ ATOMIC_BEGIN_CPT(TYPE_ID,OP_ID,TYPE,TYPE)                                  \
     return *lhs;                                                           \
 }
 
+// 16-byte operands: cmpxchg16b if possible, otherwise critical section
+#define MIN_MAX_CMPXCHG16_CPT(TYPE_ID,OP_ID,TYPE,OP,LCK_ID,GOMP_FLAG)      \
+ATOMIC_BEGIN_CPT(TYPE_ID,OP_ID,TYPE,TYPE)                                  \
+    if ( *lhs OP rhs ) {     /* need actions? */                           \
+        if ( KMP_ATOMIC_CX16_OK( lhs ) ) {                                 \
+            OP_CMPXCHG16_INIT(TYPE,lhs)                                    \
+            new_value.f_val = rhs;                                         \
+            while ( old_value.f_val OP rhs &&  /* still need actions? */   \
+                ! KMP_COMPARE_AND_STORE_RET128( lhs, old_value.i_val,      \
+                                                new_value.i_val ) )        \
+            {                                                              \
+                KMP_CPU_PAUSE();                                           \
+            }                                                              \
+            if( flag )                                                     \
+                return rhs;                                                \
+            else                                                           \
+                return old_value.f_val;                                    \
+        }                                                                  \
+        TYPE new_value, old_value;                                         \
+        GOMP_MIN_MAX_CRITSECT_CPT(OP,GOMP_FLAG)                            \
+        MIN_MAX_CRITSECT_CPT(OP,LCK_ID)                                    \
+    }                                                                      \
+    return *lhs;                                                           \
+}
+
 #define MIN_MAX_COMPXCHG_CPT(TYPE_ID,OP_ID,TYPE,BITS,OP,GOMP_FLAG)         \
 ATOMIC_BEGIN_CPT(TYPE_ID,OP_ID,TYPE,TYPE)                                  \
     TYPE new_value, old_value;                                             \
@@ -1839,8 +2184,8 @@ MIN_MAX_COMPXCHG_CPT( float4,  min_cpt, kmp_real32, 32, >, KMP_ARCH_X86 ) // __k
 MIN_MAX_COMPXCHG_CPT( float8,  max_cpt, kmp_real64, 64, <, KMP_ARCH_X86 ) // __kmpc_atomic_float8_max_cpt
 MIN_MAX_COMPXCHG_CPT( float8,  min_cpt, kmp_real64, 64, >, KMP_ARCH_X86 ) // __kmpc_atomic_float8_min_cpt
 #if KMP_HAVE_QUAD
-MIN_MAX_CRITICAL_CPT( float16, max_cpt, QUAD_LEGACY,    <, 16r,   1 )     // __kmpc_atomic_float16_max_cpt
-MIN_MAX_CRITICAL_CPT( float16, min_cpt, QUAD_LEGACY,    >, 16r,   1 )     // __kmpc_atomic_float16_min_cpt
+MIN_MAX_CMPXCHG16_CPT( float16, max_cpt, QUAD_LEGACY,   <, 16r,   1 )     // __kmpc_atomic_float16_max_cpt
+MIN_MAX_CMPXCHG16_CPT( float16, min_cpt, QUAD_LEGACY,   >, 16r,   1 )    // __kmpc_atomic_float16_min_cpt
 #endif
 
 // ------------------------------------------------------------------------
@@ -1884,6 +2229,22 @@ ATOMIC_BEGIN_CPT(TYPE_ID,OP_ID,TYPE,TYPE)                           \
     OP_CRITICAL_CPT(OP##=,LCK_ID)          /* send assignment */    \
 }
 
+// ------------------------------------------------------------------------
+// 16-byte operands: cmpxchg16b if possible, otherwise as ATOMIC_CRITICAL_CPT
+#define ATOMIC_CMPXCHG16_CPT(TYPE_ID,OP_ID,TYPE,OP,LCK_ID,GOMP_FLAG) \
+ATOMIC_BEGIN_CPT(TYPE_ID,OP_ID,TYPE,TYPE)                           \
+    if ( KMP_ATOMIC_CX16_OK( lhs ) ) {                              \
+        OP_CMPXCHG16(TYPE,old_value.f_val OP rhs)                   \
+        if( flag ) {                                                \
+            return new_value.f_val;                                 \
+        } else                                                      \
+            return old_value.f_val;                                 \
+    }                                                               \
+    TYPE new_value;                                                 \
+    OP_GOMP_CRITICAL_CPT(OP,GOMP_FLAG)  /* send assignment */       \
+    OP_CRITICAL_CPT(OP##=,LCK_ID)          /* send assignment */    \
+}
+
 // ------------------------------------------------------------------------
 
 // Workaround for cmplx4. Regular routines with return value don't work
@@ -1934,10 +2295,10 @@ ATOMIC_CRITICAL_CPT( float10, mul_cpt, long double,     *, 10r,   1 )
 ATOMIC_CRITICAL_CPT( float10, div_cpt, long double,     /, 10r,   1 )            // __kmpc_atomic_float10_div_cpt
 #if KMP_HAVE_QUAD
 // routines for _Quad type
-ATOMIC_CRITICAL_CPT( float16, add_cpt, QUAD_LEGACY,     +, 16r,   1 )            // __kmpc_atomic_float16_add_cpt
-ATOMIC_CRITICAL_CPT( float16, sub_cpt, QUAD_LEGACY,     -, 16r,   1 )            // __kmpc_atomic_float16_sub_cpt
-ATOMIC_CRITICAL_CPT( float16, mul_cpt, QUAD_LEGACY,     *, 16r,   1 )            // __kmpc_atomic_float16_mul_cpt
-ATOMIC_CRITICAL_CPT( float16, div_cpt, QUAD_LEGACY,     /, 16r,   1 )            // __kmpc_atomic_float16_div_cpt
+ATOMIC_CMPXCHG16_CPT( float16, add_cpt, QUAD_LEGACY,    +, 16r,   1 )           // __kmpc_atomic_float16_add_cpt
+ATOMIC_CMPXCHG16_CPT( float16, sub_cpt, QUAD_LEGACY,    -, 16r,   1 )           // __kmpc_atomic_float16_sub_cpt
+ATOMIC_CMPXCHG16_CPT( float16, mul_cpt, QUAD_LEGACY,    *, 16r,   1 )           // __kmpc_atomic_float16_mul_cpt
+ATOMIC_CMPXCHG16_CPT( float16, div_cpt, QUAD_LEGACY,    /, 16r,   1 )           // __kmpc_atomic_float16_div_cpt
 #endif
 
 // routines for complex types
@@ -1948,10 +2309,10 @@ ATOMIC_CRITICAL_CPT_WRK( cmplx4,  sub_cpt, kmp_cmplx32, -, 8c,    1 )
 ATOMIC_CRITICAL_CPT_WRK( cmplx4,  mul_cpt, kmp_cmplx32, *, 8c,    1 )            // __kmpc_atomic_cmplx4_mul_cpt
 ATOMIC_CRITICAL_CPT_WRK( cmplx4,  div_cpt, kmp_cmplx32, /, 8c,    1 )            // __kmpc_atomic_cmplx4_div_cpt
 
-ATOMIC_CRITICAL_CPT( cmplx8,  add_cpt, kmp_cmplx64, +, 16c,   1 )            // __kmpc_atomic_cmplx8_add_cpt
-ATOMIC_CRITICAL_CPT( cmplx8,  sub_cpt, kmp_cmplx64, -, 16c,   1 )            // __kmpc_atomic_cmplx8_sub_cpt
-ATOMIC_CRITICAL_CPT( cmplx8,  mul_cpt, kmp_cmplx64, *, 16c,   1 )            // __kmpc_atomic_cmplx8_mul_cpt
-ATOMIC_CRITICAL_CPT( cmplx8,  div_cpt, kmp_cmplx64, /, 16c,   1 )            // __kmpc_atomic_cmplx8_div_cpt
+ATOMIC_CMPXCHG16_CPT( cmplx8,  add_cpt, kmp_cmplx64, +, 16c,  1 )            // __kmpc_atomic_cmplx8_add_cpt
+ATOMIC_CMPXCHG16_CPT( cmplx8,  sub_cpt, kmp_cmplx64, -, 16c,  1 )            // __kmpc_atomic_cmplx8_sub_cpt
+ATOMIC_CMPXCHG16_CPT( cmplx8,  mul_cpt, kmp_cmplx64, *, 16c,  1 )            // __kmpc_atomic_cmplx8_mul_cpt
+ATOMIC_CMPXCHG16_CPT( cmplx8,  div_cpt, kmp_cmplx64, /, 16c,  1 )            // __kmpc_atomic_cmplx8_div_cpt
 ATOMIC_CRITICAL_CPT( cmplx10, add_cpt, kmp_cmplx80, +, 20c,   1 )            // __kmpc_atomic_cmplx10_add_cpt
 ATOMIC_CRITICAL_CPT( cmplx10, sub_cpt, kmp_cmplx80, -, 20c,   1 )            // __kmpc_atomic_cmplx10_sub_cpt
 ATOMIC_CRITICAL_CPT( cmplx10, mul_cpt, kmp_cmplx80, *, 20c,   1 )            // __kmpc_atomic_cmplx10_mul_cpt
@@ -2085,14 +2446,31 @@ ATOMIC_BEGIN_CPT(TYPE_ID,OP_ID,TYPE,TYPE)                               \
 }
 
 
+// ------------------------------------------------------------------------
+// 16-byte operands: cmpxchg16b if possible, otherwise as ATOMIC_CRITICAL_CPT_REV
+#define ATOMIC_CMPXCHG16_CPT_REV(TYPE_ID,OP_ID,TYPE,OP,LCK_ID,GOMP_FLAG) \
+ATOMIC_BEGIN_CPT(TYPE_ID,OP_ID,TYPE,TYPE)                               \
+    if ( KMP_ATOMIC_CX16_OK( lhs ) ) {                                  \
+        OP_CMPXCHG16(TYPE,rhs OP old_value.f_val)                       \
+        if( flag ) {                                                    \
+            return new_value.f_val;                                     \
+        } else                                                          \
+            return old_value.f_val;                                     \
+    }                                                                   \
+    TYPE new_value;                                                     \
+    OP_GOMP_CRITICAL_CPT_REV(OP,GOMP_FLAG)                              \
+    OP_CRITICAL_CPT_REV(OP,LCK_ID)                                      \
+}
+
+
 /* ------------------------------------------------------------------------- */
 // routines for long double type
 ATOMIC_CRITICAL_CPT_REV( float10, sub_cpt_rev, long double,     -, 10r,   1 )            // __kmpc_atomic_float10_sub_cpt_rev
 ATOMIC_CRITICAL_CPT_REV( float10, div_cpt_rev, long double,     /, 10r,   1 )            // __kmpc_atomic_float10_div_cpt_rev
 #if KMP_HAVE_QUAD
 // routines for _Quad type
-ATOMIC_CRITICAL_CPT_REV( float16, sub_cpt_rev, QUAD_LEGACY,     -, 16r,   1 )            // __kmpc_atomic_float16_sub_cpt_rev
-ATOMIC_CRITICAL_CPT_REV( float16, div_cpt_rev, QUAD_LEGACY,     /, 16r,   1 )            // __kmpc_atomic_float16_div_cpt_rev
+ATOMIC_CMPXCHG16_CPT_REV( float16, sub_cpt_rev, QUAD_LEGACY,    -, 16r,   1 )           // __kmpc_atomic_float16_sub_cpt_rev
+ATOMIC_CMPXCHG16_CPT_REV( float16, div_cpt_rev, QUAD_LEGACY,    /, 16r,   1 )           // __kmpc_atomic_float16_div_cpt_rev
 #endif
 
 // routines for complex types
@@ -2140,8 +2518,8 @@ ATOMIC_BEGIN_WRK(TYPE_ID,OP_ID,TYPE)                                          \
 ATOMIC_CRITICAL_CPT_REV_WRK( cmplx4,  sub_cpt_rev, kmp_cmplx32, -, 8c,    1 )            // __kmpc_atomic_cmplx4_sub_cpt_rev
 ATOMIC_CRITICAL_CPT_REV_WRK( cmplx4,  div_cpt_rev, kmp_cmplx32, /, 8c,    1 )            // __kmpc_atomic_cmplx4_div_cpt_rev
 
-ATOMIC_CRITICAL_CPT_REV( cmplx8,  sub_cpt_rev, kmp_cmplx64, -, 16c,   1 )            // __kmpc_atomic_cmplx8_sub_cpt_rev
-ATOMIC_CRITICAL_CPT_REV( cmplx8,  div_cpt_rev, kmp_cmplx64, /, 16c,   1 )            // __kmpc_atomic_cmplx8_div_cpt_rev
+ATOMIC_CMPXCHG16_CPT_REV( cmplx8,  sub_cpt_rev, kmp_cmplx64, -, 16c,  1 )            // __kmpc_atomic_cmplx8_sub_cpt_rev
+ATOMIC_CMPXCHG16_CPT_REV( cmplx8,  div_cpt_rev, kmp_cmplx64, /, 16c,  1 )            // __kmpc_atomic_cmplx8_div_cpt_rev
 ATOMIC_CRITICAL_CPT_REV( cmplx10, sub_cpt_rev, kmp_cmplx80, -, 20c,   1 )            // __kmpc_atomic_cmplx10_sub_cpt_rev
 ATOMIC_CRITICAL_CPT_REV( cmplx10, div_cpt_rev, kmp_cmplx80, /, 20c,   1 )            // __kmpc_atomic_cmplx10_div_cpt_rev
 #if KMP_HAVE_QUAD
@@ -2239,6 +2617,19 @@ ATOMIC_BEGIN_SWP(TYPE_ID,TYPE)                                          \
     CRITICAL_SWP(LCK_ID)                                                \
 }
 
+// ------------------------------------------------------------------------
+// 16-byte operands: cmpxchg16b if possible, otherwise as ATOMIC_CRITICAL_SWP
+#define ATOMIC_CMPXCHG16_SWP(TYPE_ID,TYPE,LCK_ID,GOMP_FLAG)             \
+ATOMIC_BEGIN_SWP(TYPE_ID,TYPE)                                          \
+    if ( KMP_ATOMIC_CX16_OK( lhs ) ) {                                  \
+        OP_CMPXCHG16(TYPE,rhs)                                          \
+        return old_value.f_val;                                         \
+    }                                                                   \
+    TYPE old_value;                                                     \
+    GOMP_CRITICAL_SWP(GOMP_FLAG)                                        \
+    CRITICAL_SWP(LCK_ID)                                                \
+}
+
 // ------------------------------------------------------------------------
 
 // !!! TODO: check if we need to return void for cmplx4 routines
@@ -2283,7 +2674,7 @@ ATOMIC_BEGIN_SWP_WRK(TYPE_ID,TYPE)                                        \
 
 ATOMIC_CRITICAL_SWP( float10, long double, 10r,   1 )              // __kmpc_atomic_float10_swp
 #if KMP_HAVE_QUAD
-ATOMIC_CRITICAL_SWP( float16, QUAD_LEGACY, 16r,   1 )              // __kmpc_atomic_float16_swp
+ATOMIC_CMPXCHG16_SWP( float16, QUAD_LEGACY, 16r,  1 )              // __kmpc_atomic_float16_swp
 #endif
 // cmplx4 routine to return void
 ATOMIC_CRITICAL_SWP_WRK( cmplx4, kmp_cmplx32,  8c,   1 )           // __kmpc_atomic_cmplx4_swp
@@ -2291,7 +2682,7 @@ ATOMIC_CRITICAL_SWP_WRK( cmplx4, kmp_cmplx32,  8c,   1 )           // __kmpc_ato
 //ATOMIC_CRITICAL_SWP( cmplx4, kmp_cmplx32,  8c,   1 )           // __kmpc_atomic_cmplx4_swp
 
 
-ATOMIC_CRITICAL_SWP( cmplx8,  kmp_cmplx64, 16c,   1 )              // __kmpc_atomic_cmplx8_swp
+ATOMIC_CMPXCHG16_SWP( cmplx8,  kmp_cmplx64, 16c,  1 )              // __kmpc_atomic_cmplx8_swp
 ATOMIC_CRITICAL_SWP( cmplx10, kmp_cmplx80, 20c,   1 )              // __kmpc_atomic_cmplx10_swp
 #if KMP_HAVE_QUAD
 ATOMIC_CRITICAL_SWP( cmplx16, CPLX128_LEG, 32c,   1 )              // __kmpc_atomic_cmplx16_swp
@@ -2420,6 +2811,21 @@ __kmpc_atomic_10( ident_t *id_ref, int gtid, void* lhs, void* rhs, void (*f)( vo
 void
 __kmpc_atomic_16( ident_t *id_ref, int gtid, void* lhs, void* rhs, void (*f)( void *, void *, void * ) )
 {
+    if ( KMP_ATOMIC_CX16_OK( lhs ) ) {
+        kmp_int64 old_value[2], new_value[2];
+
+        old_value[0] = ( (volatile kmp_int64 *) lhs )[0];
+        old_value[1] = ( (volatile kmp_int64 *) lhs )[1];
+        (*f)( new_value, old_value, rhs );
+
+        while ( ! KMP_COMPARE_AND_STORE_RET128( lhs, old_value, new_value ) )
+        {
+            KMP_CPU_PAUSE();
+
+            (*f)( new_value, old_value, rhs );
+        }
+        return;
+    }
 
 #ifdef KMP_GOMP_COMPAT
     if ( __kmp_atomic_mode == 2 ) {
@@ -2492,14 +2898,14 @@ __kmpc_atomic_32( ident_t *id_ref, int gtid, void* lhs, void* rhs, void (*f)( vo
 void
 __kmpc_atomic_start(void)
 {
-    int gtid = hpx_backend->get_thread_num();
+    int gtid = hpx_backend->get_global_thread_num();
     __kmp_acquire_atomic_lock(&__kmp_atomic_lock, gtid);
 }
 
 void
 __kmpc_atomic_end(void)
 {
-    int gtid = hpx_backend->get_thread_num();
+    int gtid = hpx_backend->get_global_thread_num();
     __kmp_release_atomic_lock(&__kmp_atomic_lock, gtid);
 }
 
@@ -107,6 +107,12 @@ typedef unsigned long kmp_uintptr_t;
 
 # define KMP_ARCH_X86 0
 
+#if defined( __x86_64__ )
+# define KMP_ARCH_X86_64 1
+#else
+# define KMP_ARCH_X86_64 0
+#endif
+
 //Is not set. When/why would I need it?
 #ifdef USE_VOLATILE_CAST
 # define VOLATILE_CAST(x)        (volatile x)
@@ -160,6 +166,26 @@ typedef unsigned long kmp_uintptr_t;
 #define KMP_XCHG_FIXED64(p, v)                  __sync_lock_test_and_set( (volatile kmp_uint64 *)(p), (kmp_uint64)(v) )
 
 
+// 16-byte compare and store. cv holds the expected value on entry and the
+// value found in memory on exit, so a failed attempt does not need to re-read *p.
+// The target must be 16-byte aligned, and the cpu must support cmpxchg16b
+// (see __kmp_atomic_cx16), so callers check both before using it.
+#if KMP_ARCH_X86_64
+static inline bool
+__kmp_compare_and_store_ret128( volatile void *p, kmp_int64 *cv, const kmp_int64 *sv )
+{
+    bool result;
+    __asm__ __volatile__( "lock; cmpxchg16b %1\n\t"
+                          "sete %0"
+                          : "=q"( result ), "+m"( *(volatile kmp_int64 (*)[2]) p ),
+                            "+a"( cv[0] ), "+d"( cv[1] )
+                          : "b"( sv[0] ), "c"( sv[1] )
+                          : "memory", "cc" );
+    return result;
+}
+# define KMP_COMPARE_AND_STORE_RET128(p, cv, sv) __kmp_compare_and_store_ret128( (p), (cv), (sv) )
+#endif
+
 inline kmp_real32 KMP_XCHG_REAL32( volatile kmp_real32 *p, kmp_real32 v) {
     kmp_int32 tmp = __sync_lock_test_and_set( (kmp_int32*)p, *(kmp_int32*)&v);
     return *(kmp_real32*)&tmp;
@@ -186,6 +212,12 @@ typedef _Quad _Complex       kmp_cmplx128;
 extern "C" {
 
     extern int __kmp_atomic_mode;
+    // Set at load time from cpuid; nonzero if cmpxchg16b can be used for
+    // the 16-byte operand types (double complex, _Quad).
+    extern int __kmp_atomic_cx16;
+    // Nonzero if contended commutative updates may be combined; read
+    // from HPXMP_ATOMIC_COMBINE on the first contended update, -1 before.
+    extern int __kmp_atomic_combine;
     // Atomic locks can easily become contended, so we use queuing locks for them.
      
     //typedef kmp_queuing_lock_t kmp_atomic_lock_t;
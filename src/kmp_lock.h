@@ -0,0 +1,353 @@
+#ifndef KMP_LOCK_H
+#define KMP_LOCK_H
+
+#include <hpx/hpx.hpp>
+#include <hpx/lcos/local/mutex.hpp>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Lock kinds for critical sections and user locks, chosen from the OpenMP
+// lock hints. The spinning kinds never suspend the HPX thread, so they only
+// fit short critical sections; kmp_lock_hpx suspends waiters.
+enum kmp_lock_kind {
+    kmp_lock_hpx,        // hpx::lcos::local::mutex, waiters are suspended
+    kmp_lock_tas,        // test and set, a single CAS when uncontended
+    kmp_lock_ticket,     // fair under contention, waiters served in order
+    kmp_lock_queuing,    // MCS, each waiter spins on its own queue node
+    kmp_lock_adaptive    // spins on try_lock for a while, then suspends
+};
+
+// Spins for a while, then lets other HPX threads on this worker run, so a
+// holder that was descheduled on the same worker can make progress.
+inline void kmp_lock_spin_wait( int &spins ) {
+    if( ++spins < 64 ) {
+#if defined( __x86_64__ ) || defined( __i386__ )
+        __builtin_ia32_pause();
+#endif
+    } else if( hpx::threads::get_self_ptr() ) {
+        hpx::this_thread::yield();
+    } else {
+        std::this_thread::yield();
+    }
+}
+
+// hpx::lcos::local::mutex can only suspend HPX threads. Other threads, like
+// the program's main thread in a serialized region, spin on try_lock.
+template<typename lock_type>
+inline void kmp_lock_acquire( lock_type &lck ) {
+    if( hpx::threads::get_self_ptr() ) {
+        lck.lock();
+        return;
+    }
+    int spins = 0;
+    while( !lck.try_lock() ) {
+        kmp_lock_spin_wait( spins );
+    }
+}
+
+class tas_lock {
+    public:
+        void lock() {
+            int spins = 0;
+            while( !try_lock() ) {
+                while( poll.load( std::memory_order_relaxed ) != 0 ) {
+                    kmp_lock_spin_wait( spins );
+                }
+            }
+        }
+        bool try_lock() {
+            int expected = 0;
+            return poll.compare_exchange_strong( expected, 1, std::memory_order_acquire );
+        }
+        void unlock() {
+            poll.store( 0, std::memory_order_release );
+        }
+    private:
+        std::atomic<int> poll{0};
+};
+
+class ticket_lock {
+    public:
+        void lock() {
+            int spins = 0;
+            uint32_t my_ticket = next_ticket.fetch_add( 1, std::memory_order_relaxed );
+            while( now_serving.load( std::memory_order_acquire ) != my_ticket ) {
+                kmp_lock_spin_wait( spins );
+            }
+        }
+        bool try_lock() {
+            uint32_t serving = now_serving.load( std::memory_order_acquire );
+            return next_ticket.compare_exchange_strong( serving, serving + 1,
+                                                        std::memory_order_acquire );
+        }
+        void unlock() {
+            now_serving.store( now_serving.load( std::memory_order_relaxed ) + 1,
+                               std::memory_order_release );
+        }
+    private:
+        std::atomic<uint32_t> next_ticket{0};
+        std::atomic<uint32_t> now_serving{0};
+};
+
+// MCS lock in the variant that keeps the holder's queue node inside the lock
+// (the K42 lock), so lock() and unlock() need no node from the caller. A
+// waiter spins on a node on its own stack until its predecessor hands over.
+class queuing_lock {
+    public:
+        void lock() {
+            while( true ) {
+                qnode *prev = tail.load();
+                if( !prev ) {
+                    // looks free, mark it held with the lock's own node
+                    if( tail.compare_exchange_strong( prev, &head ) ) {
+                        return;
+                    }
+                } else {
+                    qnode waiter;
+                    waiter.tail.store( waiting() );
+                    if( tail.compare_exchange_strong( prev, &waiter ) ) {
+                        prev->next.store( &waiter );
+                        int spins = 0;
+                        while( waiter.tail.load() == waiting() ) {
+                            kmp_lock_spin_wait( spins );
+                        }
+                        // we hold the lock, move our successor into the lock
+                        // before the stack node goes away
+                        qnode *succ = waiter.next.load();
+                        if( !succ ) {
+                            head.next.store( nullptr );
+                            qnode *expected = &waiter;
+                            if( !tail.compare_exchange_strong( expected, &head ) ) {
+                                while( !( succ = waiter.next.load() ) ) {
+                                    kmp_lock_spin_wait( spins );
+                                }
+                                head.next.store( succ );
+                            }
+                        } else {
+                            head.next.store( succ );
+                        }
+                        return;
+                    }
+                }
+            }
+        }
+        bool try_lock() {
+            qnode *expected = nullptr;
+            return tail.compare_exchange_strong( expected, &head );
+        }
+        void unlock() {
+            qnode *succ = head.next.load();
+            if( !succ ) {
+                qnode *expected = &head;
+                if( tail.compare_exchange_strong( expected, nullptr ) ) {
+                    return;
+                }
+                int spins = 0;
+                while( !( succ = head.next.load() ) ) {
+                    kmp_lock_spin_wait( spins );
+                }
+            }
+            head.next.store( nullptr );
+            succ->tail.store( nullptr );
+        }
+    private:
+        struct qnode {
+            std::atomic<qnode*> tail{nullptr};   // waiting() until handed the lock
+            std::atomic<qnode*> next{nullptr};
+        };
+        static qnode* waiting() { return reinterpret_cast<qnode*>(1); }
+
+        std::atomic<qnode*> tail{nullptr};
+        qnode head;                              // head.next is the first waiter
+};
+
+class adaptive_lock {
+    public:
+        void lock() {
+            for( int i = 0; i < 100; i++ ) {
+                if( mtx.try_lock() ) {
+                    return;
+                }
+            }
+            kmp_lock_acquire( mtx );
+        }
+        bool try_lock() { return mtx.try_lock(); }
+        void unlock() { mtx.unlock(); }
+    private:
+        hpx::lcos::local::mutex mtx;
+};
+
+// A lock whose kind is picked at runtime. Critical sections install one of
+// these in the compiler provided kmp_critical_name storage.
+class kmp_indirect_lock {
+    public:
+        kmp_indirect_lock( kmp_lock_kind k ) : kind(k) {}
+        virtual ~kmp_indirect_lock() {}
+        virtual void lock() = 0;
+        virtual bool try_lock() = 0;
+        virtual void unlock() = 0;
+        const kmp_lock_kind kind;
+};
+
+template<typename lock_type, kmp_lock_kind K>
+class kmp_indirect_lock_impl : public kmp_indirect_lock {
+    public:
+        kmp_indirect_lock_impl() : kmp_indirect_lock(K) {}
+        void lock() { kmp_lock_acquire( lck ); }
+        bool try_lock() { return lck.try_lock(); }
+        void unlock() { lck.unlock(); }
+    private:
+        lock_type lck;
+};
+
+inline kmp_indirect_lock* kmp_new_indirect_lock( kmp_lock_kind kind ) {
+    switch( kind ) {
+        case kmp_lock_tas:
+            return new kmp_indirect_lock_impl<tas_lock, kmp_lock_tas>;
+        case kmp_lock_ticket:
+            return new kmp_indirect_lock_impl<ticket_lock, kmp_lock_ticket>;
+        case kmp_lock_queuing:
+            return new kmp_indirect_lock_impl<queuing_lock, kmp_lock_queuing>;
+        case kmp_lock_adaptive:
+            return new kmp_indirect_lock_impl<adaptive_lock, kmp_lock_adaptive>;
+        default:
+            return new kmp_indirect_lock_impl<hpx::lcos::local::mutex, kmp_lock_hpx>;
+    }
+}
+
+// ---- user locks (omp_lock_t, omp_nest_lock_t) ----
+// The user's lock storage is one pointer wide. A test and set lock is kept
+// in place in that word: bit 0 marks it as direct and bit 1 is the lock
+// itself. Other kinds don't fit and the word points to a kmp_indirect_lock
+// (heap pointers always have bit 0 clear).
+#define KMP_LOCK_DIRECT_FREE ((uintptr_t) 1)
+#define KMP_LOCK_DIRECT_HELD ((uintptr_t) 3)
+
+typedef std::atomic<uintptr_t> kmp_user_lock_word;
+
+inline kmp_user_lock_word* kmp_lock_word( void **user_lock ) {
+    return reinterpret_cast<kmp_user_lock_word*>(user_lock);
+}
+
+inline bool kmp_lock_is_direct( void **user_lock ) {
+    return ( kmp_lock_word(user_lock)->load( std::memory_order_relaxed ) & 1 ) != 0;
+}
+
+inline kmp_indirect_lock* kmp_lock_indirect( void **user_lock ) {
+    return reinterpret_cast<kmp_indirect_lock*>(*user_lock);
+}
+
+//Lock kind for omp_init_lock without a hint, from HPXMP_LOCK_KIND
+// (tas, ticket, queuing, adaptive or hpx). Defaults to the in place TAS lock.
+inline kmp_lock_kind kmp_user_lock_default() {
+    static kmp_lock_kind kind = [] {
+        const char *env = getenv("HPXMP_LOCK_KIND");
+        if( !env || !strcmp(env, "tas") )
+            return kmp_lock_tas;
+        if( !strcmp(env, "ticket") )
+            return kmp_lock_ticket;
+        if( !strcmp(env, "queuing") )
+            return kmp_lock_queuing;
+        if( !strcmp(env, "adaptive") )
+            return kmp_lock_adaptive;
+        if( !strcmp(env, "hpx") )
+            return kmp_lock_hpx;
+        std::cout << "HPXMP_LOCK_KIND: unknown lock kind " << env
+                  << ", using tas" << std::endl;
+        return kmp_lock_tas;
+    }();
+    return kind;
+}
+
+inline void kmp_user_lock_init( void **user_lock, kmp_lock_kind kind ) {
+    if( kind == kmp_lock_tas ) {
+        kmp_lock_word(user_lock)->store( KMP_LOCK_DIRECT_FREE, std::memory_order_release );
+    } else {
+        *user_lock = kmp_new_indirect_lock( kind );
+    }
+}
+
+inline void kmp_user_lock_destroy( void **user_lock ) {
+    if( !kmp_lock_is_direct(user_lock) ) {
+        delete kmp_lock_indirect(user_lock);
+    }
+    *user_lock = nullptr;
+}
+
+inline bool kmp_user_lock_test( void **user_lock ) {
+    if( kmp_lock_is_direct(user_lock) ) {
+        uintptr_t expected = KMP_LOCK_DIRECT_FREE;
+        return kmp_lock_word(user_lock)->compare_exchange_strong( expected,
+                   KMP_LOCK_DIRECT_HELD, std::memory_order_acquire );
+    }
+    return kmp_lock_indirect(user_lock)->try_lock();
+}
+
+inline void kmp_user_lock_set( void **user_lock ) {
+    if( kmp_lock_is_direct(user_lock) ) {
+        int spins = 0;
+        kmp_user_lock_word *word = kmp_lock_word(user_lock);
+        while( !kmp_user_lock_test(user_lock) ) {
+            while( word->load( std::memory_order_relaxed ) == KMP_LOCK_DIRECT_HELD ) {
+                kmp_lock_spin_wait( spins );
+            }
+        }
+    } else {
+        kmp_lock_indirect(user_lock)->lock();
+    }
+}
+
+inline void kmp_user_lock_unset( void **user_lock ) {
+    if( kmp_lock_is_direct(user_lock) ) {
+        kmp_lock_word(user_lock)->store( KMP_LOCK_DIRECT_FREE, std::memory_order_release );
+    } else {
+        kmp_lock_indirect(user_lock)->unlock();
+    }
+}
+
+//Nest locks are always indirect. The owner is the OpenMP task holding the
+// lock (its omp_task_data), and only the owner touches count.
+class kmp_nest_lock {
+    public:
+        kmp_nest_lock( kmp_indirect_lock *l ) : lck(l) {}
+        ~kmp_nest_lock() { delete lck; }
+
+        int set( void *task ) {
+            if( owner.load( std::memory_order_relaxed ) != task ) {
+                lck->lock();
+                owner.store( task, std::memory_order_relaxed );
+            }
+            return ++count;
+        }
+        int test( void *task ) {
+            if( owner.load( std::memory_order_relaxed ) != task ) {
+                if( !lck->try_lock() ) {
+                    return 0;
+                }
+                owner.store( task, std::memory_order_relaxed );
+            }
+            return ++count;
+        }
+        int unset() {
+            int remaining = --count;
+            if( remaining == 0 ) {
+                owner.store( nullptr, std::memory_order_relaxed );
+                lck->unlock();
+            }
+            return remaining;
+        }
+        bool owned_by( void *task ) const {
+            return owner.load( std::memory_order_relaxed ) == task;
+        }
+        kmp_lock_kind kind() const { return lck->kind; }
+    private:
+        kmp_indirect_lock *lck;
+        std::atomic<void*> owner{nullptr};
+        int count{0};
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "lock_profile.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+using std::cout;
+using std::endl;
+
+static const char* lock_profile_env() {
+    const char *env = getenv("HPXMP_LOCK_PROFILE");
+    if( !env || !strcmp(env, "") || !strcmp(env, "0") ) {
+        return nullptr;
+    }
+    return env;
+}
+
+bool lock_profile_enabled = ( lock_profile_env() != nullptr );
+
+static std::mutex site_mtx;
+static std::map<std::string, std::unique_ptr<lock_profile_site>> sites;
+
+//psource looks like ";file;function;line;column;;", with "unknown" fields
+// when the program was built without debug info
+std::string profile_site_name( const char *kind, const char *psource, const void *caller ) {
+    std::ostringstream name;
+    name << kind << " ";
+    if( psource ) {
+        std::vector<std::string> fields;
+        std::istringstream source(psource);
+        std::string field;
+        while( std::getline(source, field, ';') ) {
+            fields.push_back(field);
+        }
+        if( fields.size() >= 4 && fields[1] != "unknown" ) {
+            name << fields[1] << ":" << fields[3] << " (" << fields[2] << ")";
+            return name.str();
+        }
+    }
+    name << "called from " << caller;
+    return name.str();
+}
+
+lock_profile_site* lock_profile_get_site( const char *kind, const char *psource,
+                                          const void *caller ) {
+    std::string name = profile_site_name( kind, psource, caller );
+    std::lock_guard<std::mutex> guard(site_mtx);
+    std::unique_ptr<lock_profile_site> &site = sites[name];
+    if( !site ) {
+        site.reset( new lock_profile_site(name) );
+    }
+    return site.get();
+}
+
+//Sites sorted by total wait time, times in microseconds
+void lock_profile_report() {
+    const char *env = lock_profile_env();
+    if( !env ) {
+        return;
+    }
+    std::vector<lock_profile_site*> sorted;
+    {
+        std::lock_guard<std::mutex> guard(site_mtx);
+        for( auto &site : sites ) {
+            sorted.push_back( site.second.get() );
+        }
+    }
+    std::sort( sorted.begin(), sorted.end(),
+               []( lock_profile_site *a, lock_profile_site *b ) {
+                   return a->wait_ns > b->wait_ns;
+               } );
+
+    std::ofstream file;
+    bool to_file = strcmp(env, "1") != 0;
+    if( to_file ) {
+        file.open(env);
+        if( !file ) {
+            cout << "HPXMP_LOCK_PROFILE: can't open " << env << ", writing to stdout" << endl;
+            to_file = false;
+        }
+    }
+    std::ostream &out = to_file ? file : cout;
+
+    out << "hpxMP lock profile (times in us)" << endl;
+    out << std::setw(10) << "locks" << std::setw(14) << "acquired"
+        << std::setw(14) << "contended" << std::setw(14) << "wait"
+        << std::setw(12) << "max wait" << std::setw(14) << "hold"
+        << "  site" << endl;
+    for( lock_profile_site *site : sorted ) {
+        out << std::setw(10) << site->locks
+            << std::setw(14) << site->acquisitions
+            << std::setw(14) << site->contended
+            << std::setw(14) << site->wait_ns / 1000
+            << std::setw(12) << site->max_wait_ns / 1000
+            << std::setw(14) << site->hold_ns / 1000
+            << "  " << site->name << endl;
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+#include "kmp_lock.h"
+#include <chrono>
+#include <string>
+
+//Contention profiling for critical sections and user locks, turned on with
+// HPXMP_LOCK_PROFILE=1 (report on stdout) or HPXMP_LOCK_PROFILE=<file>.
+//
+//Profiling only changes how locks are created: a profiled lock is an indirect
+// lock wrapping the real one. With profiling off no lock is wrapped, and the
+// set/unset paths are the same as without the profiler.
+
+//Statistics of all locks created at one source location
+struct lock_profile_site {
+    lock_profile_site( std::string const& site_name ) : name(site_name) {}
+    std::string name;
+    std::atomic<int64_t> locks{0};
+    std::atomic<int64_t> acquisitions{0};
+    std::atomic<int64_t> contended{0};
+    std::atomic<int64_t> wait_ns{0};
+    std::atomic<int64_t> max_wait_ns{0};
+    std::atomic<int64_t> hold_ns{0};
+};
+
+extern bool lock_profile_enabled;
+
+//"<kind> file:line (function)" for a site with psource, or
+// "<kind> called from <caller>" without. Also names the loop profiler's sites.
+std::string profile_site_name( const char *kind, const char *psource, const void *caller );
+
+//kind is "critical", "lock" or "nest_lock". psource is ident_t::psource if
+// the compiler provided one; otherwise the site is named by caller.
+lock_profile_site* lock_profile_get_site( const char *kind, const char *psource,
+                                          const void *caller );
+
+//called from fini_runtime
+void lock_profile_report();
+
+class kmp_profiled_lock : public kmp_indirect_lock {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        kmp_profiled_lock( kmp_indirect_lock *l, lock_profile_site *s )
+            : kmp_indirect_lock(l->kind), lck(l), site(s) {}
+        ~kmp_profiled_lock() { delete lck; }
+
+        //Counts the lock at its site once it is in place. Threads racing
+        // to create a critical section's lock each make one, and only the
+        // one that gets installed counts.
+        kmp_profiled_lock* installed() {
+            site->locks++;
+            return this;
+        }
+
+        void lock() {
+            if( !lck->try_lock() ) {
+                clock::time_point start = clock::now();
+                lck->lock();
+                hold_start = clock::now();
+                int64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   hold_start - start ).count();
+                site->contended++;
+                site->wait_ns += wait;
+                int64_t max = site->max_wait_ns.load( std::memory_order_relaxed );
+                while( wait > max &&
+                       !site->max_wait_ns.compare_exchange_weak( max, wait ) ) {
+                }
+            } else {
+                hold_start = clock::now();
+            }
+            site->acquisitions++;
+        }
+        bool try_lock() {
+            if( !lck->try_lock() ) {
+                return false;
+            }
+            hold_start = clock::now();
+            site->acquisitions++;
+            return true;
+        }
+        void unlock() {
+            site->hold_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 clock::now() - hold_start ).count();
+            lck->unlock();
+        }
+    private:
+        kmp_indirect_lock *lck;
+        lock_profile_site *site;
+        clock::time_point hold_start;   // only written by the holder
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include "loop_profile.h"
+#include "intel_hpxMP.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+using std::cout;
+using std::endl;
+
+static const char* loop_profile_env() {
+    const char *env = getenv("HPXMP_LOOP_PROFILE");
+    if( !env || !strcmp(env, "") || !strcmp(env, "0") ) {
+        return nullptr;
+    }
+    return env;
+}
+
+bool loop_profile_enabled = ( loop_profile_env() != nullptr );
+
+static std::mutex site_mtx;
+static std::map<std::string, std::unique_ptr<loop_profile_site>> sites;
+
+//Loops are entered by every thread each time they run, so each OS thread
+// caches the sites it has seen by ident_t and caller. Without debug info,
+// clang gives every loop the same ident_t, and only the caller tells them
+// apart.
+typedef std::pair<const void*, const void*> site_key;
+
+struct site_key_hash {
+    size_t operator()( site_key const& key ) const {
+        return std::hash<const void*>()( key.first ) * 31 + std::hash<const void*>()( key.second );
+    }
+};
+
+static thread_local std::unordered_map<site_key, loop_profile_site*, site_key_hash> site_cache;
+
+loop_profile_site* loop_profile_get_site( const void *loc, const char *psource,
+                                          const void *caller ) {
+    site_key key( loc, caller );
+    auto cached = site_cache.find( key );
+    if( cached != site_cache.end() ) {
+        return cached->second;
+    }
+    std::string name = profile_site_name( "loop", psource, caller );
+    std::lock_guard<std::mutex> guard(site_mtx);
+    std::unique_ptr<loop_profile_site> &site = sites[name];
+    if( !site ) {
+        site.reset( new loop_profile_site(name) );
+    }
+    return site_cache[key] = site.get();
+}
+
+void loop_profile_record( loop_profile_site *site, int tid, int schedule, int64_t chunk,
+                          int64_t iterations, int64_t chunks, int64_t time_ns ) {
+    std::lock_guard<std::mutex> guard(site->mtx);
+    if( site->threads.size() <= (std::size_t) tid ) {
+        site->threads.resize( tid + 1 );
+    }
+    loop_profile_thread &thread = site->threads[tid];
+    thread.loops++;
+    thread.iterations += iterations;
+    thread.chunks += chunks;
+    thread.time_ns += time_ns;
+    site->schedule = schedule;
+    site->chunk = chunk;
+}
+
+static int unordered_schedule( int schedule ) {
+    if( schedule > kmp_ord_lower && schedule < kmp_ord_upper ) {
+        return schedule - (kmp_ord_lower - kmp_sch_lower);
+    }
+    return schedule;
+}
+
+static bool is_dynamic( int schedule ) {
+    switch( unordered_schedule(schedule) ) {
+        case kmp_sch_dynamic_chunked:
+        case kmp_sch_guided_chunked:
+        case kmp_sch_runtime:
+            return true;
+    }
+    return false;
+}
+
+static std::string schedule_name( int schedule, int64_t chunk ) {
+    std::ostringstream name;
+    switch( unordered_schedule(schedule) ) {
+        case kmp_sch_static:          name << "static"; break;
+        case kmp_sch_static_chunked:  name << "static," << chunk; break;
+        case kmp_sch_dynamic_chunked: name << "dynamic," << chunk; break;
+        case kmp_sch_guided_chunked:  name << "guided," << chunk; break;
+        case kmp_sch_runtime:         name << "runtime"; break;
+        case kmp_sch_auto:            name << "auto"; break;
+        default:                      name << "kind " << schedule; break;
+    }
+    return name.str();
+}
+
+struct loop_profile_summary {
+    loop_profile_site *site;
+    int threads{0};
+    int64_t loops{0};
+    int64_t iterations{0};
+    int64_t chunks{0};
+    int64_t max_ns{0};
+    int64_t total_ns{0};
+    int64_t max_iterations{0};
+    double imbalance{1};        // max over mean time of the threads
+    double iteration_imbalance{1};
+    int64_t idle_ns{0};         // time threads spent waiting on the slowest one
+
+    loop_profile_summary( loop_profile_site *s ) : site(s) {
+        for( loop_profile_thread &thread : site->threads ) {
+            if( thread.loops == 0 ) {
+                continue;
+            }
+            threads++;
+            loops = std::max( loops, thread.loops );
+            iterations += thread.iterations;
+            chunks += thread.chunks;
+            total_ns += thread.time_ns;
+            max_ns = std::max( max_ns, thread.time_ns );
+            max_iterations = std::max( max_iterations, thread.iterations );
+        }
+        if( threads > 0 && total_ns > 0 ) {
+            imbalance = (double) max_ns * threads / total_ns;
+        }
+        if( threads > 0 && iterations > 0 ) {
+            iteration_imbalance = (double) max_iterations * threads / iterations;
+        }
+        idle_ns = max_ns * threads - total_ns;
+    }
+};
+
+//Up to 10% imbalance isn't worth a schedule change. When a balanced
+// dynamic loop spends under 2us on a chunk, handing out chunks costs more
+// than the balancing gains.
+static std::string suggest_schedule( loop_profile_summary const& s ) {
+    int schedule = s.site->schedule;
+    int64_t per_loop = s.loops > 0 ? s.iterations / s.loops : 0;
+    if( s.imbalance < 1.1 ) {
+        if( is_dynamic(schedule) && s.chunks > 0 && s.total_ns / s.chunks < 2000 ) {
+            return "static";
+        }
+        return "-";
+    }
+    if( !is_dynamic(schedule) ) {
+        //The iterations are split evenly, so they differ in cost
+        if( s.iteration_imbalance < 1.1 ) {
+            return "dynamic," + std::to_string( std::max<int64_t>( 1, per_loop / (s.threads * 8) ) );
+        }
+        return "static,1";
+    }
+    //Too few chunks to even out the threads
+    if( s.chunks < 4 * s.threads * s.loops && s.site->chunk > 1 ) {
+        return "dynamic," + std::to_string( std::max<int64_t>( 1, s.site->chunk / 4 ) );
+    }
+    if( unordered_schedule(schedule) != kmp_sch_guided_chunked ) {
+        return "guided";
+    }
+    return "-";
+}
+
+//Sites sorted by idle time, times in microseconds
+void loop_profile_report() {
+    const char *env = loop_profile_env();
+    if( !env ) {
+        return;
+    }
+    std::vector<loop_profile_summary> sorted;
+    {
+        std::lock_guard<std::mutex> guard(site_mtx);
+        for( auto &site : sites ) {
+            std::lock_guard<std::mutex> site_guard(site.second->mtx);
+            sorted.emplace_back( site.second.get() );
+        }
+    }
+    std::sort( sorted.begin(), sorted.end(),
+               []( loop_profile_summary const& a, loop_profile_summary const& b ) {
+                   return a.idle_ns > b.idle_ns;
+               } );
+
+    std::ofstream file;
+    bool to_file = strcmp(env, "1") != 0;
+    if( to_file ) {
+        file.open(env);
+        if( !file ) {
+            cout << "HPXMP_LOOP_PROFILE: can't open " << env << ", writing to stdout" << endl;
+            to_file = false;
+        }
+    }
+    std::ostream &out = to_file ? file : cout;
+
+    out << "hpxMP loop profile (times in us, imbalance is max/mean per thread)" << endl;
+    out << std::setw(8) << "loops" << std::setw(8) << "threads"
+        << std::setw(14) << "iterations" << std::setw(10) << "chunks"
+        << std::setw(12) << "max time" << std::setw(12) << "idle"
+        << std::setw(10) << "time imb" << std::setw(10) << "iter imb"
+        << std::setw(14) << "schedule" << std::setw(14) << "suggested"
+        << "  site" << endl;
+    out << std::fixed << std::setprecision(2);
+    for( loop_profile_summary const& s : sorted ) {
+        out << std::setw(8) << s.loops << std::setw(8) << s.threads
+            << std::setw(14) << s.iterations << std::setw(10) << s.chunks
+            << std::setw(12) << s.max_ns / 1000 << std::setw(12) << s.idle_ns / 1000
+            << std::setw(10) << s.imbalance << std::setw(10) << s.iteration_imbalance
+            << std::setw(14) << schedule_name( s.site->schedule, s.site->chunk )
+            << std::setw(14) << suggest_schedule( s )
+            << "  " << s.site->name << endl;
+    }
+}
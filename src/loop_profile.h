@@ -0,0 +1,82 @@
+#ifndef LOOP_PROFILE_H
+#define LOOP_PROFILE_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//Load imbalance profiling for worksharing loops, turned on with
+// HPXMP_LOOP_PROFILE=1 (report on stdout) or HPXMP_LOOP_PROFILE=<file>.
+//
+//For each loop site and thread number, this adds up the iterations and
+// chunks the thread got, and the time from entering the loop to reaching
+// the barrier after it. For a nowait loop, the time ends at the next loop
+// or barrier, or at the end of the implicit task.
+
+struct loop_profile_thread {
+    int64_t loops{0};
+    int64_t iterations{0};
+    int64_t chunks{0};
+    int64_t time_ns{0};
+};
+
+struct loop_profile_site {
+    loop_profile_site( std::string const& site_name ) : name(site_name) {}
+    std::string name;
+    std::mutex mtx;
+    int schedule{0};                        // the last one used
+    int64_t chunk{0};
+    std::vector<loop_profile_thread> threads;   // by thread number
+};
+
+extern bool loop_profile_enabled;
+
+//loc is the loop's ident_t, caller names the site if it has no psource
+loop_profile_site* loop_profile_get_site( const void *loc, const char *psource,
+                                          const void *caller );
+
+void loop_profile_record( loop_profile_site *site, int tid, int schedule, int64_t chunk,
+                          int64_t iterations, int64_t chunks, int64_t time_ns );
+
+//called from fini_runtime
+void loop_profile_report();
+
+//The loop an implicit task is in
+struct loop_profile_state {
+    typedef std::chrono::steady_clock clock;
+
+    loop_profile_site *site{nullptr};
+    clock::time_point begin;
+    int tid{0};
+    int schedule{0};
+    int64_t chunk{0};
+    int64_t iterations{0};
+    int64_t chunks{0};
+
+    void enter( loop_profile_site *s, int t, int sched, int64_t c ) {
+        leave();
+        site = s;
+        tid = t;
+        schedule = sched;
+        chunk = c;
+        iterations = 0;
+        chunks = 0;
+        begin = clock::now();
+    }
+    void add_chunk( int64_t n ) {
+        iterations += n;
+        chunks++;
+    }
+    void leave() {
+        if( site ) {
+            loop_profile_record( site, tid, schedule, chunk, iterations, chunks,
+                                 std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     clock::now() - begin ).count() );
+            site = nullptr;
+        }
+    }
+};
+
+#endif
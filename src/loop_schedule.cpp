@@ -1,5 +1,6 @@
 #include <iostream>
 #include "loop_schedule.h"
+#include "perf_counters.h"
 #include <thread>
 
 extern boost::shared_ptr<hpx_runtime> hpx_backend;
@@ -9,9 +10,87 @@ using std::endl;
 
 mutex_type print_mtx{};
 
+//OMPT work events. Static loops end in __kmpc_for_static_fini, dispatched
+// loops when a thread finds no chunk left.
+template<typename T, typename D>
+uint64_t loop_trip_count( T lower, T upper, D incr ) {
+    if( incr > 0 ) {
+        return upper < lower ? 0 : (upper - lower) / incr + 1;
+    }
+    if( incr < 0 ) {
+        return lower < upper ? 0 : (lower - upper) / (T)(-incr) + 1;
+    }
+    return upper < lower ? 0 : (upper - lower) + 1;
+}
+
+//KMP_IDENT_WORK_SECTIONS and KMP_IDENT_WORK_DISTRIBUTE
+static ompt_work_t work_kind( ident_t *loc ) {
+    if( loc && (loc->flags & 0x400) )
+        return ompt_work_sections;
+    if( loc && (loc->flags & 0x800) )
+        return ompt_work_distribute;
+    return ompt_work_loop;
+}
+
+static void ompt_work( ident_t *loc, ompt_scope_endpoint_t endpoint, uint64_t count,
+                       const void *codeptr ) {
+    auto *task = hpx_backend->get_task_data();
+    ompt_callbacks.work( work_kind(loc), endpoint, &task->team->ompt_parallel_data,
+                         &task->ompt_task_data, count, codeptr );
+}
+
+//HPXMP_TRACE loop chunks. A static loop is one chunk per thread, ending in
+// __kmpc_for_static_fini.
+static void trace_chunk_open( int64_t lower, int64_t upper ) {
+    if( __builtin_expect( trace_enabled, 0 ) ) {
+        hpx_backend->get_task_data()->loop_chunk.open( lower, upper );
+    }
+}
+
+static void trace_chunk_close() {
+    if( __builtin_expect( trace_enabled, 0 ) ) {
+        hpx_backend->get_task_data()->loop_chunk.close();
+    }
+}
+
+//The compiler passes the gtid, but loops are split by the rank in the team
+static int team_rank() {
+    return hpx_backend ? hpx_backend->get_thread_num() : 0;
+}
+
+//HPXMP_LOOP_PROFILE. A static loop gives a thread all of its chunks at
+// once; the ones of thread tid are counted from the loop's bounds.
+template<typename T, typename D>
+static void loop_profile_static( ident_t *loc, int tid, int schedtype, T lower, T upper,
+                                 D incr, D chunk, const void *codeptr ) {
+    if( __builtin_expect( !loop_profile_enabled, 1 ) ) {
+        return;
+    }
+    auto *task = hpx_backend->get_task_data();
+    int64_t team_size = task->team->num_threads;
+    int64_t trip_count = loop_trip_count( lower, upper, incr );
+    bool chunked = ( schedtype == kmp_sch_static_chunked || schedtype == kmp_ord_static_chunked );
+    if( !chunked || chunk < 1 ) {
+        chunk = ( trip_count + team_size - 1 ) / team_size;
+    }
+    int64_t chunks = 0, iterations = 0;
+    if( trip_count > 0 ) {
+        int64_t total_chunks = ( trip_count + chunk - 1 ) / chunk;
+        chunks = total_chunks / team_size + ( tid < total_chunks % team_size ? 1 : 0 );
+        iterations = chunks * chunk;
+        if( ( total_chunks - 1 ) % team_size == tid ) {
+            iterations -= total_chunks * chunk - trip_count;
+        }
+    }
+    task->loop_profile.enter( loop_profile_get_site( loc, loc ? loc->psource : nullptr, codeptr ),
+                              tid, schedtype, chunked ? (int64_t) chunk : 0 );
+    task->loop_profile.iterations = iterations;
+    task->loop_profile.chunks = chunks;
+}
+
 //D is the signed version of T, for when T is unsigned
 template<typename T, typename D=T>
-void omp_static_init( int gtid, int schedtype, int *p_last_iter,
+void omp_static_init( int tid, int schedtype, int *p_last_iter,
                       T *p_lower, T *p_upper,
                       D *p_stride, D incr, D chunk) {
     int team_size = hpx_backend->get_team()->num_threads;
@@ -21,10 +100,10 @@ void omp_static_init( int gtid, int schedtype, int *p_last_iter,
     int block_size, stride, my_lower, my_upper;
 
     if (schedtype == kmp_sch_static) {
-        *p_last_iter = ( gtid == trip_count - 1 );
+        *p_last_iter = ( tid == trip_count - 1 );
         stride = (trip_count / team_size + adjustment + 1) * incr;
         block_size = (trip_count / team_size + adjustment) * incr;
-        my_lower = *p_lower + gtid * stride;
+        my_lower = *p_lower + tid * stride;
         my_upper = my_lower + block_size;
         if( my_upper > *p_upper ) {
             my_upper = *p_upper;
@@ -32,10 +111,10 @@ void omp_static_init( int gtid, int schedtype, int *p_last_iter,
     } else { //kmp_sch_static_chunked
         int last_lower = *p_lower + trip_count - (trip_count)%chunk;
 
-        my_lower = *p_lower + gtid * incr * chunk;
+        my_lower = *p_lower + tid * incr * chunk;
         my_upper = my_lower + incr * chunk - 1;
         
-        if(trip_count - trip_count%(-chunk*incr) == gtid*incr*chunk + trip_count - trip_count%(chunk*incr*team_size) ) {
+        if(trip_count - trip_count%(-chunk*incr) == tid*incr*chunk + trip_count - trip_count%(chunk*incr*team_size) ) {
             *p_last_iter = 1;
         } else {
             *p_last_iter = 0;
@@ -52,8 +131,17 @@ __kmpc_for_static_init_4( ident_t *loc, int32_t gtid, int32_t schedtype,
                           int32_t *p_last_iter,int32_t *p_lower, int32_t *p_upper, 
                           int32_t *p_stride, int32_t incr, int32_t chunk ) 
 {
-    omp_static_init<int>( gtid, schedtype, p_last_iter, p_lower, p_upper,
+    if( OMPT_ENABLED(work) ) {
+        ompt_work( loc, ompt_scope_begin, loop_trip_count( *p_lower, *p_upper, incr ),
+                   __builtin_return_address(0) );
+    }
+    int tid = team_rank();
+    loop_profile_static( loc, tid, schedtype, *p_lower, *p_upper, incr, chunk,
+                         __builtin_return_address(0) );
+    omp_static_init<int>( tid, schedtype, p_last_iter, p_lower, p_upper,
                           p_stride, incr, chunk );
+    perf_counter_add( perf_chunks_dispatched );
+    trace_chunk_open( *p_lower, *p_upper );
 }
 
 void
@@ -61,8 +149,17 @@ __kmpc_for_static_init_4u( ident_t *loc, int32_t gtid, int32_t schedtype,
                            int32_t *p_last_iter, uint32_t *p_lower, uint32_t *p_upper,
                            int32_t *p_stride, int32_t incr, int32_t chunk )
 {
-    omp_static_init<uint32_t, int>( gtid, schedtype, p_last_iter,
+    if( OMPT_ENABLED(work) ) {
+        ompt_work( loc, ompt_scope_begin, loop_trip_count( *p_lower, *p_upper, incr ),
+                   __builtin_return_address(0) );
+    }
+    int tid = team_rank();
+    loop_profile_static( loc, tid, schedtype, *p_lower, *p_upper, incr, chunk,
+                         __builtin_return_address(0) );
+    omp_static_init<uint32_t, int>( tid, schedtype, p_last_iter,
                                     p_lower, p_upper, p_stride, incr, chunk );
+    perf_counter_add( perf_chunks_dispatched );
+    trace_chunk_open( *p_lower, *p_upper );
 }
 
 void
@@ -71,8 +168,17 @@ __kmpc_for_static_init_8( ident_t *loc, int32_t gtid,
                           int64_t *p_lower, int64_t *p_upper, 
                           int64_t *p_stride, int64_t incr, int64_t chunk ) 
 {
-    omp_static_init<int64_t>( gtid, schedtype, p_last_iter,
+    if( OMPT_ENABLED(work) ) {
+        ompt_work( loc, ompt_scope_begin, loop_trip_count( *p_lower, *p_upper, incr ),
+                   __builtin_return_address(0) );
+    }
+    int tid = team_rank();
+    loop_profile_static( loc, tid, schedtype, *p_lower, *p_upper, incr, chunk,
+                         __builtin_return_address(0) );
+    omp_static_init<int64_t>( tid, schedtype, p_last_iter,
                                p_lower, p_upper, p_stride, incr, chunk );
+    perf_counter_add( perf_chunks_dispatched );
+    trace_chunk_open( *p_lower, *p_upper );
 }
 
 void 
@@ -81,13 +187,25 @@ __kmpc_for_static_init_8u( ident_t *loc, int32_t gtid,
                            uint64_t *p_lower, uint64_t *p_upper,
                            int64_t *p_stride, int64_t incr, int64_t chunk )
 {
-    omp_static_init<uint64_t, int64_t>( gtid, schedtype, p_last_iter,
+    if( OMPT_ENABLED(work) ) {
+        ompt_work( loc, ompt_scope_begin, loop_trip_count( *p_lower, *p_upper, incr ),
+                   __builtin_return_address(0) );
+    }
+    int tid = team_rank();
+    loop_profile_static( loc, tid, schedtype, *p_lower, *p_upper, incr, chunk,
+                         __builtin_return_address(0) );
+    omp_static_init<uint64_t, int64_t>( tid, schedtype, p_last_iter,
                                     p_lower, p_upper, p_stride, incr, chunk );
+    perf_counter_add( perf_chunks_dispatched );
+    trace_chunk_open( *p_lower, *p_upper );
 }
 
 void
 __kmpc_for_static_fini( ident_t *loc, int32_t gtid ){
-    //Only seems to do internal tracking in intel runtime
+    if( OMPT_ENABLED(work) ) {
+        ompt_work( loc, ompt_scope_end, 0, __builtin_return_address(0) );
+    }
+    trace_chunk_close();
 }
 
 //------------------------------------------------------------------------
@@ -96,13 +214,21 @@ __kmpc_for_static_fini( ident_t *loc, int32_t gtid ){
 
 //D is the signed version of T, for when T is unsigned
 template<typename T, typename D=T>
-void scheduler_init( int gtid, int schedtype, T lower, T upper, D stride, D chunk) {
+void scheduler_init( ident_t *loc, int tid, int schedtype, T lower, T upper, D stride, D chunk,
+                     const void *codeptr ) {
+    if( OMPT_ENABLED(work) ) {
+        ompt_work( loc, ompt_scope_begin, loop_trip_count( lower, upper, stride ), codeptr );
+    }
     auto task = hpx_backend->get_task_data();
     auto team = hpx_backend->get_team();
 
     //Is there ever a case where num_threads would be different than the number of threads in a current team?
     int NT = team->num_threads;
-    team->loop_mtx.lock(); //making every thread wait here, until the struct is created.
+    //A team of one has nobody to wait for, and may be a serialized region on
+    // a thread that isn't an HPX thread, where the HPX mutex can't be locked
+    if(NT > 1) {
+        team->loop_mtx.lock(); //making every thread wait here, until the struct is created.
+    }
     if(team->loop_list.size() == task->loop_num) {//first to loop
         if( kmp_ord_lower & schedtype ) {
             schedtype -= (kmp_ord_lower - kmp_sch_lower);
@@ -115,45 +241,55 @@ void scheduler_init( int gtid, int schedtype, T lower, T upper, D stride, D chun
         }
         team->loop_list.emplace_back( loop_data(NT, lower, upper, stride, chunk, schedtype) );
     }
-    team->loop_mtx.unlock();
+    if(NT > 1) {
+        team->loop_mtx.unlock();
+    }
 
-    team->loop_list[task->loop_num].first_iter[gtid] = 0;
-    team->loop_list[task->loop_num].last_iter[gtid]  = 0;
-    team->loop_list[task->loop_num].iter_count[gtid] = 0;
+    team->loop_list[task->loop_num].first_iter[tid] = 0;
+    team->loop_list[task->loop_num].last_iter[tid]  = 0;
+    team->loop_list[task->loop_num].iter_count[tid] = 0;
     task->loop_num++;
+    if( __builtin_expect( loop_profile_enabled, 0 ) ) {
+        task->loop_profile.enter( loop_profile_get_site( loc, loc ? loc->psource : nullptr, codeptr ),
+                                  tid, schedtype, chunk == 0 ? 1 : chunk );
+    }
 }
 
 
 void 
 __kmpc_dispatch_init_4( ident_t *loc, int32_t gtid, enum sched_type schedule,
                         int32_t lb, int32_t ub, int32_t st, int32_t chunk ) {
-    scheduler_init<int32_t>( gtid, schedule, lb, ub, st, chunk );
+    scheduler_init<int32_t>( loc, team_rank(), schedule, lb, ub, st, chunk,
+                             __builtin_return_address(0) );
 }
 
 void
 __kmpc_dispatch_init_4u( ident_t *loc, int32_t gtid, enum sched_type schedule,
                          uint32_t lb, uint32_t ub, 
                          int32_t st, int32_t chunk ) {
-    scheduler_init<uint32_t, int32_t>( gtid, schedule, lb, ub, st, chunk );
+    scheduler_init<uint32_t, int32_t>( loc, team_rank(), schedule, lb, ub, st, chunk,
+                                       __builtin_return_address(0) );
 }
 
 void
 __kmpc_dispatch_init_8( ident_t *loc, int32_t gtid, enum sched_type schedule,
                         int64_t lb, int64_t ub, 
                         int64_t st, int64_t chunk ) {
-    scheduler_init<int64_t>( gtid, schedule, lb, ub, st, chunk );
+    scheduler_init<int64_t>( loc, team_rank(), schedule, lb, ub, st, chunk,
+                             __builtin_return_address(0) );
 }
 
 void
 __kmpc_dispatch_init_8u( ident_t *loc, int32_t gtid, enum sched_type schedule,
                          uint64_t lb, uint64_t ub, 
                          int64_t st, int64_t chunk ) {
-    scheduler_init<uint64_t, int64_t>( gtid, schedule, lb, ub, st, chunk );
+    scheduler_init<uint64_t, int64_t>( loc, team_rank(), schedule, lb, ub, st, chunk,
+                                       __builtin_return_address(0) );
 }
 
 //return one if there is work to be done, zero otherwise
 template<typename T, typename D=T>
-int kmp_next( int gtid, int *p_last, T *p_lower, T *p_upper, D *p_stride ) {
+int kmp_next( int tid, int *p_last, T *p_lower, T *p_upper, D *p_stride ) {
     int current_loop = hpx_backend->get_task_data()->loop_num - 1;
     auto loop_sched = &(hpx_backend->get_team()->loop_list[current_loop]);
     int schedule = loop_sched->schedule;
@@ -166,24 +302,24 @@ int kmp_next( int gtid, int *p_last, T *p_lower, T *p_upper, D *p_stride ) {
         case kmp_sch_static:
         case kmp_ord_static:
 
-            if( loop_sched->iter_count[gtid] > 0 ) {
+            if( loop_sched->iter_count[tid] > 0 ) {
                 return 0;
             } else {
                 loop_sched->schedule_count++;
             }
-            loop_sched->iter_count[gtid] = 1;
+            loop_sched->iter_count[tid] = 1;
 
             *p_lower  = loop_sched->lower;
             *p_upper  = loop_sched->upper;
             *p_stride = loop_sched->stride;
 
-            omp_static_init<T,D>( gtid, kmp_sch_static, p_last,
+            omp_static_init<T,D>( tid, kmp_sch_static, p_last,
                                   p_lower, p_upper, p_stride, 
                                   loop_sched->stride, loop_sched->chunk);
 
             //if(loop_sched->ordered) {
-                loop_sched->first_iter[gtid] = *p_lower / *p_stride ;
-                loop_sched->last_iter[gtid] = *p_upper / *p_stride ;
+                loop_sched->first_iter[tid] = *p_lower / *p_stride ;
+                loop_sched->last_iter[tid] = *p_upper / *p_stride ;
             //}
             return 1;
 
@@ -191,16 +327,16 @@ int kmp_next( int gtid, int *p_last, T *p_lower, T *p_upper, D *p_stride ) {
         case kmp_ord_static_chunked:
 
             loop_sched->schedule_count += loop_sched->chunk;
-            loop_id = loop_sched->iter_count[gtid];
+            loop_id = loop_sched->iter_count[tid];
 
-            loop_sched->first_iter[gtid] = gtid + loop_sched->iter_count[gtid] * loop_sched->stride * loop_sched->num_threads;
-            loop_sched->last_iter[gtid] = loop_sched->first_iter[gtid] + loop_sched->stride;
+            loop_sched->first_iter[tid] = tid + loop_sched->iter_count[tid] * loop_sched->stride * loop_sched->num_threads;
+            loop_sched->last_iter[tid] = loop_sched->first_iter[tid] + loop_sched->stride;
 
-            loop_sched->iter_count[gtid]++;
+            loop_sched->iter_count[tid]++;
 
             *p_stride = loop_sched->stride;
             *p_lower  = loop_sched->lower + loop_sched->chunk * \
-                        ( gtid + loop_sched->num_threads * (*p_stride) * loop_id);
+                        ( tid + loop_sched->num_threads * (*p_stride) * loop_id);
             //FIXME: this logic is wrong
             *p_upper  = *p_lower + (*p_stride) * ( loop_sched->chunk - 1 );
 
@@ -229,8 +365,8 @@ int kmp_next( int gtid, int *p_last, T *p_lower, T *p_upper, D *p_stride ) {
             *p_upper = *p_lower + (loop_sched->chunk - 1) * (*p_stride);
 
             //only used for ordered
-            loop_sched->first_iter[gtid] = loop_id;
-            loop_sched->last_iter[gtid] = loop_sched->first_iter[gtid] + loop_sched->chunk;
+            loop_sched->first_iter[tid] = loop_id;
+            loop_sched->last_iter[tid] = loop_sched->first_iter[tid] + loop_sched->chunk;
             *p_last = 0;
 
             if(*p_lower > loop_sched->upper ) {
@@ -243,35 +379,59 @@ int kmp_next( int gtid, int *p_last, T *p_lower, T *p_upper, D *p_stride ) {
             return 1;
 
         default:
-            if(gtid == 0) {
+            if(tid == 0) {
                 cout << "default, scheduler = " << schedule << endl;
             }
     }
     return 0;
 }
 
+template<typename T, typename D=T>
+int dispatch_next( ident_t *loc, int tid, int *p_last, T *p_lower, T *p_upper, D *p_stride,
+                   const void *codeptr ) {
+    int more = kmp_next<T,D>( tid, p_last, p_lower, p_upper, p_stride );
+    if( more ) {
+        perf_counter_add( perf_chunks_dispatched );
+        trace_chunk_open( *p_lower, *p_upper );
+        if( __builtin_expect( loop_profile_enabled, 0 ) ) {
+            hpx_backend->get_task_data()->loop_profile.add_chunk(
+                loop_trip_count( *p_lower, *p_upper, *p_stride ) );
+        }
+    } else {
+        trace_chunk_close();
+        if( OMPT_ENABLED(work) ) {
+            ompt_work( loc, ompt_scope_end, 0, codeptr );
+        }
+    }
+    return more;
+}
+
 int
 __kmpc_dispatch_next_4( ident_t *loc, int32_t gtid, int32_t *p_last,
                         int32_t *p_lb, int32_t *p_ub, int32_t *p_st ){
-    return kmp_next<int32_t>(gtid, p_last, p_lb, p_ub, p_st);
+    return dispatch_next<int32_t>(loc, team_rank(), p_last, p_lb, p_ub, p_st,
+                                  __builtin_return_address(0));
 }
 
 int
 __kmpc_dispatch_next_4u( ident_t *loc, int32_t gtid, int32_t *p_last,
                         uint32_t *p_lb, uint32_t *p_ub, int32_t *p_st ){
-    return kmp_next<uint32_t, int32_t>(gtid, p_last, p_lb, p_ub, p_st);
+    return dispatch_next<uint32_t, int32_t>(loc, team_rank(), p_last, p_lb, p_ub, p_st,
+                                            __builtin_return_address(0));
 }
 
 int
 __kmpc_dispatch_next_8( ident_t *loc, int32_t gtid, int32_t *p_last,
                         int64_t *p_lb, int64_t *p_ub, int64_t *p_st ){
-    return kmp_next<int64_t>(gtid, p_last, p_lb, p_ub, p_st);
+    return dispatch_next<int64_t>(loc, team_rank(), p_last, p_lb, p_ub, p_st,
+                                  __builtin_return_address(0));
 }
 
 int
 __kmpc_dispatch_next_8u( ident_t *loc, int32_t gtid, int32_t *p_last,
                         uint64_t *p_lb, uint64_t *p_ub, int64_t *p_st ){
-    return kmp_next<uint64_t, int64_t>(gtid, p_last, p_lb, p_ub, p_st);
+    return dispatch_next<uint64_t, int64_t>(loc, team_rank(), p_last, p_lb, p_ub, p_st,
+                                            __builtin_return_address(0));
 }
 
 void __kmpc_dispatch_fini_4( ident_t *loc, kmp_int32 gtid ){
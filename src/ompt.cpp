@@ -0,0 +1,224 @@
+#include "hpx_runtime.h"
+#include <dlfcn.h>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using std::cout;
+using std::endl;
+
+extern boost::shared_ptr<hpx_runtime> hpx_backend;
+
+ompt_callbacks_active ompt_callbacks;
+bool ompt_enabled = false;
+ompt_frame_t ompt_frame_unknown;
+
+//OMPT first appeared in OpenMP 5.0
+static const unsigned int ompt_omp_version = 201811;
+
+static ompt_start_tool_result_t *tool = nullptr;
+static std::atomic<uint64_t> next_unique_id{1};
+
+//thread_end is called from the destructor, as the worker thread exits
+struct ompt_thread_state {
+    ~ompt_thread_state() {
+        if( started ) {
+            OMPT_CALLBACK(thread_end, (&data));
+        }
+    }
+    bool started{false};
+    ompt_data_t data = ompt_data_none;
+};
+
+static thread_local ompt_thread_state thread_state;
+static thread_local ompt_data_t scheduler_task_data = ompt_data_none;
+
+ompt_data_t* ompt_thread_data() {
+    if( !thread_state.started ) {
+        thread_state.started = true;
+        OMPT_CALLBACK(thread_begin, (ompt_thread_worker, &thread_state.data));
+    }
+    return &thread_state.data;
+}
+
+ompt_data_t* ompt_scheduler_task_data() {
+    return &scheduler_task_data;
+}
+
+// ---- entry points ----
+
+static ompt_set_result_t ompt_set_callback( ompt_callbacks_t event, ompt_callback_t callback ) {
+    switch( event ) {
+#define OMPT_SET_CALLBACK(name, type) \
+        case ompt_callback_##name: \
+            ompt_callbacks.name = (type) callback; \
+            break;
+        FOREACH_OMPT_EVENT(OMPT_SET_CALLBACK)
+#undef OMPT_SET_CALLBACK
+        default:
+            return ompt_set_never;
+    }
+    //only loops are reported as work, and taskgroups don't report a sync region
+    if( event == ompt_callback_work || event == ompt_callback_sync_region ||
+        event == ompt_callback_sync_region_wait ) {
+        return ompt_set_sometimes;
+    }
+    return ompt_set_always;
+}
+
+static int ompt_get_callback( ompt_callbacks_t event, ompt_callback_t *callback ) {
+    switch( event ) {
+#define OMPT_GET_CALLBACK(name, type) \
+        case ompt_callback_##name: \
+            *callback = (ompt_callback_t) ompt_callbacks.name; \
+            return *callback != nullptr;
+        FOREACH_OMPT_EVENT(OMPT_GET_CALLBACK)
+#undef OMPT_GET_CALLBACK
+        default:
+            return 0;
+    }
+}
+
+static ompt_data_t* ompt_get_thread_data() {
+    return ompt_thread_data();
+}
+
+static int ompt_get_num_procs() {
+    return hpx::threads::hardware_concurrency();
+}
+
+//Teams don't keep a pointer to their parent, so only the innermost parallel
+// region and task are known.
+static int ompt_get_parallel_info( int ancestor_level, ompt_data_t **parallel_data, int *team_size ) {
+    if( !hpx_backend || ancestor_level != 0 ) {
+        return 0;
+    }
+    parallel_region *team = hpx_backend->get_team();
+    *parallel_data = &team->ompt_parallel_data;
+    *team_size = team->num_threads;
+    return 2;
+}
+
+static int ompt_get_task_info( int ancestor_level, int *flags, ompt_data_t **task_data,
+                               ompt_frame_t **task_frame, ompt_data_t **parallel_data,
+                               int *thread_num ) {
+    if( !hpx_backend || ancestor_level != 0 ) {
+        return 0;
+    }
+    omp_task_data *task = hpx_backend->get_task_data();
+    if( flags )
+        *flags = task->ompt_task_flags;
+    if( task_data )
+        *task_data = &task->ompt_task_data;
+    if( task_frame )
+        *task_frame = &ompt_frame_unknown;
+    if( parallel_data )
+        *parallel_data = &task->team->ompt_parallel_data;
+    if( thread_num )
+        *thread_num = hpx_backend->get_thread_num();
+    return 2;
+}
+
+static uint64_t ompt_get_unique_id() {
+    return next_unique_id++;
+}
+
+static ompt_interface_fn_t ompt_lookup( const char *name ) {
+#define OMPT_LOOKUP(function) \
+    if( !strcmp( name, #function ) ) \
+        return (ompt_interface_fn_t) function;
+    OMPT_LOOKUP(ompt_set_callback)
+    OMPT_LOOKUP(ompt_get_callback)
+    OMPT_LOOKUP(ompt_get_thread_data)
+    OMPT_LOOKUP(ompt_get_num_procs)
+    OMPT_LOOKUP(ompt_get_parallel_info)
+    OMPT_LOOKUP(ompt_get_task_info)
+    OMPT_LOOKUP(ompt_get_unique_id)
+#undef OMPT_LOOKUP
+    return nullptr;
+}
+
+// ---- tool discovery ----
+
+//An ompt_start_tool defined in the application or a preloaded library
+// replaces this one.
+extern "C" __attribute__((weak))
+ompt_start_tool_result_t* ompt_start_tool( unsigned int omp_version, const char *runtime_version ) {
+    return nullptr;
+}
+
+static ompt_start_tool_result_t* start_tool( void *handle ) {
+    ompt_start_tool_t start_tool_fn = (ompt_start_tool_t) dlsym( handle, "ompt_start_tool" );
+    if( !start_tool_fn || start_tool_fn == ompt_start_tool ) {
+        return nullptr;
+    }
+    return start_tool_fn( ompt_omp_version, "hpxMP" );
+}
+
+//The application comes first, then each library in OMP_TOOL_LIBRARIES in
+// order, until one returns a tool.
+static ompt_start_tool_result_t* find_tool() {
+    ompt_start_tool_result_t *result = ompt_start_tool( ompt_omp_version, "hpxMP" );
+    const char *libraries = getenv("OMP_TOOL_LIBRARIES");
+    if( result || !libraries ) {
+        return result;
+    }
+    std::istringstream paths(libraries);
+    std::string path;
+    while( std::getline(paths, path, ':') ) {
+        if( path.empty() ) {
+            continue;
+        }
+        void *handle = dlopen( path.c_str(), RTLD_LAZY );
+        if( !handle ) {
+            cout << "OMP_TOOL_LIBRARIES: can't load " << path << ": " << dlerror() << endl;
+            continue;
+        }
+        result = start_tool( handle );
+        if( result ) {
+            return result;
+        }
+        dlclose( handle );
+    }
+    return nullptr;
+}
+
+void ompt_init() {
+    const char *omp_tool = getenv("OMP_TOOL");
+    if( omp_tool && !strcmp(omp_tool, "disabled") ) {
+        return;
+    }
+    tool = find_tool();
+    if( !tool ) {
+        return;
+    }
+    if( !tool->initialize( ompt_lookup, 0, &tool->tool_data ) ) {
+        //the tool declined, forget whatever it registered
+        ompt_callbacks = ompt_callbacks_active();
+        tool = nullptr;
+        return;
+    }
+    ompt_enabled = true;
+    thread_state.started = true;
+    OMPT_CALLBACK(thread_begin, (ompt_thread_initial, &thread_state.data));
+}
+
+void ompt_fini() {
+    if( !ompt_enabled ) {
+        return;
+    }
+    omp_task_data *initial_task = hpx_backend->get_task_data();
+    OMPT_CALLBACK(implicit_task, (ompt_scope_end, nullptr, &initial_task->ompt_task_data,
+                                  1, 1, ompt_task_initial));
+    if( thread_state.started ) {
+        thread_state.started = false;
+        OMPT_CALLBACK(thread_end, (&thread_state.data));
+    }
+    if( tool->finalize ) {
+        tool->finalize( &tool->tool_data );
+    }
+    ompt_callbacks = ompt_callbacks_active();
+    ompt_enabled = false;
+    tool = nullptr;
+}
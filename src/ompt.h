@@ -0,0 +1,282 @@
+#ifndef OMPT_H
+#define OMPT_H
+
+#include <cstdint>
+
+//OMPT, the OpenMP 5.0 tools interface. The first half of this file is the
+// part of the spec's omp-tools.h that hpxMP implements, with the spec's
+// names and values, so tools built against omp-tools.h work unchanged.
+//
+//A tool is found at startup through ompt_start_tool, defined either in the
+// application (or a library it preloads) or in one of the libraries listed
+// in OMP_TOOL_LIBRARIES, and registers callbacks with ompt_set_callback.
+// OMP_TOOL=disabled skips the search. Without a tool every event site is a single predicted branch on a
+// null callback pointer.
+
+extern "C" {
+
+typedef union ompt_data_t {
+    uint64_t value;
+    void *ptr;
+} ompt_data_t;
+
+#define ompt_data_none {0}
+
+typedef uint64_t ompt_id_t;
+typedef uint64_t ompt_wait_id_t;
+
+typedef struct ompt_frame_t {
+    ompt_data_t exit_frame;
+    ompt_data_t enter_frame;
+    int exit_frame_flags;
+    int enter_frame_flags;
+} ompt_frame_t;
+
+typedef enum ompt_callbacks_t {
+    ompt_callback_thread_begin      = 1,
+    ompt_callback_thread_end        = 2,
+    ompt_callback_parallel_begin    = 3,
+    ompt_callback_parallel_end      = 4,
+    ompt_callback_task_create       = 5,
+    ompt_callback_task_schedule     = 6,
+    ompt_callback_implicit_task     = 7,
+    ompt_callback_sync_region_wait  = 16,
+    ompt_callback_mutex_released    = 17,
+    ompt_callback_work              = 20,
+    ompt_callback_sync_region       = 23,
+    ompt_callback_lock_init         = 24,
+    ompt_callback_lock_destroy      = 25,
+    ompt_callback_mutex_acquire     = 26,
+    ompt_callback_mutex_acquired    = 27,
+    ompt_callback_nest_lock         = 28
+} ompt_callbacks_t;
+
+typedef enum ompt_set_result_t {
+    ompt_set_error            = 0,
+    ompt_set_never            = 1,
+    ompt_set_impossible       = 2,
+    ompt_set_sometimes        = 3,
+    ompt_set_sometimes_paired = 4,
+    ompt_set_always           = 5
+} ompt_set_result_t;
+
+typedef enum ompt_thread_t {
+    ompt_thread_initial = 1,
+    ompt_thread_worker  = 2,
+    ompt_thread_other   = 3,
+    ompt_thread_unknown = 4
+} ompt_thread_t;
+
+typedef enum ompt_scope_endpoint_t {
+    ompt_scope_begin = 1,
+    ompt_scope_end   = 2
+} ompt_scope_endpoint_t;
+
+typedef enum ompt_parallel_flag_t {
+    ompt_parallel_invoker_program = 0x00000001,
+    ompt_parallel_invoker_runtime = 0x00000002,
+    ompt_parallel_league          = 0x40000000,
+    ompt_parallel_team            = 0x80000000
+} ompt_parallel_flag_t;
+
+typedef enum ompt_task_flag_t {
+    ompt_task_initial    = 0x00000001,
+    ompt_task_implicit   = 0x00000002,
+    ompt_task_explicit   = 0x00000004,
+    ompt_task_target     = 0x00000008,
+    ompt_task_undeferred = 0x08000000,
+    ompt_task_untied     = 0x10000000,
+    ompt_task_final      = 0x20000000,
+    ompt_task_mergeable  = 0x40000000,
+    ompt_task_merged     = 0x80000000
+} ompt_task_flag_t;
+
+typedef enum ompt_task_status_t {
+    ompt_task_complete = 1,
+    ompt_task_yield    = 2,
+    ompt_task_cancel   = 3,
+    ompt_task_detach   = 4,
+    ompt_task_early_fulfill = 5,
+    ompt_task_late_fulfill  = 6,
+    ompt_task_switch   = 7
+} ompt_task_status_t;
+
+typedef enum ompt_sync_region_t {
+    ompt_sync_region_barrier                = 1,
+    ompt_sync_region_barrier_implicit       = 2,
+    ompt_sync_region_barrier_explicit       = 3,
+    ompt_sync_region_barrier_implementation = 4,
+    ompt_sync_region_taskwait               = 5,
+    ompt_sync_region_taskgroup              = 6,
+    ompt_sync_region_reduction              = 7
+} ompt_sync_region_t;
+
+typedef enum ompt_work_t {
+    ompt_work_loop            = 1,
+    ompt_work_sections        = 2,
+    ompt_work_single_executor = 3,
+    ompt_work_single_other    = 4,
+    ompt_work_workshare       = 5,
+    ompt_work_distribute      = 6,
+    ompt_work_taskloop        = 7
+} ompt_work_t;
+
+typedef enum ompt_mutex_t {
+    ompt_mutex_lock           = 1,
+    ompt_mutex_test_lock      = 2,
+    ompt_mutex_nest_lock      = 3,
+    ompt_mutex_test_nest_lock = 4,
+    ompt_mutex_critical       = 5,
+    ompt_mutex_atomic         = 6,
+    ompt_mutex_ordered        = 7
+} ompt_mutex_t;
+
+typedef void (*ompt_callback_t)(void);
+typedef void (*ompt_interface_fn_t)(void);
+typedef ompt_interface_fn_t (*ompt_function_lookup_t)(const char *interface_function_name);
+
+typedef int  (*ompt_initialize_t)(ompt_function_lookup_t lookup, int initial_device_num,
+                                  ompt_data_t *tool_data);
+typedef void (*ompt_finalize_t)(ompt_data_t *tool_data);
+
+typedef struct ompt_start_tool_result_t {
+    ompt_initialize_t initialize;
+    ompt_finalize_t finalize;
+    ompt_data_t tool_data;
+} ompt_start_tool_result_t;
+
+typedef ompt_start_tool_result_t* (*ompt_start_tool_t)(unsigned int omp_version,
+                                                       const char *runtime_version);
+
+ompt_start_tool_result_t* ompt_start_tool(unsigned int omp_version, const char *runtime_version);
+
+typedef void (*ompt_callback_thread_begin_t)(ompt_thread_t thread_type, ompt_data_t *thread_data);
+typedef void (*ompt_callback_thread_end_t)(ompt_data_t *thread_data);
+
+typedef void (*ompt_callback_parallel_begin_t)(ompt_data_t *encountering_task_data,
+                                               const ompt_frame_t *encountering_task_frame,
+                                               ompt_data_t *parallel_data,
+                                               unsigned int requested_parallelism,
+                                               int flags, const void *codeptr_ra);
+typedef void (*ompt_callback_parallel_end_t)(ompt_data_t *parallel_data,
+                                             ompt_data_t *encountering_task_data,
+                                             int flags, const void *codeptr_ra);
+
+typedef void (*ompt_callback_task_create_t)(ompt_data_t *encountering_task_data,
+                                            const ompt_frame_t *encountering_task_frame,
+                                            ompt_data_t *new_task_data, int flags,
+                                            int has_dependences, const void *codeptr_ra);
+typedef void (*ompt_callback_task_schedule_t)(ompt_data_t *prior_task_data,
+                                              ompt_task_status_t prior_task_status,
+                                              ompt_data_t *next_task_data);
+typedef void (*ompt_callback_implicit_task_t)(ompt_scope_endpoint_t endpoint,
+                                              ompt_data_t *parallel_data,
+                                              ompt_data_t *task_data,
+                                              unsigned int actual_parallelism,
+                                              unsigned int index, int flags);
+
+typedef void (*ompt_callback_sync_region_t)(ompt_sync_region_t kind,
+                                            ompt_scope_endpoint_t endpoint,
+                                            ompt_data_t *parallel_data,
+                                            ompt_data_t *task_data,
+                                            const void *codeptr_ra);
+typedef void (*ompt_callback_work_t)(ompt_work_t wstype, ompt_scope_endpoint_t endpoint,
+                                     ompt_data_t *parallel_data, ompt_data_t *task_data,
+                                     uint64_t count, const void *codeptr_ra);
+
+typedef void (*ompt_callback_mutex_acquire_t)(ompt_mutex_t kind, unsigned int hint,
+                                              unsigned int impl, ompt_wait_id_t wait_id,
+                                              const void *codeptr_ra);
+typedef void (*ompt_callback_mutex_t)(ompt_mutex_t kind, ompt_wait_id_t wait_id,
+                                      const void *codeptr_ra);
+typedef void (*ompt_callback_nest_lock_t)(ompt_scope_endpoint_t endpoint,
+                                          ompt_wait_id_t wait_id, const void *codeptr_ra);
+
+//entry points handed out by the lookup function
+typedef ompt_set_result_t (*ompt_set_callback_t)(ompt_callbacks_t event, ompt_callback_t callback);
+typedef int (*ompt_get_callback_t)(ompt_callbacks_t event, ompt_callback_t *callback);
+typedef ompt_data_t* (*ompt_get_thread_data_t)(void);
+typedef int (*ompt_get_num_procs_t)(void);
+typedef int (*ompt_get_parallel_info_t)(int ancestor_level, ompt_data_t **parallel_data,
+                                        int *team_size);
+typedef int (*ompt_get_task_info_t)(int ancestor_level, int *flags, ompt_data_t **task_data,
+                                    ompt_frame_t **task_frame, ompt_data_t **parallel_data,
+                                    int *thread_num);
+typedef uint64_t (*ompt_get_unique_id_t)(void);
+
+}
+
+// ---- runtime side ----
+
+//Implementation specific lock kinds, passed as impl to mutex_acquire
+enum kmp_mutex_impl {
+    kmp_mutex_impl_none     = 0,
+    kmp_mutex_impl_spin     = 1,
+    kmp_mutex_impl_queuing  = 2,
+    kmp_mutex_impl_speculative = 3
+};
+
+#define FOREACH_OMPT_EVENT(macro) \
+    macro(thread_begin,     ompt_callback_thread_begin_t) \
+    macro(thread_end,       ompt_callback_thread_end_t) \
+    macro(parallel_begin,   ompt_callback_parallel_begin_t) \
+    macro(parallel_end,     ompt_callback_parallel_end_t) \
+    macro(task_create,      ompt_callback_task_create_t) \
+    macro(task_schedule,    ompt_callback_task_schedule_t) \
+    macro(implicit_task,    ompt_callback_implicit_task_t) \
+    macro(sync_region_wait, ompt_callback_sync_region_t) \
+    macro(mutex_released,   ompt_callback_mutex_t) \
+    macro(work,             ompt_callback_work_t) \
+    macro(sync_region,      ompt_callback_sync_region_t) \
+    macro(lock_init,        ompt_callback_mutex_acquire_t) \
+    macro(lock_destroy,     ompt_callback_mutex_t) \
+    macro(mutex_acquire,    ompt_callback_mutex_acquire_t) \
+    macro(mutex_acquired,   ompt_callback_mutex_t) \
+    macro(nest_lock,        ompt_callback_nest_lock_t)
+
+#define OMPT_DECLARE_CALLBACK(event, type) type event;
+struct ompt_callbacks_active {
+    FOREACH_OMPT_EVENT(OMPT_DECLARE_CALLBACK)
+};
+#undef OMPT_DECLARE_CALLBACK
+
+//Only written while the tool initializes, before the first parallel region.
+extern ompt_callbacks_active ompt_callbacks;
+extern bool ompt_enabled;
+
+//Frames aren't tracked; every frame reported to the tool is this empty one.
+extern ompt_frame_t ompt_frame_unknown;
+
+#define OMPT_ENABLED(event) __builtin_expect( ompt_callbacks.event != nullptr, 0 )
+
+//Calls the tool's callback for event, if it registered one. args are only
+// evaluated when it did.
+#define OMPT_CALLBACK(event, args) \
+    do { \
+        if( OMPT_ENABLED(event) ) { \
+            ompt_callbacks.event args; \
+        } \
+    } while(0)
+
+//Looks for a tool and initializes it; called when the runtime starts.
+void ompt_init();
+
+//Ends the initial thread and finalizes the tool; called from fini_runtime
+// after HPX stopped, so the worker threads have ended.
+void ompt_fini();
+
+//The calling OS thread's tool data. Worker threads are announced to the
+// tool the first time they run an OpenMP task, and ended when they exit.
+ompt_data_t* ompt_thread_data();
+
+inline void ompt_thread_begin() {
+    if( __builtin_expect( ompt_enabled, 0 ) ) {
+        ompt_thread_data();
+    }
+}
+
+//Stand-in for the prior/next task of task_schedule when a task starts or
+// ends on an HPX thread, where the task that ran before isn't known.
+ompt_data_t* ompt_scheduler_task_data();
+
+#endif
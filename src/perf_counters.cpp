@@ -0,0 +1,82 @@
+#include "perf_counters.h"
+#include <hpx/include/performance_counters.hpp>
+#include <algorithm>
+#include <string>
+
+namespace pc = hpx::performance_counters;
+
+perf_counter_slot perf_counter_slots[PERF_COUNTER_WORKERS + 1];
+bool perf_timing_enabled = false;
+
+static const struct {
+    const char *name;
+    const char *help;
+    const char *unit;
+} perf_counter_types[perf_num_counters] = {
+    { "/hpxmp/parallel-regions",
+      "returns the number of parallel regions started", "" },
+    { "/hpxmp/tasks/created",
+      "returns the number of explicit tasks created", "" },
+    { "/hpxmp/tasks/executed-inline",
+      "returns the number of explicit tasks run right away by the thread creating them", "" },
+    { "/hpxmp/tasks/deferred",
+      "returns the number of explicit tasks handed to the scheduler", "" },
+    { "/hpxmp/barriers/wait-time",
+      "returns the time spent in barriers", "ns" },
+    { "/hpxmp/loops/chunks-dispatched",
+      "returns the number of loop chunks handed out to threads", "" },
+    { "/hpxmp/critical/contended",
+      "returns the number of critical sections that had to wait for another thread", "" },
+    { "/hpxmp/taskwait/wait-time",
+      "returns the time spent in taskwait", "ns" }
+};
+
+//worker is -1 for the total
+static boost::int64_t counter_value( int counter, int worker, bool reset ) {
+    if( worker >= 0 ) {
+        auto &value = perf_counter_slots[worker].values[counter];
+        return reset ? value.exchange(0) : value.load();
+    }
+    boost::int64_t total = 0;
+    for( auto &slot : perf_counter_slots ) {
+        total += reset ? slot.values[counter].exchange(0) : slot.values[counter].load();
+    }
+    return total;
+}
+
+//Instances are locality#0/total and locality#0/worker-thread#N
+static hpx::naming::gid_type create_counter( int counter, pc::counter_info const& info,
+                                             hpx::error_code& ec ) {
+    pc::counter_path_elements paths;
+    pc::get_counter_path_elements( info.fullname_, paths, ec );
+    if( ec ) {
+        return hpx::naming::invalid_gid;
+    }
+    int worker;
+    if( paths.instancename_ == "total" && paths.instanceindex_ == -1 ) {
+        worker = -1;
+    } else if( paths.instancename_ == "worker-thread" && paths.instanceindex_ >= 0 &&
+               paths.instanceindex_ < (boost::int64_t) hpx::get_os_thread_count() ) {
+        worker = (int) std::min<boost::int64_t>( paths.instanceindex_, PERF_COUNTER_WORKERS );
+    } else {
+        HPX_THROWS_IF( ec, hpx::bad_parameter, "hpxmp create_counter",
+                       "invalid counter instance name: " + paths.instancename_ );
+        return hpx::naming::invalid_gid;
+    }
+    if( counter == perf_barrier_wait_ns || counter == perf_taskwait_wait_ns ) {
+        perf_timing_enabled = true;
+    }
+    return pc::detail::create_raw_counter( info,
+               hpx::util::bind( &counter_value, counter, worker, hpx::util::placeholders::_1 ), ec );
+}
+
+void perf_counters_register() {
+    for( int i = 0; i < perf_num_counters; i++ ) {
+        pc::install_counter_type( perf_counter_types[i].name, pc::counter_raw,
+                                  perf_counter_types[i].help,
+                                  hpx::util::bind( &create_counter, i, hpx::util::placeholders::_1,
+                                                   hpx::util::placeholders::_2 ),
+                                  &pc::locality_thread_counter_discoverer,
+                                  HPX_PERFORMANCE_COUNTER_V1, perf_counter_types[i].unit );
+    }
+}
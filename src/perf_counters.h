@@ -0,0 +1,66 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <hpx/hpx.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+//Runtime statistics published as HPX performance counters, e.g.
+//  --hpx:print-counter=/hpxmp{locality#0/total}/tasks/created
+//  --hpx:print-counter=/hpxmp{locality#0/worker-thread#*}/barriers/wait-time
+//Each worker counts into its own cache line; the total instance adds them
+// up. Threads that aren't HPX workers count into an extra slot that only
+// shows up in the total.
+enum perf_counter {
+    perf_parallel_regions,
+    perf_tasks_created,
+    perf_tasks_inline,
+    perf_tasks_deferred,
+    perf_barrier_wait_ns,
+    perf_chunks_dispatched,
+    perf_critical_contended,
+    perf_taskwait_wait_ns,
+    perf_num_counters
+};
+
+//Workers past this share the last slot
+#define PERF_COUNTER_WORKERS 256
+
+struct alignas(64) perf_counter_slot {
+    std::atomic<int64_t> values[perf_num_counters];
+};
+
+extern perf_counter_slot perf_counter_slots[PERF_COUNTER_WORKERS + 1];
+
+//The wait times need two clock reads per wait, so they are only measured
+// once one of the wait-time counters was created.
+extern bool perf_timing_enabled;
+
+inline void perf_counter_add( perf_counter counter, int64_t n = 1 ) {
+    std::size_t worker = hpx::get_worker_thread_num();
+    if( worker >= PERF_COUNTER_WORKERS ) {
+        worker = PERF_COUNTER_WORKERS;
+    }
+    perf_counter_slots[worker].values[counter].fetch_add( n, std::memory_order_relaxed );
+}
+
+//Start of a wait, 0 when the wait times aren't measured
+inline uint64_t perf_wait_begin() {
+    if( !perf_timing_enabled ) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+inline void perf_wait_end( perf_counter counter, uint64_t begin ) {
+    if( begin != 0 ) {
+        perf_counter_add( counter, perf_wait_begin() - begin );
+    }
+}
+
+//called from the HPX startup function
+void perf_counters_register();
+
+#endif
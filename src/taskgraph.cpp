@@ -0,0 +1,98 @@
+#include "taskgraph.h"
+#include <hpx/hpx.hpp>
+#include <hpx/lcos/local/spinlock.hpp>
+#include <map>
+#include <mutex>
+
+typedef hpx::lcos::local::spinlock tg_mutex_type;
+
+bool taskgraph::begin()
+{
+    if( in_use.exchange( true ) ) {
+        return false;
+    }
+    next_node = 0;
+    if( recorded ) {
+        mode = replaying;
+        //the creation of a node counts as one of its predecessors, so a node
+        // is not started before its task exists
+        for( size_t i = 0; i < nodes.size(); i++ ) {
+            pending[i].store( nodes[i].num_predecessors + 1, std::memory_order_relaxed );
+        }
+    } else {
+        mode = recording;
+        nodes.clear();
+    }
+    return true;
+}
+
+void taskgraph::end()
+{
+    if( mode == recording ) {
+        recorded = !nodes.empty();
+        pending.reset( new std::atomic<int>[nodes.size()] );
+        launch.assign( nodes.size(), nullptr );
+    } else if( mode == replaying && next_node != (int) nodes.size() ) {
+        //the region created fewer tasks than were recorded
+        recorded = false;
+    }
+    mode = off;
+    in_use.store( false );
+}
+
+int taskgraph::record( void *routine, std::vector<taskgraph_dep> const& deps,
+                       std::vector<int> const& predecessors )
+{
+    int index = nodes.size();
+    nodes.emplace_back();
+    nodes[index].routine = routine;
+    nodes[index].deps = deps;
+    for( int predecessor : predecessors ) {
+        if( predecessor < 0 ) {
+            continue;
+        }
+        auto &successors = nodes[predecessor].successors;
+        if( successors.empty() || successors.back() != index ) {
+            successors.push_back( index );
+            nodes[index].num_predecessors++;
+        }
+    }
+    return index;
+}
+
+int taskgraph::replay_next( void *routine, std::vector<taskgraph_dep> const& deps )
+{
+    if( next_node < (int) nodes.size() && nodes[next_node].routine == routine
+            && nodes[next_node].deps == deps ) {
+        return next_node++;
+    }
+    return -1;
+}
+
+void taskgraph::abandon()
+{
+    mode = off;
+    recorded = false;
+}
+
+static tg_mutex_type graphs_mtx;
+static std::map<int, taskgraph*> graphs;
+
+taskgraph* taskgraph_get( int id )
+{
+    std::lock_guard<tg_mutex_type> lk(graphs_mtx);
+    taskgraph *&graph = graphs[id];
+    if( !graph ) {
+        graph = new taskgraph;
+    }
+    return graph;
+}
+
+void taskgraph_fini()
+{
+    std::lock_guard<tg_mutex_type> lk(graphs_mtx);
+    for( auto &graph : graphs ) {
+        delete graph.second;
+    }
+    graphs.clear();
+}
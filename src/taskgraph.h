@@ -0,0 +1,87 @@
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+//Recorded graphs of dependent tasks, for regions between kmp_taskgraph_begin
+// and kmp_taskgraph_end (or __kmpc_start_record_task and
+// __kmpc_end_record_task) that create the same tasks every time they run.
+//
+//The first run resolves dependences through the task's dependence map as
+// usual, and records each dependent task's routine and dependences, and which
+// earlier tasks it waits for. Later runs still create the tasks, so their
+// firstprivate values are current, but each task is matched against its
+// recorded node: it waits on a counter of its predecessors and is started by
+// the last one to finish, with no map lookups or dataflow. A task that does
+// not match ends the replay; the graph is recorded again on the next run.
+
+struct taskgraph_dep {
+    int64_t addr;
+    size_t len;
+    bool out;
+    bool operator==( taskgraph_dep const& other ) const {
+        return addr == other.addr && len == other.len && out == other.out;
+    }
+};
+
+struct taskgraph_node {
+    void *routine;
+    std::vector<taskgraph_dep> deps;
+    std::vector<int> successors;
+    int num_predecessors{0};
+};
+
+class taskgraph {
+    public:
+        enum run_mode { off, recording, replaying };
+
+        //Starts a run of the region; false if the graph is already running
+        bool begin();
+        //Ends the run, the tasks of the run must have finished
+        void end();
+
+        //Adds the next node and returns it. Its predecessors are the nodes of
+        // the tasks that the dependence map made it wait for.
+        int record( void *routine, std::vector<taskgraph_dep> const& deps,
+                    std::vector<int> const& predecessors );
+
+        //Matches the next created task against the recorded nodes. Returns
+        // the node, or -1 if the task differs.
+        int replay_next( void *routine, std::vector<taskgraph_dep> const& deps );
+
+        //Stops recording or replaying for the rest of the run, and drops the
+        // graph. The replayed tasks must have finished.
+        void abandon();
+
+        //Counts a node's predecessor, or its own creation, as done; true if
+        // the node is ready then.
+        bool release( int node ) {
+            return pending[node].fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+
+        run_mode mode{off};
+        std::vector<taskgraph_node> nodes;
+        //What runs a replayed node, set when the task is created
+        std::vector<std::function<void()>> launch;
+        //Replayed tasks that were created and did not finish yet
+        std::atomic<int> active{0};
+
+    private:
+        bool recorded{false};
+        int next_node{0};
+        std::atomic<bool> in_use{false};
+        std::unique_ptr<std::atomic<int>[]> pending;
+};
+
+//The graph of a region id, created on first use
+taskgraph* taskgraph_get( int id );
+
+//called from fini_runtime
+void taskgraph_fini();
+
+#endif
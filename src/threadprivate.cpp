@@ -0,0 +1,151 @@
+#include "threadprivate.h"
+#include <hpx/hpx.hpp>
+#include <hpx/lcos/local/spinlock.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+typedef hpx::lcos::local::spinlock tp_mutex_type;
+
+//Copies are cache line aligned, and large ones get whole pages, so copies
+// of different threads never share a line or a page. A copy is created and
+// filled by the thread that uses it, so first touch places its pages on that
+// thread's NUMA node.
+static void* allocate_copy( size_t size ) {
+    size_t align = size >= 4096 ? 4096 : 64;
+    size_t padded = (size + align - 1) / align * align;
+    void *copy = nullptr;
+    if( posix_memalign( &copy, align, padded ) != 0 ) {
+        throw std::bad_alloc();
+    }
+    return copy;
+}
+
+//The table in *cache is preceded by one slot holding its capacity, so the
+// fast path can bounds check it without finding the variable.
+static void** allocate_table( intptr_t capacity ) {
+    void **block = new void*[capacity + 1]();
+    block[0] = (void*) capacity;
+    return block + 1;
+}
+
+static intptr_t table_capacity( void **table ) {
+    return (intptr_t) table[-1];
+}
+
+static void free_table( void **table ) {
+    delete[] (table - 1);
+}
+
+//The bookkeeping of a variable. The compiler's cache only holds the table of
+// copies, since compilers may read (*cache)[gtid] themselves.
+class threadprivate_var {
+    public:
+        threadprivate_var( void *d, size_t s, void ***c )
+            : data(d), size(s), cache(c)
+        {
+            grow( hpx::get_os_thread_count() );
+        }
+
+        ~threadprivate_var() {
+            for( auto copy : copies ) {
+                free( copy );
+            }
+            for( auto old : old_tables ) {
+                free_table( old );
+            }
+            free_table( *cache );
+            *cache = nullptr;
+        }
+
+        //Called with mtx held, when the table has no entry for gtid yet
+        void* create( int gtid ) {
+            grow( gtid + 1 );
+            void **table = *cache;
+            if( !table[gtid] ) {
+                void *copy = data;
+                if( gtid > 0 ) {
+                    copy = allocate_copy( size );
+                    std::memcpy( copy, data, size );
+                    copies.push_back( copy );
+                }
+                __atomic_store_n( &table[gtid], copy, __ATOMIC_RELEASE );
+            }
+            return table[gtid];
+        }
+
+        tp_mutex_type mtx;
+
+    private:
+        //Nested teams take gtids beyond the number of workers. Old tables
+        // stay alive until shutdown, since other threads may still be reading
+        // them.
+        void grow( int min_capacity ) {
+            void **old_table = *cache;
+            intptr_t old_capacity = old_table ? table_capacity( old_table ) : 0;
+            if( min_capacity <= old_capacity ) {
+                return;
+            }
+            intptr_t new_capacity = std::max( (intptr_t) min_capacity, 2 * old_capacity );
+            void **new_table = allocate_table( new_capacity );
+            for( intptr_t i = 0; i < old_capacity; i++ ) {
+                new_table[i] = old_table[i];
+            }
+            __atomic_store_n( cache, new_table, __ATOMIC_RELEASE );
+            if( old_table ) {
+                old_tables.push_back( old_table );
+            }
+        }
+
+        void *data;
+        size_t size;
+        void ***cache;
+        std::vector<void*> copies;
+        std::vector<void**> old_tables;
+};
+
+static tp_mutex_type registry_mtx;
+static std::unordered_map<void***, threadprivate_var*> registry;
+
+static threadprivate_var* get_var( void *data, size_t size, void ***cache ) {
+    std::lock_guard<tp_mutex_type> lk(registry_mtx);
+    threadprivate_var *&var = registry[cache];
+    if( !var ) {
+        var = new threadprivate_var( data, size, cache );
+    }
+    return var;
+}
+
+void* threadprivate_get( void *data, size_t size, void ***cache, int gtid ) {
+    if( gtid < 0 ) {
+        return data;
+    }
+    void **table = __atomic_load_n( cache, __ATOMIC_ACQUIRE );
+    if( table && gtid < table_capacity( table ) ) {
+        void *copy = __atomic_load_n( &table[gtid], __ATOMIC_ACQUIRE );
+        if( copy ) {
+            return copy;
+        }
+    }
+    threadprivate_var *var = get_var( data, size, cache );
+    std::lock_guard<tp_mutex_type> lk(var->mtx);
+    return var->create( gtid );
+}
+
+void threadprivate_copyin( void *data, size_t size, void ***cache, int gtid ) {
+    void *copy = threadprivate_get( data, size, cache, gtid );
+    if( copy != data ) {
+        std::memcpy( copy, data, size );
+    }
+}
+
+void threadprivate_fini() {
+    std::lock_guard<tp_mutex_type> lk(registry_mtx);
+    for( auto entry : registry ) {
+        delete entry.second;
+    }
+    registry.clear();
+}
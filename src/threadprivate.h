@@ -0,0 +1,27 @@
+#ifndef THREADPRIVATE_H
+#define THREADPRIVATE_H
+
+#include <cstddef>
+
+//Threadprivate variables. Each variable keeps a table of copies indexed by
+// gtid, which no two threads running at the same time share; a deferred
+// task on an HPX thread of its own counts as a thread here (see
+// acquire_gtid and task_setup in hpx_runtime.cpp). gtid 0, the initial thread, uses the
+// original variable, so its values carry over between serial and parallel
+// parts, and copyin can broadcast from it. The master of a team has the gtid
+// of the thread that forked it, so a nested team's master uses the copy of
+// its parent thread.
+//
+//cache is the compiler provided per-variable cache pointer. It holds the table
+// of copies, as compilers may read (*cache)[gtid] without calling the
+// runtime; the runtime keeps the rest of its bookkeeping on the side.
+
+void* threadprivate_get( void *data, size_t size, void ***cache, int gtid );
+
+//Copies the initial thread's value into the calling thread's copy.
+void threadprivate_copyin( void *data, size_t size, void ***cache, int gtid );
+
+//Frees every copy and resets the compiler caches; called from fini_runtime.
+void threadprivate_fini();
+
+#endif
@@ -0,0 +1,202 @@
+#include "trace.h"
+#include <hpx/hpx.hpp>
+#include <dlfcn.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::cout;
+using std::endl;
+
+static const char* trace_file() {
+    const char *env = getenv("HPXMP_TRACE");
+    if( !env || !strcmp(env, "") || !strcmp(env, "0") ) {
+        return nullptr;
+    }
+    return env;
+}
+
+bool trace_enabled = ( trace_file() != nullptr );
+
+//64K events (2.5MB) per thread
+static const uint64_t trace_buffer_size = 1 << 16;
+
+struct trace_event {
+    uint64_t begin;
+    uint64_t end;
+    int64_t arg0;
+    int64_t arg1;
+    trace_kind kind;
+};
+
+//Only the owning thread writes; the buffers are read once all threads that
+// write them have stopped.
+struct trace_buffer {
+    trace_buffer( std::string const& n, int t ) : name(n), tid(t), events(trace_buffer_size) {}
+    std::string name;
+    int tid;
+    std::atomic<uint64_t> count{0};
+    std::vector<trace_event> events;
+};
+
+static std::mutex buffers_mtx;
+static std::vector<trace_buffer*> buffers;
+static thread_local trace_buffer *local_buffer = nullptr;
+static uint64_t trace_start_time = trace_now();
+
+uint64_t trace_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+//Workers are named after their HPX worker number, other threads (the
+// program's main thread) are numbered after them.
+static trace_buffer* register_buffer() {
+    std::size_t worker = hpx::get_worker_thread_num();
+    std::lock_guard<std::mutex> lk(buffers_mtx);
+    trace_buffer *buffer;
+    if( worker != std::size_t(-1) ) {
+        buffer = new trace_buffer( "worker " + std::to_string(worker), (int) worker );
+    } else {
+        int others = 0;
+        for( auto b : buffers ) {
+            if( b->name.compare(0, 6, "thread") == 0 )
+                others++;
+        }
+        buffer = new trace_buffer( "thread " + std::to_string(others), 1000 + others );
+    }
+    buffers.push_back( buffer );
+    return buffer;
+}
+
+void trace_record( trace_kind kind, uint64_t begin, int64_t arg0, int64_t arg1 ) {
+    if( !local_buffer ) {
+        local_buffer = register_buffer();
+    }
+    uint64_t n = local_buffer->count.load( std::memory_order_relaxed );
+    trace_event &event = local_buffer->events[ n & (trace_buffer_size - 1) ];
+    event.begin = begin;
+    event.end = trace_now();
+    event.arg0 = arg0;
+    event.arg1 = arg1;
+    event.kind = kind;
+    local_buffer->count.store( n + 1, std::memory_order_release );
+}
+
+//Exported symbols are named, anything else (like the outlined task bodies
+// compilers generate) becomes module+offset, for addr2line.
+static std::string symbolize( const void *addr, std::map<const void*, std::string> &names ) {
+    auto known = names.find( addr );
+    if( known != names.end() ) {
+        return known->second;
+    }
+    std::ostringstream name;
+    Dl_info info;
+    if( dladdr( addr, &info ) && info.dli_fname ) {
+        if( info.dli_sname && info.dli_saddr == addr ) {
+            name << info.dli_sname;
+        } else {
+            const char *module = strrchr( info.dli_fname, '/' );
+            name << ( module ? module + 1 : info.dli_fname ) << "+0x" << std::hex
+                 << ( (const char*) addr - (const char*) info.dli_fbase );
+        }
+    } else {
+        name << addr;
+    }
+    return names[addr] = name.str();
+}
+
+static std::string escape( std::string const& s ) {
+    std::string out;
+    for( char c : s ) {
+        if( c == '"' || c == '\\' ) {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+static const char* kind_name( trace_kind kind ) {
+    switch( kind ) {
+        case trace_parallel:      return "parallel";
+        case trace_implicit_task: return "implicit task";
+        case trace_task:          return "task";
+        case trace_barrier:       return "barrier";
+        case trace_taskwait:      return "taskwait";
+        case trace_loop_chunk:    return "loop chunk";
+    }
+    return "unknown";
+}
+
+void trace_flush() {
+    const char *file_name = trace_file();
+    if( !file_name ) {
+        return;
+    }
+    trace_enabled = false;
+    std::ofstream out(file_name);
+    if( !out ) {
+        cout << "HPXMP_TRACE: can't open " << file_name << endl;
+        return;
+    }
+    std::map<const void*, std::string> names;
+    std::lock_guard<std::mutex> lk(buffers_mtx);
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << endl;
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"hpxMP\"}}";
+    out << std::fixed << std::setprecision(3);
+    for( trace_buffer *buffer : buffers ) {
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+            << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+
+        uint64_t count = buffer->count.load( std::memory_order_acquire );
+        uint64_t first = count > trace_buffer_size ? count - trace_buffer_size : 0;
+        if( first > 0 ) {
+            cout << "HPXMP_TRACE: " << buffer->name << " dropped its oldest "
+                 << first << " events" << endl;
+        }
+        for( uint64_t i = first; i < count; i++ ) {
+            trace_event &event = buffer->events[ i & (trace_buffer_size - 1) ];
+            std::string name = kind_name( event.kind );
+            if( event.kind == trace_task ) {
+                name = symbolize( (const void*) event.arg0, names );
+            }
+            out << ",\n{\"name\":\"" << escape(name) << "\",\"cat\":\"" << kind_name( event.kind )
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"ts\":" << ( event.begin - trace_start_time ) / 1000.0
+                << ",\"dur\":" << ( event.end - event.begin ) / 1000.0;
+            switch( event.kind ) {
+                case trace_parallel:
+                    out << ",\"args\":{\"threads\":" << event.arg0 << "}";
+                    break;
+                case trace_implicit_task:
+                    out << ",\"args\":{\"thread\":" << event.arg0 << "}";
+                    break;
+                case trace_task:
+                    out << ",\"args\":{\"routine\":\"" << (const void*) event.arg0 << "\"}";
+                    break;
+                case trace_loop_chunk:
+                    out << ",\"args\":{\"lower\":" << event.arg0 << ",\"upper\":" << event.arg1 << "}";
+                    break;
+                default:
+                    break;
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}" << endl;
+    for( trace_buffer *buffer : buffers ) {
+        delete buffer;
+    }
+    buffers.clear();
+}
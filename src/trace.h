@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+
+//Timeline tracing, turned on with HPXMP_TRACE=<file>. The trace is written
+// when the runtime shuts down, in the Chrome trace event format, which
+// chrome://tracing and Perfetto open directly.
+//
+//Every OS thread records into its own ring buffer, so recording takes no
+// lock and no atomic read-modify-write. A full buffer overwrites its oldest
+// events. HPX threads can be suspended and resumed on another worker, so an
+// interval is drawn on the worker where it ended.
+//
+//With tracing off, every trace point is a single predicted branch.
+
+enum trace_kind {
+    trace_parallel,         // fork to join of a parallel region
+    trace_implicit_task,    // arg0 is the thread number
+    trace_task,             // arg0 is the task's routine
+    trace_barrier,
+    trace_taskwait,
+    trace_loop_chunk        // arg0 and arg1 are the chunk's bounds
+};
+
+extern bool trace_enabled;
+
+uint64_t trace_now();
+void trace_record( trace_kind kind, uint64_t begin, int64_t arg0, int64_t arg1 );
+
+//called from fini_runtime, after the workers have stopped
+void trace_flush();
+
+//Start of an interval, 0 when tracing is off
+inline uint64_t trace_begin() {
+    return __builtin_expect( trace_enabled, 0 ) ? trace_now() : 0;
+}
+
+inline void trace_end( trace_kind kind, uint64_t begin, int64_t arg0 = 0, int64_t arg1 = 0 ) {
+    if( __builtin_expect( trace_enabled, 0 ) ) {
+        trace_record( kind, begin, arg0, arg1 );
+    }
+}
+
+//The loop chunk an implicit task is working on, closed when it asks for
+// the next one or the loop ends.
+struct trace_chunk {
+    uint64_t begin{0};
+    int64_t lower{0};
+    int64_t upper{0};
+
+    void open( int64_t l, int64_t u ) {
+        close();
+        begin = trace_now();
+        lower = l;
+        upper = u;
+    }
+    void close() {
+        if( begin != 0 ) {
+            trace_record( trace_loop_chunk, begin, lower, upper );
+            begin = 0;
+        }
+    }
+};
+
+#endif
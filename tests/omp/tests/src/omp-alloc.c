@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <omp.h>
+
+#define N 1000
+
+int main() {
+    int i, errors = 0;
+
+    int *a = (int*) omp_alloc(N * sizeof(int), omp_default_mem_alloc);
+    for(i = 0; i < N; i++)
+        a[i] = i;
+    for(i = 0; i < N; i++)
+        if(a[i] != i)
+            errors++;
+    omp_free(a, omp_default_mem_alloc);
+
+    omp_alloctrait_t aligned_traits[] = { { omp_atk_alignment, 256 } };
+    omp_allocator_handle_t aligned = omp_init_allocator(omp_default_mem_space, 1, aligned_traits);
+    for(i = 1; i < 100000; i *= 7) {
+        void *p = omp_alloc(i, aligned);
+        if((uintptr_t) p % 256 != 0) {
+            printf("error: %d bytes at %p are not 256 byte aligned\n", i, p);
+            errors++;
+        }
+        memset(p, 1, i);
+        omp_free(p, aligned);
+    }
+    omp_destroy_allocator(aligned);
+
+    //A full pool returns NULL with null_fb
+    omp_alloctrait_t pool_traits[] = { { omp_atk_pool_size, 4096 },
+                                       { omp_atk_fallback, omp_atv_null_fb } };
+    omp_allocator_handle_t pool = omp_init_allocator(omp_default_mem_space, 2, pool_traits);
+    void *first = omp_alloc(2048, pool);
+    void *second = omp_alloc(4096, pool);
+    if(!first || second) {
+        printf("error: pool of 4096 bytes gave %p and %p\n", first, second);
+        errors++;
+    }
+    omp_free(first, pool);
+    omp_free(second, pool);
+    omp_destroy_allocator(pool);
+
+    //Scratch buffers allocated in tasks and freed by whichever thread finishes
+    int sums[N];
+#pragma omp parallel
+#pragma omp single
+    for(i = 0; i < N; i++) {
+#pragma omp task firstprivate(i)
+        {
+            int j, *scratch = (int*) omp_calloc(i + 1, sizeof(int), omp_null_allocator);
+            for(j = 0; j <= i; j++)
+                scratch[j] += j;
+            sums[i] = 0;
+            for(j = 0; j <= i; j++)
+                sums[i] += scratch[j];
+            omp_free(scratch, omp_null_allocator);
+        }
+    }
+    for(i = 0; i < N; i++)
+        if(sums[i] != i * (i + 1) / 2)
+            errors++;
+
+    if(errors) {
+        printf("%d errors\n", errors);
+        return 1;
+    }
+    printf("allocators work\n");
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <complex.h>
+#include <omp.h>
+
+//Whether the atomic update below reaches the runtime depends on the
+// compiler: icc calls __kmpc_atomic_cmplx8_add, while clang lowers
+// _Complex double atomics to libatomic. The runtime entry points are also
+// called directly, so they are tested with either compiler.
+typedef struct {
+    int reserved_1;
+    int flags;
+    int reserved_2;
+    int reserved_3;
+    char const *psource;
+} ident_t;
+
+int __kmpc_global_thread_num(ident_t *loc);
+void __kmpc_atomic_cmplx8_add(ident_t *loc, int gtid, double _Complex *lhs, double _Complex rhs);
+void __kmpc_atomic_16(ident_t *loc, int gtid, void *lhs, void *rhs,
+                      void (*f)(void *, void *, void *));
+
+static ident_t loc = { 0, 0x2, 0, 0, ";omp-atomic-complex.c;main;0;0;;" };
+
+static void cmplx8_add(void *out, void *a, void *b) {
+    *(double _Complex *) out = *(double _Complex *) a + *(double _Complex *) b;
+}
+
+static int check(char const *what, double _Complex z, int n) {
+    printf("%s: z = %f + %fi\n", what, creal(z), cimag(z));
+    if(creal(z) != n || cimag(z) != 2*n) {
+        printf("error: expected %d + %di\n", n, 2*n);
+        return 1;
+    }
+    return 0;
+}
+
+int main() {
+    int i, n = 10000, errors = 0;
+    double _Complex z = 0;
+    double _Complex z_add __attribute__((aligned(16))) = 0;
+    double _Complex z_16 __attribute__((aligned(16))) = 0;
+
+#pragma omp parallel for
+    for(i = 0; i < n; i++)
+    {
+#pragma omp atomic
+        z += 1.0 + 2.0*I;
+    }
+    errors += check("atomic", z, n);
+
+#pragma omp parallel for
+    for(i = 0; i < n; i++)
+    {
+        double _Complex one = 1.0 + 2.0*I;
+        int gtid = __kmpc_global_thread_num(&loc);
+        __kmpc_atomic_cmplx8_add(&loc, gtid, &z_add, one);
+        __kmpc_atomic_16(&loc, gtid, &z_16, &one, cmplx8_add);
+    }
+    errors += check("__kmpc_atomic_cmplx8_add", z_add, n);
+    errors += check("__kmpc_atomic_16", z_16, n);
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+
+//clang lowers double atomics to an inline compare and swap, so the runtime
+// entry points, where contended updates are combined, are also called
+// directly. Combining is off by default; it is read on the first contended
+// update, so setting it here is early enough. The values added are small
+// integers, so the sums are exact in any order.
+typedef struct {
+    int reserved_1;
+    int flags;
+    int reserved_2;
+    int reserved_3;
+    char const *psource;
+} ident_t;
+
+int __kmpc_global_thread_num(ident_t *loc);
+void __kmpc_atomic_float8_add(ident_t *loc, int gtid, double *lhs, double rhs);
+void __kmpc_atomic_float8_sub(ident_t *loc, int gtid, double *lhs, double rhs);
+
+static ident_t loc = { 0, 0x2, 0, 0, ";omp-atomic-sum.c;main;0;0;;" };
+
+static int check(char const *what, double sum, double diff, int n) {
+    printf("%s: sum = %f, diff = %f\n", what, sum, diff);
+    if(sum != n || diff != -2.0*n) {
+        printf("error: expected %d and %d\n", n, -2*n);
+        return 1;
+    }
+    return 0;
+}
+
+int main() {
+    int i, n = 1000000, errors = 0;
+    double sum = 0, diff = 0;
+    double sum_rt = 0, diff_rt = 0;
+
+    setenv("HPXMP_ATOMIC_COMBINE", "1", 0);
+
+#pragma omp parallel for
+    for(i = 0; i < n; i++)
+    {
+#pragma omp atomic
+        sum += 1.0;
+#pragma omp atomic
+        diff -= 2.0;
+    }
+    errors += check("atomic", sum, diff, n);
+
+#pragma omp parallel for
+    for(i = 0; i < n; i++)
+    {
+        int gtid = __kmpc_global_thread_num(&loc);
+        __kmpc_atomic_float8_add(&loc, gtid, &sum_rt, 1.0);
+        __kmpc_atomic_float8_sub(&loc, gtid, &diff_rt, 2.0);
+    }
+    errors += check("__kmpc_atomic_float8_add/sub", sum_rt, diff_rt, n);
+
+    return errors ? 1 : 0;
+}
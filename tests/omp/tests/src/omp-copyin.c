@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include <omp.h>
+
+int counter;
+double work[4096];
+#pragma omp threadprivate(counter, work)
+
+int main() {
+    int errors = 0;
+    counter = 42;
+    work[4095] = 1.5;
+
+#pragma omp parallel copyin(counter, work) reduction(+:errors)
+    {
+        if(counter != 42 || work[4095] != 1.5)
+            errors++;
+        counter = omp_get_thread_num();
+    }
+    printf("master counter = %d, errors = %d\n", counter, errors);
+    if(errors != 0 || counter != 0) {
+        printf("error: copyin did not broadcast the master's values\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#include <stdio.h>
+#include <omp.h>
+
+int main() {
+    int i, a = 0, b = 0, c = 0;
+
+#pragma omp parallel for
+    for(i = 0; i < 1000; i++)
+    {
+#pragma omp critical (first)
+        a++;
+#pragma omp critical (second)
+        b += 2;
+#pragma omp critical
+        c += 3;
+    }
+    printf("a = %d, b = %d, c = %d\n", a, b, c);
+    if(a != 1000 || b != 2000 || c != 3000) {
+        printf("error: expected 1000, 2000, 3000\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <omp.h>
+
+int main() {
+    int i, count = 0, nested = 0;
+    omp_lock_t lock, hinted;
+    omp_nest_lock_t nest;
+
+    omp_init_lock(&lock);
+    omp_init_lock_with_hint(&hinted, omp_lock_hint_contended);
+    omp_init_nest_lock(&nest);
+
+#pragma omp parallel for
+    for(i = 0; i < 1000; i++)
+    {
+        omp_set_lock(&lock);
+        count++;
+        omp_unset_lock(&lock);
+
+        omp_set_lock(&hinted);
+        count++;
+        omp_unset_lock(&hinted);
+
+        omp_set_nest_lock(&nest);
+        if(omp_test_nest_lock(&nest) == 2)
+            nested++;
+        omp_unset_nest_lock(&nest);
+        omp_unset_nest_lock(&nest);
+    }
+    omp_destroy_lock(&lock);
+    omp_destroy_lock(&hinted);
+    omp_destroy_nest_lock(&nest);
+
+    printf("count = %d, nested = %d\n", count, nested);
+    if(count != 2000 || nested != 1000) {
+        printf("error: expected 2000 and 1000\n");
+        return 1;
+    }
+    return 0;
+}
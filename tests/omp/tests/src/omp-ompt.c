@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <omp.h>
+
+//A minimal OMPT tool, found by the runtime through ompt_start_tool, that
+// counts events. The types are the ones from omp-tools.h.
+typedef union { uint64_t value; void *ptr; } ompt_data_t;
+typedef void (*ompt_callback_t)(void);
+typedef ompt_callback_t (*ompt_function_lookup_t)(const char *);
+typedef int (*ompt_set_callback_t)(int event, ompt_callback_t callback);
+typedef struct {
+    int (*initialize)(ompt_function_lookup_t lookup, int initial_device_num, ompt_data_t *tool_data);
+    void (*finalize)(ompt_data_t *tool_data);
+    ompt_data_t tool_data;
+} ompt_start_tool_result_t;
+
+enum { parallel_begin = 3, parallel_end = 4, task_create = 5, task_schedule = 6,
+       implicit_task = 7, mutex_released = 17, work = 20, sync_region = 23,
+       mutex_acquired = 27 };
+
+static int counts[32][2];
+
+static void count(int event, int end) {
+    __sync_fetch_and_add(&counts[event][end], 1);
+}
+
+static void on_parallel_begin(ompt_data_t *task, const void *frame, ompt_data_t *parallel,
+                              unsigned int requested, int flags, const void *codeptr) {
+    count(parallel_begin, 0);
+}
+static void on_parallel_end(ompt_data_t *parallel, ompt_data_t *task, int flags, const void *codeptr) {
+    count(parallel_end, 0);
+}
+static void on_task_create(ompt_data_t *parent, const void *frame, ompt_data_t *task,
+                           int flags, int has_deps, const void *codeptr) {
+    task->value = 1;
+    count(task_create, 0);
+}
+static void on_task_schedule(ompt_data_t *prior, int status, ompt_data_t *next) {
+    if(status == 1 && prior->value == 1)       //ompt_task_complete
+        count(task_schedule, 1);
+}
+static void on_implicit_task(int endpoint, ompt_data_t *parallel, ompt_data_t *task,
+                             unsigned int team_size, unsigned int index, int flags) {
+    if(flags & 2)                               //ompt_task_implicit
+        count(implicit_task, endpoint - 1);
+}
+static void on_sync_region(int kind, int endpoint, ompt_data_t *parallel, ompt_data_t *task,
+                           const void *codeptr) {
+    count(sync_region, endpoint - 1);
+}
+static void on_work(int kind, int endpoint, ompt_data_t *parallel, ompt_data_t *task,
+                    uint64_t count_, const void *codeptr) {
+    count(work, endpoint - 1);
+}
+static void on_mutex(int kind, uint64_t wait_id, const void *codeptr) {
+    if(kind == 5)                               //ompt_mutex_critical
+        count(mutex_acquired, 0);
+}
+static void on_mutex_released(int kind, uint64_t wait_id, const void *codeptr) {
+    if(kind == 5)
+        count(mutex_released, 0);
+}
+
+static int initialize(ompt_function_lookup_t lookup, int device, ompt_data_t *tool_data) {
+    ompt_set_callback_t set_callback = (ompt_set_callback_t) lookup("ompt_set_callback");
+    set_callback(parallel_begin, (ompt_callback_t) on_parallel_begin);
+    set_callback(parallel_end,   (ompt_callback_t) on_parallel_end);
+    set_callback(task_create,    (ompt_callback_t) on_task_create);
+    set_callback(task_schedule,  (ompt_callback_t) on_task_schedule);
+    set_callback(implicit_task,  (ompt_callback_t) on_implicit_task);
+    set_callback(sync_region,    (ompt_callback_t) on_sync_region);
+    set_callback(work,           (ompt_callback_t) on_work);
+    set_callback(mutex_acquired, (ompt_callback_t) on_mutex);
+    set_callback(mutex_released, (ompt_callback_t) on_mutex_released);
+    return 1;
+}
+
+static void finalize(ompt_data_t *tool_data) {
+}
+
+static ompt_start_tool_result_t tool = { initialize, finalize, {0} };
+
+ompt_start_tool_result_t* ompt_start_tool(unsigned int omp_version, const char *runtime_version) {
+    return &tool;
+}
+
+int main() {
+    int i, sum = 0, threads = 0;
+
+#pragma omp parallel
+    {
+#pragma omp single
+        threads = omp_get_num_threads();
+
+#pragma omp task
+        {
+#pragma omp critical
+            sum++;
+        }
+#pragma omp taskwait
+
+#pragma omp for
+        for(i = 0; i < 100; i++) {
+        }
+    }
+
+    printf("threads %d, parallel %d/%d, implicit tasks %d/%d, tasks %d/%d\n",
+           threads, counts[parallel_begin][0], counts[parallel_end][0],
+           counts[implicit_task][0], counts[implicit_task][1],
+           counts[task_create][0], counts[task_schedule][1]);
+    printf("sync regions %d/%d, loops %d/%d, critical %d/%d\n",
+           counts[sync_region][0], counts[sync_region][1],
+           counts[work][0], counts[work][1],
+           counts[mutex_acquired][0], counts[mutex_released][0]);
+
+    if(counts[parallel_begin][0] != 1 || counts[parallel_end][0] != 1 ||
+       counts[implicit_task][0] != threads || counts[implicit_task][1] != threads ||
+       counts[task_create][0] != threads || counts[task_schedule][1] != threads ||
+       counts[sync_region][0] == 0 || counts[sync_region][0] != counts[sync_region][1] ||
+       counts[work][0] != threads || counts[work][1] != threads ||
+       counts[mutex_acquired][0] != threads || counts[mutex_released][0] != threads ||
+       sum != threads) {
+        printf("error: unexpected OMPT event counts\n");
+        return 1;
+    }
+    return 0;
+}
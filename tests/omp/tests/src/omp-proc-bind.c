@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <omp.h>
+
+//Run with e.g. OMP_PLACES=cores OMP_PROC_BIND=spread to check the place
+// assignment. Without places, threads are unbound and there is nothing to check.
+int main() {
+    int num_places = omp_get_num_places();
+    int errors = 0;
+
+    printf("proc_bind %d, %d places\n", (int) omp_get_proc_bind(), num_places);
+    if(num_places == 0) {
+        if(omp_get_proc_bind() != omp_proc_bind_false) {
+            printf("error: bound without places\n");
+            return 1;
+        }
+        return 0;
+    }
+
+#pragma omp parallel num_threads(2) proc_bind(spread)
+    {
+        int place = omp_get_place_num();
+        int partition[256];
+        int n = omp_get_partition_num_places(), i, found = 0;
+
+        omp_get_partition_place_nums(partition);
+        for(i = 0; i < n; i++) {
+            if(partition[i] == place)
+                found = 1;
+        }
+#pragma omp critical
+        {
+            printf("thread %d: place %d, partition of %d places\n",
+                   omp_get_thread_num(), place, n);
+            //spread gives each thread its own part of the places
+            if(!found || (num_places >= 2 && n > num_places - 1) ||
+               omp_get_place_num_procs(place) < 1) {
+                errors++;
+            }
+        }
+    }
+
+#pragma omp parallel num_threads(num_places) proc_bind(close)
+    {
+#pragma omp critical
+        {
+            //close puts thread i on place i when there are as many threads as places
+            if(omp_get_place_num() != omp_get_thread_num()) {
+                printf("error: thread %d on place %d\n", omp_get_thread_num(), omp_get_place_num());
+                errors++;
+            }
+        }
+    }
+
+    if(errors) {
+        printf("error: %d threads were placed wrong\n", errors);
+        return 1;
+    }
+    return 0;
+}
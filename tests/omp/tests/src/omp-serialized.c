@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <omp.h>
+
+//Regions with a false if clause or one thread run on the encountering
+// thread, but are still regions of their own.
+int check(int level) {
+    int errors = 0;
+    if(omp_get_num_threads() != 1 || omp_get_thread_num() != 0)
+        errors++;
+    if(omp_get_level() != level || omp_in_parallel())
+        errors++;
+    return errors;
+}
+
+int main() {
+    int errors = 0, i, x = 0, expected = 0, count = 0;
+
+#pragma omp parallel if(0)
+    errors += check(1);
+
+#pragma omp parallel num_threads(1)
+    {
+        errors += check(1);
+#pragma omp parallel if(0)
+        errors += check(2);
+    }
+
+    //Dependent tasks in a team of one run once each, in order
+#pragma omp parallel num_threads(1)
+#pragma omp single
+    for(i = 0; i < 100; i++) {
+#pragma omp task depend(inout: x) shared(x, count) firstprivate(i)
+        {
+            x = (x * 31 + i) % 1000003;
+            count++;
+        }
+    }
+    for(i = 0; i < 100; i++)
+        expected = (expected * 31 + i) % 1000003;
+    if(count != 100 || x != expected) {
+        printf("error: %d tasks ran, x = %d\n", count, x);
+        errors++;
+    }
+
+#pragma omp parallel for num_threads(1) reduction(+:count)
+    for(i = 0; i < 100; i++)
+        count++;
+    if(count != 200)
+        errors++;
+
+    //Dynamic loops and critical sections lock the runtime's mutexes, also
+    // when the region runs on the program's main thread
+    count = 0;
+#pragma omp parallel for num_threads(1) schedule(dynamic, 3)
+    for(i = 0; i < 100; i++) {
+#pragma omp critical
+        count++;
+    }
+#pragma omp parallel if(0)
+    {
+#pragma omp for schedule(guided)
+        for(i = 0; i < 100; i++) {
+#pragma omp critical(named)
+            count++;
+        }
+    }
+    if(count != 200) {
+        printf("error: %d iterations of the dynamic loops ran\n", count);
+        errors++;
+    }
+
+    if(errors) {
+        printf("%d errors\n", errors);
+        return 1;
+    }
+    printf("serialized regions work\n");
+    return 0;
+}
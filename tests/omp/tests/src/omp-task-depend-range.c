@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <omp.h>
+
+#define N 100
+#define BLOCK 8
+
+//Dependences on array sections that overlap without starting at the same
+// address, on a whole array after writes to its sub-blocks, and on a
+// sub-block after the whole array is written again.
+int main() {
+    int k, errors = 0;
+    int a[4 * N + 4] = {0}, b[8] = {0};
+    long tiles[N * BLOCK] = {0}, sum = 0;
+
+#pragma omp parallel
+#pragma omp single
+    {
+        //task k overwrites half of what task k-1 wrote
+        for(k = 0; k < N; k++) {
+#pragma omp task depend(inout: a[4 * k : 8]) firstprivate(k) shared(a, errors)
+            {
+                int j;
+                if(a[4 * k] != k) {
+#pragma omp atomic
+                    errors++;
+                }
+                for(j = 0; j < 8; j++) {
+                    a[4 * k + j] = k + 1;
+                }
+            }
+        }
+
+        for(k = 0; k < N; k++) {
+#pragma omp task depend(out: tiles[k * BLOCK : BLOCK]) firstprivate(k) shared(tiles)
+            {
+                int j;
+                for(j = 0; j < BLOCK; j++) {
+                    tiles[k * BLOCK + j] = k;
+                }
+            }
+        }
+#pragma omp task depend(in: tiles[0 : N * BLOCK]) shared(tiles, sum)
+        {
+            int j;
+            for(j = 0; j < N * BLOCK; j++) {
+                sum += tiles[j];
+            }
+        }
+
+        for(k = 1; k <= 3; k++) {
+#pragma omp task depend(out: b[0 : 8]) firstprivate(k) shared(b)
+            {
+                int j;
+                for(j = 0; j < 8; j++) {
+                    b[j] = 2 * k;
+                }
+            }
+#pragma omp task depend(out: b[2 : 2]) firstprivate(k) shared(b)
+            {
+                b[2] = b[3] = 2 * k + 1;
+            }
+        }
+#pragma omp task depend(out: b[0 : 8]) shared(b)
+        {
+            int j;
+            for(j = 0; j < 8; j++) {
+                b[j] = 10;
+            }
+        }
+#pragma omp task depend(in: b[2 : 2]) shared(b, errors)
+        {
+            if(b[2] != 10 || b[3] != 10) {
+#pragma omp atomic
+                errors++;
+            }
+        }
+    }
+
+    if(errors || sum != (long) BLOCK * N * (N - 1) / 2) {
+        printf("%d errors, sum %ld\n", errors, sum);
+        return 1;
+    }
+    printf("overlapping dependences were ordered\n");
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <omp.h>
+
+#define N 200
+
+//Undeferred dependent tasks wait for their predecessors and then run on the
+// encountering thread, before it creates the next task.
+int main() {
+    int i, errors = 0, x = 0, y = 0;
+
+#pragma omp parallel
+#pragma omp single
+    for(i = 0; i < N; i++) {
+#pragma omp task depend(inout: x) firstprivate(i) shared(x)
+        {
+            if(x != 2 * i) {
+#pragma omp atomic
+                errors++;
+            }
+            x++;
+        }
+        int thread = omp_get_thread_num();
+#pragma omp task if(0) depend(inout: x) firstprivate(i, thread) shared(x, errors)
+        {
+            if(x != 2 * i + 1 || omp_get_thread_num() != thread) {
+#pragma omp atomic
+                errors++;
+            }
+            x++;
+        }
+        //the if(0) task has finished, so x can be read here
+        if(x != 2 * i + 2) {
+#pragma omp atomic
+            errors++;
+        }
+#pragma omp task if(0) depend(in: y) shared(y)
+        y++;
+    }
+
+    if(errors || x != 2 * N || y != N) {
+        printf("%d errors, x = %d, y = %d\n", errors, x, y);
+        return 1;
+    }
+    printf("undeferred dependent tasks ran in order\n");
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <omp.h>
+
+#define N 200
+
+//Priorities only reorder tasks; every task still runs once. Run with
+// OMP_MAX_TASK_PRIORITY set for the priorities to take effect.
+int main() {
+    int i, errors = 0, ran[N] = {0};
+    int max_priority = omp_get_max_task_priority();
+
+#pragma omp parallel
+#pragma omp single
+    for(i = 0; i < N; i++) {
+#pragma omp task priority(i % 4) firstprivate(i) shared(ran)
+        {
+#pragma omp atomic
+            ran[i]++;
+        }
+    }
+
+    //Dependent tasks with priorities keep their order
+    int x = 0;
+#pragma omp parallel
+#pragma omp single
+    for(i = 0; i < N; i++) {
+#pragma omp task priority(N - i) depend(inout: x) firstprivate(i) shared(x)
+        {
+            if(x != i) {
+#pragma omp atomic
+                errors++;
+            }
+            x = i + 1;
+        }
+    }
+
+    for(i = 0; i < N; i++) {
+        if(ran[i] != 1) {
+            printf("error: task %d ran %d times\n", i, ran[i]);
+            errors++;
+        }
+    }
+    if(errors || max_priority < 0) {
+        printf("%d errors\n", errors);
+        return 1;
+    }
+    printf("prioritized tasks ran, max priority %d\n", max_priority);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <omp.h>
+
+//hpxMP extension, see src/taskgraph.h
+void kmp_taskgraph_begin(int id);
+void kmp_taskgraph_end(int id);
+
+#define BLOCKS 16
+#define ITERATIONS 20
+
+//A chain of dependent tasks per block, plus a task reading all the blocks,
+// run as a recorded graph. Every iteration creates the same tasks with new
+// firstprivate values; the last iteration takes another path halfway.
+int main() {
+    int i, b, errors = 0;
+    long blocks[BLOCKS] = {0}, sums[ITERATIONS] = {0};
+
+#pragma omp parallel
+#pragma omp single
+    for(i = 0; i < ITERATIONS; i++) {
+        kmp_taskgraph_begin(1);
+        for(b = 0; b < BLOCKS; b++) {
+#pragma omp task depend(inout: blocks[b]) firstprivate(b, i) shared(blocks)
+            blocks[b] += i;
+            if(i == ITERATIONS - 1 && b == BLOCKS / 2) {
+#pragma omp task depend(inout: blocks[0]) shared(blocks)
+                blocks[0] += 1000;
+            }
+#pragma omp task depend(inout: blocks[b]) firstprivate(b) shared(blocks)
+            blocks[b] *= 2;
+        }
+#pragma omp task depend(in: blocks[0], blocks[BLOCKS / 2], blocks[BLOCKS - 1]) firstprivate(i) shared(blocks, sums)
+        sums[i] = blocks[0] + blocks[BLOCKS / 2] + blocks[BLOCKS - 1];
+        kmp_taskgraph_end(1);
+    }
+
+    long expected = 0;
+    for(i = 0; i < ITERATIONS; i++) {
+        expected = (expected + i) * 2;
+        long first = expected + (i == ITERATIONS - 1 ? 1000 : 0);
+        if(sums[i] != first + 2 * expected) {
+            printf("error: iteration %d summed %ld, expected %ld\n", i, sums[i], first + 2 * expected);
+            errors++;
+        }
+    }
+    for(b = 1; b < BLOCKS; b++) {
+        if(blocks[b] != expected) {
+            printf("error: block %d is %ld, expected %ld\n", b, blocks[b], expected);
+            errors++;
+        }
+    }
+    if(errors) {
+        printf("%d errors\n", errors);
+        return 1;
+    }
+    printf("replayed task graph computed the same values\n");
+    return 0;
+}
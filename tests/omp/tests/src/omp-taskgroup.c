@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <omp.h>
+
+#define STEPS 50
+#define TASKS 16
+
+//A taskgroup per time step and thread, in many short regions
+int main() {
+    int step, errors = 0;
+    int done[STEPS];
+
+    for(step = 0; step < STEPS; step++) {
+        done[step] = 0;
+#pragma omp parallel shared(done)
+        {
+            int i, before;
+#pragma omp taskgroup
+            {
+                for(i = 0; i < TASKS; i++) {
+#pragma omp task shared(done)
+                    {
+#pragma omp atomic
+                        done[step]++;
+                    }
+                }
+            }
+#pragma omp atomic read
+            before = done[step];
+            if(before < TASKS) {
+#pragma omp atomic
+                errors++;
+            }
+        }
+        if(done[step] != TASKS * omp_get_max_threads()) {
+            printf("error: step %d ran %d tasks\n", step, done[step]);
+            errors++;
+        }
+    }
+
+    //An inner taskgroup waits for its own tasks only, the outer one for the
+    // descendants of its tasks too
+    int inner = 0, outer = 0, grandchildren = 0;
+#pragma omp parallel
+#pragma omp single
+    {
+#pragma omp taskgroup
+        {
+            int i;
+            for(i = 0; i < TASKS; i++) {
+#pragma omp task shared(outer, grandchildren)
+                {
+#pragma omp task shared(grandchildren)
+                    {
+#pragma omp atomic
+                        grandchildren++;
+                    }
+#pragma omp atomic
+                    outer++;
+                }
+            }
+#pragma omp taskgroup
+            {
+                for(i = 0; i < TASKS; i++) {
+#pragma omp task shared(inner)
+                    {
+#pragma omp atomic
+                        inner++;
+                    }
+                }
+            }
+            if(inner != TASKS) {
+                printf("error: inner taskgroup ended with %d of %d tasks\n", inner, TASKS);
+                errors++;
+            }
+        }
+        if(outer != TASKS || grandchildren != TASKS) {
+            printf("error: outer taskgroup ended with %d tasks and %d descendants\n",
+                   outer, grandchildren);
+            errors++;
+        }
+    }
+
+    if(errors) {
+        printf("%d errors\n", errors);
+        return 1;
+    }
+    printf("taskgroups wait for their tasks\n");
+    return 0;
+}
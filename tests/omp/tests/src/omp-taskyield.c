@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+
+#define N 64
+#define MAX_POLLS 1000000
+
+//Every thread polls, with taskyield, for values its own tasks produce, and
+// then for a flag one thread's task sets. hpxMP runs queued tasks at the
+// taskyield, so every value has to show up before the polling gives up; a
+// taskwait doesn't help here.
+int main() {
+    int errors = 0, flag = 0;
+
+#pragma omp parallel
+    {
+        int i, ready[N];
+        for(i = 0; i < N; i++) {
+            ready[i] = 0;
+#pragma omp task firstprivate(i) shared(ready)
+            {
+#pragma omp atomic write
+                ready[i] = i + 1;
+            }
+        }
+        for(i = 0; i < N; i++) {
+            int value, polls = 0;
+            do {
+#pragma omp atomic read
+                value = ready[i];
+                if(value == 0) {
+#pragma omp taskyield
+                }
+            } while(value == 0 && ++polls < MAX_POLLS);
+            if(value != i + 1) {
+#pragma omp atomic
+                errors++;
+            }
+        }
+#pragma omp taskwait
+
+#pragma omp single nowait
+        {
+#pragma omp task shared(flag)
+            {
+#pragma omp atomic write
+                flag = 1;
+            }
+        }
+        {
+            int value, polls = 0;
+            do {
+#pragma omp atomic read
+                value = flag;
+                if(value == 0) {
+#pragma omp taskyield
+                }
+            } while(value == 0 && ++polls < MAX_POLLS);
+            if(value != 1) {
+#pragma omp atomic
+                errors++;
+            }
+        }
+    }
+
+    if(errors) {
+        printf("taskyield made no progress: %d errors\n", errors);
+        return 1;
+    }
+    printf("taskyield made progress\n");
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <omp.h>
+
+//Nested teams share the workers of the outer team instead of each asking
+// for a full team, and max-active-levels serializes them entirely.
+int main() {
+    int errors = 0, total = 0;
+    int workers = omp_get_max_threads();
+
+#pragma omp parallel reduction(+:total)
+    {
+#pragma omp parallel num_threads(4)
+        {
+#pragma omp master
+            total += omp_get_num_threads();
+            if(omp_get_level() != 2) {
+#pragma omp atomic
+                errors++;
+            }
+        }
+    }
+    if(total > workers && total > omp_get_thread_limit()) {
+        printf("error: nested teams used %d threads on %d workers\n", total, workers);
+        errors++;
+    }
+
+    omp_set_max_active_levels(1);
+#pragma omp parallel num_threads(2)
+    {
+        int outer_active = omp_get_active_level();
+#pragma omp parallel num_threads(2)
+        {
+            if(omp_get_num_threads() != 1 || omp_get_active_level() != outer_active) {
+#pragma omp atomic
+                errors++;
+            }
+        }
+    }
+    if(omp_get_max_active_levels() != 1) {
+        errors++;
+    }
+
+    omp_set_max_active_levels(workers);
+    omp_set_dynamic(1);
+    if(!omp_get_dynamic()) {
+        errors++;
+    }
+#pragma omp parallel
+    {
+#pragma omp master
+        if(omp_get_num_threads() < 1 || omp_get_num_threads() > workers) {
+            printf("error: dynamic team of %d threads\n", omp_get_num_threads());
+            errors++;
+        }
+    }
+
+    if(errors) {
+        printf("%d errors\n", errors);
+        return 1;
+    }
+    printf("nested teams stay within the workers\n");
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <omp.h>
+
+#define N 1024
+
+//omp_get_thread_num has to be the rank a static loop partitions by, in
+// every region and in nested teams.
+int main() {
+    int owner[N], i, region, errors = 0;
+
+    for(region = 0; region < 3; region++) {
+#pragma omp parallel
+        {
+            int me = omp_get_thread_num();
+#pragma omp for schedule(static)
+            for(i = 0; i < N; i++) {
+                owner[i] = me;
+            }
+#pragma omp for schedule(static)
+            for(i = 0; i < N; i++) {
+                if(owner[i] != me) {
+#pragma omp atomic
+                    errors++;
+                }
+            }
+        }
+    }
+    if(errors) {
+        printf("error: %d iterations went to another thread in the next loop\n", errors);
+        return 1;
+    }
+
+#pragma omp parallel num_threads(2)
+    {
+        int outer = omp_get_thread_num();
+        int seen = 0, inner_threads = 0;
+#pragma omp parallel num_threads(2) reduction(|:seen)
+        {
+            int me = omp_get_thread_num();
+            if(me == 0)
+                inner_threads = omp_get_num_threads();
+            if(me < 0 || me >= omp_get_num_threads()) {
+#pragma omp atomic
+                errors++;
+            } else {
+                seen |= 1 << me;
+            }
+        }
+        if(seen != (1 << inner_threads) - 1) {
+            printf("error: inner team of thread %d had ranks %x\n", outer, seen);
+#pragma omp atomic
+            errors++;
+        }
+    }
+
+    if(errors) {
+        return 1;
+    }
+    printf("thread numbers are consistent\n");
+    return 0;
+}
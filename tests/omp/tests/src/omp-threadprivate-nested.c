@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <omp.h>
+
+int tp = -1;
+#pragma omp threadprivate(tp)
+
+int main() {
+    int errors = 0;
+    omp_set_nested(1);
+#pragma omp parallel num_threads(2) reduction(+:errors)
+    {
+        int outer = omp_get_thread_num();
+        tp = 100 + outer;
+#pragma omp parallel num_threads(3) reduction(+:errors)
+        {
+            int inner = omp_get_thread_num();
+            //The master of the nested team is the thread that forked it
+            if(inner == 0 && tp != 100 + outer) {
+                printf("outer %d: nested master sees %d\n", outer, tp);
+                errors++;
+            }
+            if(inner != 0) {
+                tp = 1000 * (outer + 1) + inner;
+            }
+#pragma omp barrier
+            if(inner != 0 && tp != 1000 * (outer + 1) + inner) {
+                printf("outer %d inner %d: copy shared, sees %d\n", outer, inner, tp);
+                errors++;
+            }
+        }
+        if(tp != 100 + outer) {
+            printf("outer %d: copy changed by nested team to %d\n", outer, tp);
+            errors++;
+        }
+    }
+    if(tp != 100) {
+        printf("initial thread: copy is %d\n", tp);
+        errors++;
+    }
+    if(errors > 0) {
+        printf("omp-threadprivate-nested failed\n");
+        return 1;
+    }
+    printf("omp-threadprivate-nested passed\n");
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <omp.h>
+
+#define NTASKS 400
+#define READS 20000
+
+int tp = -1;
+#pragma omp threadprivate(tp)
+
+//Tasks write the threadprivate copy of the thread running them. No two
+// tasks running at the same time may share a copy, whichever thread created
+// them, so a task with no scheduling point in it reads back what it wrote.
+int main() {
+    int errors = 0;
+#pragma omp parallel
+    {
+        int i;
+#pragma omp for schedule(static)
+        for(i = 0; i < NTASKS; i++) {
+#pragma omp task firstprivate(i) shared(errors)
+            {
+                int j, seen = i;
+                tp = i;
+                for(j = 0; j < READS && seen == i; j++) {
+                    seen = *(volatile int *) &tp;
+                }
+                if(seen != i) {
+#pragma omp atomic
+                    errors++;
+                }
+            }
+        }
+    }
+    if(errors > 0) {
+        printf("omp-threadprivate-task failed: %d tasks saw another task's write\n", errors);
+        return 1;
+    }
+    printf("omp-threadprivate-task passed\n");
+    return 0;
+}